@@ -0,0 +1,80 @@
+{-# OPTIONS_JHC -fffi #-}
+module Control.Concurrent(
+    ThreadId(),
+    myThreadId,
+    forkIO,
+    forkOS,
+    yield,
+    threadDelay,
+    threadWaitRead,
+    threadWaitWrite,
+    rtsSupportsBoundThreads,
+    module Control.Concurrent.MVar,
+    module Control.Concurrent.Chan
+    ) where
+
+import Control.Concurrent.Chan
+import Control.Concurrent.MVar
+import Data.Word
+import Foreign.Ptr
+import Foreign.StablePtr
+
+-- | The main thread is number 0, every forked thread gets the next one.
+newtype ThreadId = ThreadId Word deriving (Eq,Ord)
+
+instance Show ThreadId where
+    showsPrec p (ThreadId n) = showParen (p > 10) $ showString "ThreadId " . showsPrec 11 n
+
+-- | True when the program was compiled with -fthreaded.
+rtsSupportsBoundThreads :: Bool
+rtsSupportsBoundThreads = c_threaded /= 0
+
+myThreadId :: IO ThreadId
+myThreadId = fmap ThreadId c_thread_id
+
+-- | Run an action in a new green thread. Green threads are cheap, they get a
+-- small stack when they first run, and are scheduled cooperatively: a thread
+-- runs until it blocks on an 'MVar', sleeps, yields or returns. With
+-- -fthreaded there is a worker OS thread per processor and idle workers take
+-- threads that have not started yet from busy ones.
+forkIO :: IO () -> IO ThreadId
+forkIO act = do
+    sp <- newStablePtr act
+    n <- c_fork_io (castStablePtrToPtr sp)
+    return (ThreadId n)
+
+-- | Run an action in a new OS thread. With -fthreaded the thread gets a
+-- capability of its own and runs in parallel with the others, otherwise
+-- forkOS is an error. The program exits when the main thread does.
+forkOS :: IO () -> IO ThreadId
+forkOS act = do
+    sp <- newStablePtr act
+    n <- c_fork_os (castStablePtrToPtr sp)
+    return (ThreadId n)
+
+-- called by the runtime in the new thread.
+forkedThread :: Ptr () -> IO ()
+forkedThread p = do
+    let sp = castPtrToStablePtr p
+    act <- deRefStablePtr sp
+    freeStablePtr sp
+    act
+
+-- | Block until the file descriptor can be read from without blocking,
+-- letting the other threads run in the meantime.
+threadWaitRead :: Int -> IO ()
+threadWaitRead fd = c_io_wait fd 0 (-1) >> return ()
+
+-- | Block until the file descriptor can be written to without blocking.
+threadWaitWrite :: Int -> IO ()
+threadWaitWrite fd = c_io_wait fd 1 (-1) >> return ()
+
+foreign export ccall "jhc_thread_entry" forkedThread :: Ptr () -> IO ()
+
+foreign import ccall safe "jhc_fork_io" c_fork_io :: Ptr () -> IO Word
+foreign import ccall safe "jhc_fork_os" c_fork_os :: Ptr () -> IO Word
+foreign import ccall unsafe "jhc_thread_id" c_thread_id :: IO Word
+foreign import ccall safe "jhc_yield" yield :: IO ()
+foreign import ccall safe "jhc_thread_delay" threadDelay :: Int -> IO ()
+foreign import ccall safe "jhc_io_wait" c_io_wait :: Int -> Int -> Int -> IO Bool
+foreign import primitive "const._JHC_THREADED" c_threaded :: Int
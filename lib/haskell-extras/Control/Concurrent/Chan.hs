@@ -0,0 +1,59 @@
+module Control.Concurrent.Chan(
+    Chan(),
+    newChan,
+    writeChan,
+    readChan,
+    dupChan,
+    getChanContents,
+    writeList2Chan
+    ) where
+
+import Control.Concurrent.MVar
+import System.IO.Unsafe(unsafeInterleaveIO)
+
+-- | An unbounded channel. The items are a linked list of 'MVar's, the read
+-- end points at the first one that has not been read and the write end at
+-- the empty one a writer fills next.
+data Chan a = Chan (MVar (Stream a)) (MVar (Stream a))
+
+type Stream a = MVar (ChItem a)
+
+data ChItem a = ChItem a (Stream a)
+
+newChan :: IO (Chan a)
+newChan = do
+    hole <- newEmptyMVar
+    readVar <- newMVar hole
+    writeVar <- newMVar hole
+    return (Chan readVar writeVar)
+
+writeChan :: Chan a -> a -> IO ()
+writeChan (Chan _ writeVar) x = do
+    newHole <- newEmptyMVar
+    oldHole <- takeMVar writeVar
+    putMVar oldHole (ChItem x newHole)
+    putMVar writeVar newHole
+
+readChan :: Chan a -> IO a
+readChan (Chan readVar _) = do
+    readEnd <- takeMVar readVar
+    ChItem x newReadEnd <- readMVar readEnd
+    putMVar readVar newReadEnd
+    return x
+
+-- | A new channel that starts out empty and gets everything written to the
+-- original from now on.
+dupChan :: Chan a -> IO (Chan a)
+dupChan (Chan _ writeVar) = do
+    hole <- readMVar writeVar
+    newReadVar <- newMVar hole
+    return (Chan newReadVar writeVar)
+
+getChanContents :: Chan a -> IO [a]
+getChanContents ch = unsafeInterleaveIO $ do
+    x <- readChan ch
+    xs <- getChanContents ch
+    return (x:xs)
+
+writeList2Chan :: Chan a -> [a] -> IO ()
+writeList2Chan ch = mapM_ (writeChan ch)
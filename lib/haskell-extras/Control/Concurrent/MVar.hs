@@ -0,0 +1,125 @@
+{-# OPTIONS_JHC -fffi #-}
+module Control.Concurrent.MVar(
+    MVar(),
+    newEmptyMVar,
+    newMVar,
+    takeMVar,
+    putMVar,
+    readMVar,
+    swapMVar,
+    tryTakeMVar,
+    tryPutMVar,
+    isEmptyMVar,
+    withMVar,
+    modifyMVar_,
+    modifyMVar
+    ) where
+
+import Data.IORef
+import Data.Word
+
+-- | A synchronising variable, either empty or holding a value. Taking from
+-- an empty 'MVar' or putting into a full one blocks until another thread
+-- has done the opposite, letting the other threads run in the meantime.
+-- Blocking when no other thread can ever fill or empty it is an error.
+--
+-- The key names the lock in the runtime guarding the reference, MVars share
+-- a fixed set of them.
+data MVar a = MVar !Word (IORef (Maybe a))
+
+newEmptyMVar :: IO (MVar a)
+newEmptyMVar = do
+    k <- c_mvar_new
+    r <- newIORef Nothing
+    return (MVar k r)
+
+newMVar :: a -> IO (MVar a)
+newMVar x = do
+    k <- c_mvar_new
+    r <- newIORef (Just x)
+    return (MVar k r)
+
+takeMVar :: MVar a -> IO a
+takeMVar (MVar k r) = c_mvar_lock k >> loop where
+    loop = do
+        v <- readIORef r
+        case v of
+            Nothing -> c_mvar_wait k 1 >> loop
+            Just x -> do
+                writeIORef r Nothing
+                c_mvar_unlock k 0
+                return x
+
+putMVar :: MVar a -> a -> IO ()
+putMVar (MVar k r) x = c_mvar_lock k >> loop where
+    loop = do
+        v <- readIORef r
+        case v of
+            Just _ -> c_mvar_wait k 0 >> loop
+            Nothing -> do
+                writeIORef r (Just x)
+                c_mvar_unlock k 1
+
+readMVar :: MVar a -> IO a
+readMVar (MVar k r) = c_mvar_lock k >> loop where
+    loop = do
+        v <- readIORef r
+        case v of
+            Nothing -> c_mvar_wait k 1 >> loop
+            Just x -> c_mvar_unlock k 1 >> return x
+
+swapMVar :: MVar a -> a -> IO a
+swapMVar m new = do
+    old <- takeMVar m
+    putMVar m new
+    return old
+
+tryTakeMVar :: MVar a -> IO (Maybe a)
+tryTakeMVar (MVar k r) = do
+    c_mvar_lock k
+    v <- readIORef r
+    case v of
+        Just _ -> writeIORef r Nothing
+        Nothing -> return ()
+    c_mvar_unlock k 0
+    return v
+
+tryPutMVar :: MVar a -> a -> IO Bool
+tryPutMVar (MVar k r) x = do
+    c_mvar_lock k
+    v <- readIORef r
+    case v of
+        Nothing -> do
+            writeIORef r (Just x)
+            c_mvar_unlock k 1
+            return True
+        Just _ -> c_mvar_unlock k 1 >> return False
+
+isEmptyMVar :: MVar a -> IO Bool
+isEmptyMVar (MVar _ r) = do
+    v <- readIORef r
+    return $ case v of
+        Nothing -> True
+        Just _ -> False
+
+withMVar :: MVar a -> (a -> IO b) -> IO b
+withMVar m io = do
+    x <- takeMVar m
+    r <- io x
+    putMVar m x
+    return r
+
+modifyMVar_ :: MVar a -> (a -> IO a) -> IO ()
+modifyMVar_ m io = takeMVar m >>= io >>= putMVar m
+
+modifyMVar :: MVar a -> (a -> IO (a,b)) -> IO b
+modifyMVar m io = do
+    x <- takeMVar m
+    (x',b) <- io x
+    putMVar m x'
+    return b
+
+foreign import ccall unsafe "jhc_mvar_new" c_mvar_new :: IO Word
+foreign import ccall safe "jhc_mvar_lock" c_mvar_lock :: Word -> IO ()
+foreign import ccall safe "jhc_mvar_wait" c_mvar_wait :: Word -> Int -> IO ()
+foreign import ccall unsafe "jhc_mvar_unlock" c_mvar_unlock :: Word -> Int -> IO ()
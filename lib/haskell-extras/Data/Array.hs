@@ -15,6 +15,7 @@ module Data.Array (
     ixmap
     ) where
 
+import Data.Array.Base
 import Data.Ix
 import Jhc.Int
 import Jhc.Prim.Array
@@ -22,14 +23,17 @@ import Jhc.Prim.IO
 
 infixl 9  !, //
 
-data Array a b = MkArray !a !a (Array_ b)
+-- The arrays are built by writing the elements into a new MutArray_ which is
+-- then frozen in place, without going through intermediate lists.
 
 array       :: (Ix a) => (a,a) -> [(a,b)] -> Array a b
-array b@(s,e) ivs = case newArray (error "array: missing element") (rangeSize b) [(index b x,y) | (x,y) <- ivs] of
-        arr -> MkArray s e arr
+array b ivs = withNewArray b (error "array: missing element") (writeElems b ivs)
 
 listArray             :: (Ix a) => (a,a) -> [b] -> Array a b
-listArray b vs        =  array b (zipWith (\ a b -> (a,b)) (range b) vs)
+listArray b vs        =  withNewArray b (error "listArray: missing element") (\arr -> f arr 0 vs) where
+    n = rangeSize b
+    f arr i (v:vs) w | i < n = case unboxInt i of i' -> case writeArray__ arr i' v w of w -> f arr (i + 1) vs w
+    f _ _ _ w = w
 
 (!)                   :: (Ix a) => Array a b -> a -> b
 (!) (MkArray s e arr) i =  case unboxInt (index (s,e) i) of i' -> case indexArray__ arr i' of (# r #) -> r
@@ -48,23 +52,25 @@ assocs a              =  [(i, a!i) | i <- indices a]
 
 (//)                  :: (Ix a) => Array a b -> [(a,b)] -> Array a b
 a // []               = a
-a // new_ivs          = array (bounds a) (old_ivs ++ new_ivs)
-                      where
-                  	old_ivs = [(i,a!i) | i <- indices a,
-                                             i `notElem` new_is]
-                  	new_is  = [i | (i,_) <- new_ivs]
+a // new_ivs          = withCopyOf a (writeElems (bounds a) new_ivs)
 
 accum                 :: (Ix a) => (b -> c -> b) -> Array a b -> [(a,c)] -> Array a b
-accum f               =  foldl (\a (i,v) -> a // [(i,f (a!i) v)])
+accum f a ivs         = withCopyOf a (accumElems f (bounds a) ivs)
 
 accumArray            :: (Ix a) => (b -> c -> b) -> b -> (a,a) -> [(a,c)] -> Array a b
-accumArray f z b      =  accum f (array b [(i,z) | i <- range b])
+accumArray f z b ivs  = withNewArray b z (accumElems f b ivs)
 
 ixmap                 :: (Ix a, Ix b) => (a,a) -> (a -> b) -> Array b c -> Array a c
-ixmap b f a           = array b [(i, a ! f i) | i <- range b]
+ixmap b f a           = withNewArray b (error "ixmap: missing element") (\m -> g m 0 (range b)) where
+    g m k (i:is) w = case unboxInt k of k' -> case writeArray__ m k' (a ! f i) w of w -> g m (k + 1) is w
+    g _ _ [] w = w
 
 instance  (Ix a)          => Functor (Array a) where
-    fmap fn a = array (bounds a) [ (a,fn b) | (a,b) <- assocs a ]
+    fmap fn (MkArray s e arr) = withNewArray (s,e) (error "fmap: missing element") (\m -> f m 0) where
+        n = rangeSize (s,e)
+        f m i w | i < n = case unboxInt i of
+            i' -> case indexArray__ arr i' of (# x #) -> case writeArray__ m i' (fn x) w of w -> f m (i + 1) w
+        f _ _ w = w
 
 instance  (Ix a, Eq b)  => Eq (Array a b)  where
     a == a' =  assocs a == assocs a'
@@ -88,16 +94,14 @@ instance  (Ix a, Read a, Read b) => Read (Array a b)  where
 arrPrec :: Int
 arrPrec = 10
 
-foreign import primitive newWorld__ :: a -> World__
-
-newArray :: a -> Int -> [(Int,a)] -> Array_ a
-newArray init n xs = case unboxInt n of
-    n' -> case newWorld__ (init,n,xs) of
-     w -> case newArray__ n' init w of
-      (# w, arr #) -> let
-        f :: MutArray_ a -> World__ -> [(Int,a)] -> World__
-        f arr w [] = w
-        f arr w ((i,v):xs) = case unboxInt i of i' -> case writeArray__ arr i' v w of w -> f arr w xs
-            in case f arr w xs of w -> Array_ arr `worldDep_` w
-
-foreign import primitive "dependingOn" worldDep_ :: Array_ b -> World__ -> Array_ b
+writeElems :: Ix a => (a,a) -> [(a,b)] -> MutArray_ b -> World__ -> World__
+writeElems b ivs arr = f ivs where
+    f [] w = w
+    f ((i,v):ivs) w = case unboxInt (index b i) of i' -> case writeArray__ arr i' v w of w -> f ivs w
+
+accumElems :: Ix a => (b -> c -> b) -> (a,a) -> [(a,c)] -> MutArray_ b -> World__ -> World__
+accumElems g b ivs arr = f ivs where
+    f [] w = w
+    f ((i,v):ivs) w = case unboxInt (index b i) of
+        i' -> case readArray__ arr i' w of
+            (# w, x #) -> case writeArray__ arr i' (g x v) w of w -> f ivs w
@@ -0,0 +1,40 @@
+{-# OPTIONS_JHC -funboxed-tuples #-}
+-- | The representation of boxed arrays, shared by Data.Array and
+-- Data.Array.IO, and the helpers both use to build them in place.
+module Data.Array.Base where
+
+import Data.Ix
+import Jhc.Int
+import Jhc.Prim.Array
+import Jhc.Prim.IO
+
+data Array a b = MkArray !a !a (Array_ b)
+
+-- | @copyMutArray off n arr@ copies @n@ elements of @arr@ starting at @off@
+-- into a new array.
+copyMutArray :: Int -> Int -> MutArray_ a -> UST s (MutArray_ a)
+copyMutArray off n src w = case unboxInt n of
+    n' -> case newBlankArray__ n' w of
+        (# w, dst #) -> case copyArray__ (unboxInt off) (unboxInt 0) n' src dst w of
+            w -> (# w, dst #)
+
+-- | Run the writes of a function on a new array with the given bounds and all
+-- elements set to @init@, then freeze it without copying.
+{-# INLINE withNewArray #-}
+withNewArray :: Ix i => (i,i) -> a -> (MutArray_ a -> World__ -> World__) -> Array i a
+withNewArray b@(s,e) init fill = case newWorld__ (b,init,fill) of
+    w -> case newArray__ (unboxInt (rangeSize b)) init w of
+        (# w, arr #) -> MkArray s e (freezeAfter arr (fill arr w))
+
+-- | Like 'withNewArray', but the new array starts as a copy of another.
+{-# INLINE withCopyOf #-}
+withCopyOf :: Ix i => Array i a -> (MutArray_ a -> World__ -> World__) -> Array i a
+withCopyOf a@(MkArray s e src) fill = case newWorld__ (a,fill) of
+    w -> case unsafeThawArray__ src w of
+        (# w, src' #) -> case copyMutArray 0 (rangeSize (s,e)) src' w of
+            (# w, arr #) -> MkArray s e (freezeAfter arr (fill arr w))
+
+freezeAfter :: MutArray_ a -> World__ -> Array_ a
+freezeAfter arr w = case unsafeFreezeArray__ arr w of (# _, r #) -> r
+
+foreign import primitive newWorld__ :: a -> World__
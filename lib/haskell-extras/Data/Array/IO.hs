@@ -2,9 +2,20 @@
 module Data.Array.IO where
 
 import Jhc.Prim.Array
+import Data.Array.Base
+import Data.Array.Unboxed(newUArray, mutUArrayPtr, replicateElem)
+import qualified Data.Array.Unboxed as U
 import Data.Ix
+import Foreign.C.Types
+import Foreign.Storable
+import Jhc.Addr
+import Jhc.Basics
 import Jhc.IO
 import Jhc.Int
+import Jhc.Monad
+import Jhc.Num
+import Jhc.Order
+import Jhc.Type.Float
 
 data IOArray a b = IOA !a !a (MutArray_ b)
 
@@ -39,11 +50,222 @@ unsafeWriteIOArray (IOA l h arr) i x =
     case unboxInt i of i' -> fromUIO (\w1 -> case writeArray__ arr i' x w1 of
                                           w2 -> (# w2, () #))
 
-{-
+-- | @copyIOArray src soff dst doff n@ copies @n@ elements of @src@ starting at
+-- the zero based position @soff@ to @dst@ starting at @doff@. The arrays may
+-- be the same and the ranges may overlap.
+copyIOArray :: Ix a => IOArray a b -> Int -> IOArray a b -> Int -> Int -> IO ()
+copyIOArray s@(IOA _ _ src) soff d@(IOA _ _ dst) doff n =
+    checkRange "copyIOArray" soff n (sizeIOArray s) $ checkRange "copyIOArray" doff n (sizeIOArray d) $
+        fromUIO_ (copyArray__ (unboxInt soff) (unboxInt doff) (unboxInt n) src dst)
+
+-- | @fillIOArray arr off n x@ sets the @n@ elements starting at the zero based
+-- position @off@ to @x@.
+fillIOArray :: Ix a => IOArray a b -> Int -> Int -> b -> IO ()
+fillIOArray a@(IOA _ _ arr) off n x = checkRange "fillIOArray" off n (sizeIOArray a) $
+    fromUIO_ (fillArray__ (unboxInt off) (unboxInt n) x arr)
+
+sizeIOArray :: Ix a => IOArray a b -> Int
+sizeIOArray (IOA l h _) = rangeSize (l,h)
+
+-- | Mutable arrays of unboxed elements. The elements are kept in a single
+-- atomic heap object, so the collector does not trace them.
+data IOUArray a b = IOUA !a !a (MutUArray_ b)
+
+newIOUArray :: (Ix a, Storable b) => (a,a) -> b -> IO (IOUArray a b)
+newIOUArray rng@(l,h) fill = do
+    arr <- newUArray n fill
+    replicateElem (mutUArrayPtr arr) n fill
+    returnIO (IOUA l h arr)
+    where n = rangeSize rng
+
+boundsIOUArray :: Ix a => IOUArray a b -> IO (a,a)
+boundsIOUArray (IOUA l h _) = returnIO (l,h)
+
+readIOUArray :: (Ix a, Storable b) => IOUArray a b -> a -> IO b
+readIOUArray (IOUA l h arr) i = peekElemOff (mutUArrayPtr arr) (index (l,h) i)
+
+writeIOUArray :: (Ix a, Storable b) => IOUArray a b -> a -> b -> IO ()
+writeIOUArray (IOUA l h arr) i x = pokeElemOff (mutUArrayPtr arr) (index (l,h) i) x
+
+unsafeReadIOUArray :: Storable b => IOUArray a b -> Int -> IO b
+unsafeReadIOUArray (IOUA _ _ arr) i = peekElemOff (mutUArrayPtr arr) i
+
+unsafeWriteIOUArray :: Storable b => IOUArray a b -> Int -> b -> IO ()
+unsafeWriteIOUArray (IOUA _ _ arr) i x = pokeElemOff (mutUArrayPtr arr) i x
+
+-- | Like 'copyIOArray', the elements are moved with a single memmove.
+copyIOUArray :: (Ix a, Storable b) => IOUArray a b -> Int -> IOUArray a b -> Int -> Int -> IO ()
+copyIOUArray s@(IOUA _ _ src) soff d@(IOUA _ _ dst) doff n =
+    checkRange "copyIOUArray" soff n (sizeIOUArray s) $ checkRange "copyIOUArray" doff n (sizeIOUArray d) $
+        c_memmove (castPtr (sp `plusPtr` (doff * sz))) (castPtr (mutUArrayPtr src `plusPtr` (soff * sz))) (fromIntegral (n * sz))
+    where sp = mutUArrayPtr dst
+          sz = sizeOf (_f sp)
+
+-- | Like 'fillIOArray', the first element is stored and then copied over the
+-- rest of the range by doubling memcpys.
+fillIOUArray :: (Ix a, Storable b) => IOUArray a b -> Int -> Int -> b -> IO ()
+fillIOUArray a@(IOUA _ _ arr) off n x = checkRange "fillIOUArray" off n (sizeIOUArray a) $
+    replicateElem (mutUArrayPtr arr `plusPtr` (off * sizeOf x)) n x
+
+-- | Lexicographic comparison of @n@ elements of each array starting at the
+-- given zero based positions.
+compareIOUArray :: (Ix a, UArrayElem b) => IOUArray a b -> Int -> IOUArray a b -> Int -> Int -> IO Ordering
+compareIOUArray a@(IOUA _ _ x) xoff b@(IOUA _ _ y) yoff n =
+    checkRange "compareIOUArray" xoff n (sizeIOUArray a) $ checkRange "compareIOUArray" yoff n (sizeIOUArray b) $ do
+        r <- compareElems__ (mutUArrayPtr x `advance` xoff) (mutUArrayPtr y `advance` yoff) n
+        returnIO (if r < 0 then LT else if r > 0 then GT else EQ)
+
+sumIOUArray :: (Ix a, UArrayElem b) => IOUArray a b -> IO b
+sumIOUArray a@(IOUA _ _ arr) = sumElems__ (mutUArrayPtr arr) (sizeIOUArray a)
+
+minimumIOUArray :: (Ix a, UArrayElem b) => IOUArray a b -> IO b
+minimumIOUArray a@(IOUA _ _ arr) = case sizeIOUArray a of
+    0 -> error "Data.Array.IO.minimumIOUArray: empty array"
+    n -> minElems__ (mutUArrayPtr arr) n
+
+maximumIOUArray :: (Ix a, UArrayElem b) => IOUArray a b -> IO b
+maximumIOUArray a@(IOUA _ _ arr) = case sizeIOUArray a of
+    0 -> error "Data.Array.IO.maximumIOUArray: empty array"
+    n -> maxElems__ (mutUArrayPtr arr) n
+
+sizeIOUArray :: Ix a => IOUArray a b -> Int
+sizeIOUArray (IOUA l h _) = rangeSize (l,h)
+
+-- | Element types whose reductions and comparisons are done by loops in the
+-- rts, which the C compiler vectorizes where it can.
+class Storable e => UArrayElem e where
+    sumElems__ :: Ptr e -> Int -> IO e
+    minElems__ :: Ptr e -> Int -> IO e
+    maxElems__ :: Ptr e -> Int -> IO e
+    compareElems__ :: Ptr e -> Ptr e -> Int -> IO Int
+
+instance UArrayElem Int where
+    sumElems__ = c_sum_int
+    minElems__ = c_min_int
+    maxElems__ = c_max_int
+    compareElems__ = c_compare_int
+
+instance UArrayElem Word where
+    sumElems__ = c_sum_word
+    minElems__ = c_min_word
+    maxElems__ = c_max_word
+    compareElems__ = c_compare_word
+
+instance UArrayElem Word8 where
+    sumElems__ = c_sum_word8
+    minElems__ = c_min_word8
+    maxElems__ = c_max_word8
+    compareElems__ = c_compare_word8
+
+instance UArrayElem Int64 where
+    sumElems__ = c_sum_int64
+    minElems__ = c_min_int64
+    maxElems__ = c_max_int64
+    compareElems__ = c_compare_int64
+
+instance UArrayElem Word64 where
+    sumElems__ = c_sum_word64
+    minElems__ = c_min_word64
+    maxElems__ = c_max_word64
+    compareElems__ = c_compare_word64
+
+instance UArrayElem Float where
+    sumElems__ = c_sum_float
+    minElems__ = c_min_float
+    maxElems__ = c_max_float
+    compareElems__ = c_compare_float
+
+instance UArrayElem Double where
+    sumElems__ = c_sum_double
+    minElems__ = c_min_double
+    maxElems__ = c_max_double
+    compareElems__ = c_compare_double
+
+advance :: Storable b => Ptr b -> Int -> Ptr b
+advance p i = p `plusPtr` (i * sizeOf (_f p))
+
+_f :: Ptr a -> a
+_f _ = undefined
+
+checkRange :: String -> Int -> Int -> Int -> a -> a
+checkRange fn off n size x
+    | off < 0 || n < 0 || off + n > size = error ("Data.Array.IO." ++ fn ++ ": range out of bounds")
+    | otherwise = x
+
+foreign import ccall unsafe "string.h memmove" c_memmove :: Ptr Word8 -> Ptr Word8 -> CSize -> IO ()
+
+foreign import ccall unsafe "jhc_array_sum_int" c_sum_int :: Ptr Int -> Int -> IO Int
+foreign import ccall unsafe "jhc_array_min_int" c_min_int :: Ptr Int -> Int -> IO Int
+foreign import ccall unsafe "jhc_array_max_int" c_max_int :: Ptr Int -> Int -> IO Int
+foreign import ccall unsafe "jhc_array_compare_int" c_compare_int :: Ptr Int -> Ptr Int -> Int -> IO Int
+
+foreign import ccall unsafe "jhc_array_sum_word" c_sum_word :: Ptr Word -> Int -> IO Word
+foreign import ccall unsafe "jhc_array_min_word" c_min_word :: Ptr Word -> Int -> IO Word
+foreign import ccall unsafe "jhc_array_max_word" c_max_word :: Ptr Word -> Int -> IO Word
+foreign import ccall unsafe "jhc_array_compare_word" c_compare_word :: Ptr Word -> Ptr Word -> Int -> IO Int
+
+foreign import ccall unsafe "jhc_array_sum_word8" c_sum_word8 :: Ptr Word8 -> Int -> IO Word8
+foreign import ccall unsafe "jhc_array_min_word8" c_min_word8 :: Ptr Word8 -> Int -> IO Word8
+foreign import ccall unsafe "jhc_array_max_word8" c_max_word8 :: Ptr Word8 -> Int -> IO Word8
+foreign import ccall unsafe "jhc_array_compare_word8" c_compare_word8 :: Ptr Word8 -> Ptr Word8 -> Int -> IO Int
+
+foreign import ccall unsafe "jhc_array_sum_int64" c_sum_int64 :: Ptr Int64 -> Int -> IO Int64
+foreign import ccall unsafe "jhc_array_min_int64" c_min_int64 :: Ptr Int64 -> Int -> IO Int64
+foreign import ccall unsafe "jhc_array_max_int64" c_max_int64 :: Ptr Int64 -> Int -> IO Int64
+foreign import ccall unsafe "jhc_array_compare_int64" c_compare_int64 :: Ptr Int64 -> Ptr Int64 -> Int -> IO Int
+
+foreign import ccall unsafe "jhc_array_sum_word64" c_sum_word64 :: Ptr Word64 -> Int -> IO Word64
+foreign import ccall unsafe "jhc_array_min_word64" c_min_word64 :: Ptr Word64 -> Int -> IO Word64
+foreign import ccall unsafe "jhc_array_max_word64" c_max_word64 :: Ptr Word64 -> Int -> IO Word64
+foreign import ccall unsafe "jhc_array_compare_word64" c_compare_word64 :: Ptr Word64 -> Ptr Word64 -> Int -> IO Int
+
+foreign import ccall unsafe "jhc_array_sum_float" c_sum_float :: Ptr Float -> Int -> IO Float
+foreign import ccall unsafe "jhc_array_min_float" c_min_float :: Ptr Float -> Int -> IO Float
+foreign import ccall unsafe "jhc_array_max_float" c_max_float :: Ptr Float -> Int -> IO Float
+foreign import ccall unsafe "jhc_array_compare_float" c_compare_float :: Ptr Float -> Ptr Float -> Int -> IO Int
+
+foreign import ccall unsafe "jhc_array_sum_double" c_sum_double :: Ptr Double -> Int -> IO Double
+foreign import ccall unsafe "jhc_array_min_double" c_min_double :: Ptr Double -> Int -> IO Double
+foreign import ccall unsafe "jhc_array_max_double" c_max_double :: Ptr Double -> Int -> IO Double
+foreign import ccall unsafe "jhc_array_compare_double" c_compare_double :: Ptr Double -> Ptr Double -> Int -> IO Int
+
+-- | Copy the elements into a new immutable array.
 freezeIOArray :: Ix a => IOArray a b -> IO (Array a b)
+freezeIOArray a@(IOA l h arr) = fromUIO $ \w -> case copyMutArray 0 (sizeIOArray a) arr w of
+    (# w, r #) -> case unsafeFreezeArray__ r w of (# w, r #) -> (# w, MkArray l h r #)
+
+-- | Copy the elements into a new mutable array.
 thawIOArray :: Ix a => Array a b -> IO (IOArray a b)
+thawIOArray (MkArray l h arr) = fromUIO $ \w -> case unsafeThawArray__ arr w of
+    (# w, m #) -> case copyMutArray 0 (rangeSize (l,h)) m w of (# w, r #) -> (# w, IOA l h r #)
 
+-- | Turn a mutable array into an immutable one in constant time. The mutable
+-- array must not be written to afterwards.
 unsafeFreezeIOArray :: Ix a => IOArray a b -> IO (Array a b)
-unsafeFreezeIOArray (IOA l h arr) =
-    IO (\w1 -> unsafeFreezeArray__ )
--}
+unsafeFreezeIOArray (IOA l h arr) = fromUIO $ \w -> case unsafeFreezeArray__ arr w of
+    (# w, r #) -> (# w, MkArray l h r #)
+
+-- | Turn an immutable array into a mutable one in constant time. The
+-- immutable array must not be used afterwards.
+unsafeThawIOArray :: Ix a => Array a b -> IO (IOArray a b)
+unsafeThawIOArray (MkArray l h arr) = fromUIO $ \w -> case unsafeThawArray__ arr w of
+    (# w, m #) -> (# w, IOA l h m #)
+
+freezeIOUArray :: (Ix a, Storable b) => IOUArray a b -> IO (U.UArray a b)
+freezeIOUArray a@(IOUA l h arr) = do
+    r <- newUArray (sizeIOUArray a) (_f (mutUArrayPtr arr))
+    copyIOUArray a 0 (IOUA l h r) 0 (sizeIOUArray a)
+    returnIO (U.MkArray l h (U.unsafeFreezeUArray r))
+
+thawIOUArray :: (Ix a, Storable b) => U.UArray a b -> IO (IOUArray a b)
+thawIOUArray (U.MkArray l h arr) = do
+    r <- newUArray n (_f (U.uArrayPtr arr))
+    copyIOUArray (IOUA l h (U.unsafeThawUArray arr)) 0 (IOUA l h r) 0 n
+    returnIO (IOUA l h r)
+    where n = rangeSize (l,h)
+
+unsafeFreezeIOUArray :: Ix a => IOUArray a b -> IO (U.UArray a b)
+unsafeFreezeIOUArray (IOUA l h arr) = returnIO (U.MkArray l h (U.unsafeFreezeUArray arr))
+
+unsafeThawIOUArray :: Ix a => U.UArray a b -> IO (IOUArray a b)
+unsafeThawIOUArray (U.MkArray l h arr) = returnIO (IOUA l h (U.unsafeThawUArray arr))
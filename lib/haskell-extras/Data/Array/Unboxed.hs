@@ -1,29 +1,43 @@
+{-# OPTIONS_JHC -fffi #-}
 module Data.Array.Unboxed where
 
 import Data.Ix
-import System.IO.Unsafe
+import Foreign.Marshal.Utils(copyBytes)
 import Foreign.Storable
-import Foreign.ForeignPtr
+import Jhc.Addr(Ptr(..))
+import Jhc.Int
+import Jhc.Prim.Array
+import Jhc.Prim.IO
+import System.IO.Unsafe
 
 infixl 9  !, //
 
-data UArray i e = MkArray !i !i (ForeignPtr e)
+-- | Arrays of unboxed elements, kept in a single atomic heap object that the
+-- garbage collector never scans.
+data UArray i e = MkArray !i !i (UArray_ e)
 
 array       :: (Ix a,Storable b) => (a,a) -> [(a,b)] -> UArray a b
 array b@(s,e) ivs = MkArray s e (unsafePerformIO arr) where
     arr = do
         let f :: [(a,b)] -> b; f _ = undefined
-        fp <- mallocForeignPtrBytes (sizeOf (f ivs) *  rangeSize b)
-        withForeignPtr fp $ \ptr ->
-            mapM_ (\ (i,v) -> pokeElemOff ptr (index b i) v) ivs
-        return fp
+        m <- newUArray (rangeSize b) (f ivs)
+        mapM_ (\ (i,v) -> pokeElemOff (mutUArrayPtr m) (index b i) v) ivs
+        return (unsafeFreezeUArray m)
 
 
 listArray             :: (Ix a,Storable b) => (a,a) -> [b] -> UArray a b
-listArray b vs        =  array b (zipWith (\ a b -> (a,b)) (range b) vs)
+listArray b@(s,e) vs  =  MkArray s e (unsafePerformIO arr) where
+    n = rangeSize b
+    arr = do
+        let f :: [b] -> b; f _ = undefined
+        m <- newUArray n (f vs)
+        let g i (x:xs) | i < n = pokeElemOff (mutUArrayPtr m) i x >> g (i + 1) xs
+            g _ _ = return ()
+        g 0 vs
+        return (unsafeFreezeUArray m)
 
 (!)                   :: (Ix a,Storable b) => UArray a b -> a -> b
-(!) (MkArray s e arr) i = case (index (s,e) i) of i' -> unsafePerformIO (withForeignPtr arr (\ptr -> peekElemOff ptr i'))
+(!) (MkArray s e arr) i = case (index (s,e) i) of i' -> unsafePerformIO (peekElemOff (uArrayPtr arr) i')
 
 bounds                :: (Ix a) => UArray a b -> (a,a)
 bounds (MkArray s e _)  =  (s,e)
@@ -39,20 +53,40 @@ assocs a              =  [(i, a!i) | i <- indices a]
 
 (//)                  :: (Ix a,Storable b) => UArray a b -> [(a,b)] -> UArray a b
 a // []               = a
-a // new_ivs          = array (bounds a) (old_ivs ++ new_ivs)
-                      where
-                  	old_ivs = [(i,a!i) | i <- indices a,
-                                             i `notElem` new_is]
-                  	new_is  = [i | (i,_) <- new_ivs]
+a@(MkArray s e _) // new_ivs = MkArray s e (unsafePerformIO arr) where
+    arr = do
+        m <- copyUArray a
+        mapM_ (\ (i,v) -> pokeElemOff (mutUArrayPtr m) (index (s,e) i) v) new_ivs
+        return (unsafeFreezeUArray m)
 
 accum                 :: (Ix a,Storable b ) => (b -> c -> b) -> UArray a b -> [(a,c)] -> UArray a b
-accum f               =  foldl (\a (i,v) -> a // [(i,f (a!i) v)])
+accum f a@(MkArray s e _) ivs = MkArray s e (unsafePerformIO arr) where
+    arr = do
+        m <- copyUArray a
+        accumElems f (s,e) ivs (mutUArrayPtr m)
+        return (unsafeFreezeUArray m)
 
 accumArray            :: (Ix a,Storable b ) => (b -> c -> b) -> b -> (a,a) -> [(a,c)] -> UArray a b
-accumArray f z b      =  accum f (array b [(i,z) | i <- range b])
+accumArray f z b@(s,e) ivs = MkArray s e (unsafePerformIO arr) where
+    arr = do
+        m <- newUArray (rangeSize b) z
+        replicateElem (mutUArrayPtr m) (rangeSize b) z
+        accumElems f b ivs (mutUArrayPtr m)
+        return (unsafeFreezeUArray m)
 
 ixmap                 :: (Ix a, Ix b,Storable c) => (a,a) -> (a -> b) -> UArray b c -> UArray a c
-ixmap b f a           = array b [(i, a ! f i) | i <- range b]
+ixmap b@(s,e) f a     = MkArray s e (unsafePerformIO arr) where
+    arr = do
+        let g :: UArray b c -> c; g _ = undefined
+        m <- newUArray (rangeSize b) (g a)
+        let p = mutUArrayPtr m
+            h k (i:is) = pokeElemOff p k (a ! f i) >> h (k + 1) is
+            h _ [] = return ()
+        h 0 (range b)
+        return (unsafeFreezeUArray m)
+
+accumElems :: (Ix a, Storable b) => (b -> c -> b) -> (a,a) -> [(a,c)] -> Ptr b -> IO ()
+accumElems f b ivs p = mapM_ (\ (i,v) -> let i' = index b i in peekElemOff p i' >>= \x -> pokeElemOff p i' (f x v)) ivs
 
 --instance  (Ix a)          => Functor (UArray a) where
 --    fmap fn a = array (bounds a) [ (a,fn b) | (a,b) <- assocs a ]
@@ -79,3 +113,41 @@ instance  (Ix a, Read a, Read b, Storable b) => Read (UArray a b)  where
 arrPrec :: Int
 arrPrec = 10
 
+-- | Allocate room for the given number of elements of the type of the second
+-- argument, which is not evaluated.
+newUArray :: Storable e => Int -> e -> IO (MutUArray_ e)
+newUArray n x
+    | n < 0 = error "Data.Array.Unboxed: negative size"
+    | n > 0 && sz > maxBound `quot` n = error "Data.Array.Unboxed: array too large"
+    | otherwise = IO (ST (newUArray__ (unboxInt n) (unboxInt sz)))
+    where sz = sizeOf x
+
+unsafeFreezeUArray :: MutUArray_ e -> UArray_ e
+unsafeFreezeUArray (MutUArray_ ba) = UArray_ ba
+
+unsafeThawUArray :: UArray_ e -> MutUArray_ e
+unsafeThawUArray (UArray_ ba) = MutUArray_ ba
+
+mutUArrayPtr :: MutUArray_ e -> Ptr e
+mutUArrayPtr m = Ptr (mutUArrayContents__ m)
+
+uArrayPtr :: UArray_ e -> Ptr e
+uArrayPtr a = Ptr (uArrayContents__ a)
+
+-- | A new mutable array holding a copy of the elements of an immutable one.
+copyUArray :: (Ix a, Storable b) => UArray a b -> IO (MutUArray_ b)
+copyUArray (MkArray s e arr) = do
+    let p = uArrayPtr arr
+        n = rangeSize (s,e)
+        g :: Ptr b -> b; g _ = undefined
+    m <- newUArray n (g p)
+    copyBytes (mutUArrayPtr m) p (n * sizeOf (g p))
+    return m
+
+-- store @x@ and copy it over the following @n - 1@ elements.
+replicateElem :: Storable b => Ptr b -> Int -> b -> IO ()
+replicateElem p n x
+    | n <= 0 = return ()
+    | otherwise = poke p x >> c_array_replicate p (sizeOf x) n
+
+foreign import ccall unsafe "jhc_array_replicate" c_array_replicate :: Ptr a -> Int -> Int -> IO ()
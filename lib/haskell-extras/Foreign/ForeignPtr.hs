@@ -23,9 +23,6 @@ newForeignPtr finalizer ptr = do
     addForeignPtrFinalizer finalizer fp
     return fp
 
-addForeignPtrFinalizer :: FinalizerPtr a -> ForeignPtr a -> IO ()
-addForeignPtrFinalizer _ _ = return ()
-
 mallocForeignPtrBytes :: Int -> IO (ForeignPtr a)
 mallocForeignPtrBytes sz = mallocForeignPtrAlignBytes 0 sz
 
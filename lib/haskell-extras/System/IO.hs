@@ -11,6 +11,7 @@ module System.IO(
     hTell,
     hFlush,
     hGetBuf,
+    hGetBufNonBlocking,
     hGetPosn,
     hSetPosn,
     hGetContents,
@@ -38,6 +39,7 @@ module System.IO(
     hLookAhead,
     hReady,
     hSetBuffering,
+    hSetBinaryMode,
     hGetBuffering
     ) where
 
@@ -47,6 +49,7 @@ import Jhc.Handle
 import Jhc.IO
 import Jhc.Num
 import Jhc.Type.C
+import Prelude.IO(fileContents, filePutStr)
 import System.C.Stdio
 import System.IO.Error
 
@@ -84,12 +87,14 @@ hWaitForInput :: Handle -> Int -> IO Bool
 hWaitForInput h to = withHandle h $ \ptr -> c_wait_for_input ptr to
 
 hPutChar h ch = withHandle h $ \ptr -> do
-    c_fputwc (fromInt (ord ch)) ptr
+    binary <- hIsBinary h
+    if binary then c_fputc (ord ch) ptr else c_fputwc (ord ch) ptr
     return ()
 
 hPutStr     :: Handle -> String -> IO ()
 hPutStr h s   = withHandle h $ \ptr -> do
-    sequence_ [ c_fputwc (fromInt (ord ch)) ptr | ch <- s ]
+    binary <- hIsBinary h
+    filePutStr ptr binary s
 
 hPutStrLn   :: Handle -> String -> IO ()
 hPutStrLn h s = do
@@ -107,21 +112,16 @@ hGetLine h  =  do c <- hGetChar h
 
 hGetChar :: Handle -> IO Char
 hGetChar h = withHandle h $ \ptr -> do
-    ch <- c_fgetwc ptr
+    binary <- hIsBinary h
+    ch <- if binary then c_fgetc ptr else c_fgetwc ptr
     case ch of
         -1 -> fail "hGetChar: EOF"
         _  -> return (unsafeChr ch)
 
 hGetContents :: Handle -> IO String
 hGetContents h = withHandle h $ \ptr -> do
-    let getContents' = do
-            ch <- c_fgetwc ptr
-            case ch of
-                -1 -> return []
-                _ -> do
-                    xs <- unsafeInterleaveIO getContents'
-                    return (unsafeChr ch:xs)
-    unsafeInterleaveIO getContents'
+    binary <- hIsBinary h
+    fileContents ptr (handleFile h) binary
 
 hTell :: Handle -> IO Integer
 hTell h = withHandle h $ \ptr -> fmap fromIntegral (c_ftell ptr)
@@ -147,11 +147,14 @@ hPutBuf h p c = do
     rc <- withHandle h $ c_fwrite p 1 count
     if rc /= count then fail "hPutBuf: short write" else return ()
 
+-- | Read up to count bytes, fewer only at the end of the file.
 hGetBuf :: Handle -> Ptr a -> Int -> IO Int
-hGetBuf h p c = do
-    let count = fromIntegral c
-    rc <- withHandle h $ c_fread p 1 count
-    return $ fromIntegral rc
+hGetBuf h p count = withHandle h $ \ptr -> c_get_buf ptr p count
+
+-- | Read up to count bytes of what is there without waiting, 0 if nothing
+-- is.
+hGetBufNonBlocking :: Handle -> Ptr a -> Int -> IO Int
+hGetBufNonBlocking h p count = withHandle h $ \ptr -> c_get_buf_nonblocking ptr p count
 
 hIsSeekable :: Handle -> IO Bool
 hIsSeekable _ = return True
@@ -162,11 +165,28 @@ hLookAhead = error "hLookAhead"
 hReady :: Handle -> IO Bool
 hReady _ = return True
 
+-- | The buffer is that of the stream the handle wraps, set the mode before
+-- reading as input already buffered is dropped.
 hSetBuffering :: Handle -> BufferMode -> IO ()
-hSetBuffering _ _ = return ()
+hSetBuffering h m = withHandle h $ \ptr -> do
+    r <- case m of
+        NoBuffering -> c_set_buffering ptr c__IONBF 0
+        LineBuffering -> c_set_buffering ptr c__IOLBF 0
+        BlockBuffering Nothing -> c_set_buffering ptr c__IOFBF 0
+        BlockBuffering (Just n)
+            | n > 0 -> c_set_buffering ptr c__IOFBF n
+            | otherwise -> fail ("hSetBuffering: illegal buffer size " ++ show n)
+    if r /= 0 then fail ("hSetBuffering " ++ handleName h ++ " failed") else return ()
 
 hGetBuffering :: Handle -> IO BufferMode
-hGetBuffering _ = error "hGetBuffering"
+hGetBuffering h = withHandle h $ \ptr -> do
+    mode <- c_buffer_mode ptr
+    size <- c_buffer_size ptr
+    return $ case () of
+        _ | mode == c__IONBF -> NoBuffering
+          | mode == c__IOLBF -> LineBuffering
+          | size > 0 -> BlockBuffering (Just size)
+          | otherwise -> BlockBuffering Nothing
 
 hFileSize :: Handle -> IO Integer
 hFileSize h = do
@@ -178,3 +198,8 @@ hFileSize h = do
 
 foreign import primitive "I2I" cwintToChar :: CWint -> Char
 foreign import ccall "jhc_wait_for_input" c_wait_for_input :: FILE -> Int -> IO Bool
+foreign import ccall "jhc_get_buf" c_get_buf :: FILE -> Ptr a -> Int -> IO Int
+foreign import ccall "jhc_get_buf_nonblocking" c_get_buf_nonblocking :: FILE -> Ptr a -> Int -> IO Int
+foreign import ccall "jhc_set_buffering" c_set_buffering :: FILE -> CInt -> Int -> IO Int
+foreign import ccall "jhc_buffer_mode" c_buffer_mode :: FILE -> IO CInt
+foreign import ccall "jhc_buffer_size" c_buffer_size :: FILE -> IO Int
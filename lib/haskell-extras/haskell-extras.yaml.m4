@@ -5,7 +5,12 @@ Extensions: ForeignFunctionInterface
 # TODO this should not have to depend on jhc-prim directly.
 build-depends: [jhc, jhc-prim]
 Options: [ --noauto ]
+Hidden-Modules:
+        - Data.Array.Base
 Exposed-Modules:
+        - Control.Concurrent
+        - Control.Concurrent.Chan
+        - Control.Concurrent.MVar
         - Control.Exception
         - Control.Monad
         - Data.String
@@ -2,13 +2,48 @@ module Jhc.Prim.Array where
 
 import Jhc.Prim.IO
 import Jhc.Prim.Bits
+import Jhc.Prim.ByteArray
 
 data MutArray_ :: * -> #
 newtype Array_ m = Array_ (MutArray_ m)
 
 foreign import primitive newArray__      :: Word_ -> a -> UST s (MutArray_ a)
 foreign import primitive newBlankArray__ :: Word_ -> UST s (MutArray_ a)
+-- copyArray__ srcOff dstOff count src dst, the ranges may overlap.
 foreign import primitive copyArray__     :: Word_ -> Word_ -> Word_ -> MutArray_ a -> MutArray_ a -> UST_ s
+-- fillArray__ off count v arr
+foreign import primitive fillArray__     :: Word_ -> Word_ -> a -> MutArray_ a -> UST_ s
 foreign import primitive readArray__     :: MutArray_ a -> Word_ -> UST s a
 foreign import primitive writeArray__    :: MutArray_ a -> Word_ -> a -> UST_ s
 foreign import primitive indexArray__    :: Array_ a -> Word_ -> (# a #)
+
+-- An Array_ is a MutArray_ that is no longer written to, so freezing and
+-- thawing in place only changes the type. The frozen array depends on the
+-- state so that reads of it are not moved before the writes that preceded it.
+unsafeFreezeArray__ :: MutArray_ a -> UST s (Array_ a)
+unsafeFreezeArray__ arr w = (# w, arrayDependingOn__ (Array_ arr) w #)
+
+unsafeThawArray__ :: Array_ a -> UST s (MutArray_ a)
+unsafeThawArray__ (Array_ arr) w = (# w, arr #)
+
+foreign import primitive "dependingOn" arrayDependingOn__ :: Array_ a -> State_ s -> Array_ a
+
+-- Arrays of unboxed elements are kept in a ByteArray_, a single atomic object
+-- the collector never scans, and are accessed through the address of their
+-- contents with the peek and poke primitives of the element type.
+newtype MutUArray_ e = MutUArray_ ByteArray_
+newtype UArray_ e = UArray_ ByteArray_
+
+foreign import primitive "Mul" timesWord__ :: Word_ -> Word_ -> Word_
+
+-- takes the number of elements and the size of one in bytes, the elements are
+-- not initialized.
+newUArray__ :: Word_ -> Word_ -> UIO (MutUArray_ e)
+newUArray__ n size w = case newByteArray__ (timesWord__ n size) w of
+    (# w', ba #) -> (# w', MutUArray_ ba #)
+
+mutUArrayContents__ :: MutUArray_ e -> Addr_
+mutUArrayContents__ (MutUArray_ ba) = byteArrayContents__ ba
+
+uArrayContents__ :: UArray_ e -> Addr_
+uArrayContents__ (UArray_ ba) = byteArrayContents__ ba
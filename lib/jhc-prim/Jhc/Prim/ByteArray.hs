@@ -0,0 +1,24 @@
+{-# LANGUAGE UnboxedTuples, ForeignFunctionInterface #-}
+module Jhc.Prim.ByteArray where
+
+import Jhc.Prim.Bits
+import Jhc.Prim.IO
+import Jhc.Prim.Rts
+
+-- A pinned array of bytes. It is a single atomic heap object that the garbage
+-- collector neither scans nor moves, and like a ForeignPtr it starts with the
+-- address of its contents, so they may be handed to C directly for as long as
+-- the array is reachable.
+data ByteArray_ = ByteArray_ BitsPtr_
+
+foreign import safe ccall gc_new_bytearray :: Word_ -> UIO (Bang_ ByteArray_)
+
+-- the contents are not initialized.
+newByteArray__ :: Word_ -> UIO ByteArray_
+newByteArray__ n w = case gc_new_bytearray n w of
+    (# w', ba #) -> (# w', fromBang_ ba #)
+
+byteArrayContents__ :: ByteArray_ -> Addr_
+byteArrayContents__ (ByteArray_ a) = Addr_ a
+
+foreign import primitive "touch_" touchByteArray__ :: ByteArray_ -> UIO_
@@ -0,0 +1,193 @@
+{-# OPTIONS_JHC -fno-prelude -fffi -funboxed-tuples -funboxed-values #-}
+-- | Pinned arrays of bytes, for strict ByteString style code. The arrays are
+-- atomic objects of the garbage collector so it never looks inside them, and
+-- the bulk operations are done by memcpy, memset, memcmp and memchr.
+module Jhc.ByteArray(
+    -- * Mutable byte arrays
+    MutableByteArray(),
+    newByteArray,
+    sizeofMutableByteArray,
+    readByteArray,
+    writeByteArray,
+    copyByteArray,
+    copyMutableByteArray,
+    fillByteArray,
+    withMutableByteArray,
+    -- * Immutable byte arrays
+    ByteArray(),
+    unsafeFreezeByteArray,
+    freezeByteArray,
+    sizeofByteArray,
+    indexByteArray,
+    sliceByteArray,
+    compareByteArrays,
+    elemIndexByteArray,
+    withByteArray,
+    unsafeForeignPtrToByteArray,
+    packByteArray,
+    unpackByteArray
+    ) where
+
+import Foreign.C.Types
+import Foreign.Storable
+import Jhc.Addr
+import Jhc.Basics
+import Jhc.ForeignPtr
+import Jhc.IO
+import Jhc.Inst.Storable()
+import Jhc.Int(unboxInt)
+import Jhc.List
+import Jhc.Monad
+import Jhc.Num
+import Jhc.Order
+import Jhc.Prim.ByteArray
+import Jhc.Type.Word
+
+-- | A mutable array of bytes along with its size.
+data MutableByteArray = MutableByteArray ByteArray_ !Int
+
+-- | An immutable run of bytes given by an array, an offset and a length.
+-- Slices share the array they were taken from.
+data ByteArray = ByteArray ByteArray_ !Int !Int
+
+-- | Allocate an array of the given number of bytes, which are not
+-- initialized.
+newByteArray :: Int -> IO MutableByteArray
+newByteArray n
+    | n < 0 = error "Jhc.ByteArray.newByteArray: negative size"
+    | otherwise = fromUIO $ \w -> case newByteArray__ (unboxInt n) w of
+        (# w', ba #) -> (# w', MutableByteArray ba n #)
+
+sizeofMutableByteArray :: MutableByteArray -> Int
+sizeofMutableByteArray (MutableByteArray _ n) = n
+
+readByteArray :: MutableByteArray -> Int -> IO Word8
+readByteArray (MutableByteArray ba n) i = checkIndex "readByteArray" i n $
+    peekByteOff (contents ba) i
+
+writeByteArray :: MutableByteArray -> Int -> Word8 -> IO ()
+writeByteArray (MutableByteArray ba n) i v = checkIndex "writeByteArray" i n $
+    pokeByteOff (contents ba) i v
+
+-- | @copyByteArray src soff dst doff n@ copies @n@ bytes of @src@ starting at
+-- @soff@ to @dst@ starting at @doff@.
+copyByteArray :: ByteArray -> Int -> MutableByteArray -> Int -> Int -> IO ()
+copyByteArray (ByteArray sba so sn) soff (MutableByteArray dba dn) doff n =
+    checkRange "copyByteArray" soff n sn $ checkRange "copyByteArray" doff n dn $
+        c_memcpy (contents dba `plusPtr` doff) (contents sba `plusPtr` (so + soff)) (fromIntegral n)
+
+-- | Like 'copyByteArray', but the arrays may be the same and the ranges may
+-- overlap.
+copyMutableByteArray :: MutableByteArray -> Int -> MutableByteArray -> Int -> Int -> IO ()
+copyMutableByteArray (MutableByteArray sba sn) soff (MutableByteArray dba dn) doff n =
+    checkRange "copyMutableByteArray" soff n sn $ checkRange "copyMutableByteArray" doff n dn $
+        c_memmove (contents dba `plusPtr` doff) (contents sba `plusPtr` soff) (fromIntegral n)
+
+-- | @fillByteArray arr off n v@ sets @n@ bytes starting at @off@ to @v@.
+fillByteArray :: MutableByteArray -> Int -> Int -> Word8 -> IO ()
+fillByteArray (MutableByteArray ba bn) off n v = checkRange "fillByteArray" off n bn $
+    c_memset (contents ba `plusPtr` off) (fromIntegral v) (fromIntegral n)
+
+-- | Pass the address of the contents to an action, the array is kept alive
+-- until it returns.
+withMutableByteArray :: MutableByteArray -> (Ptr Word8 -> IO a) -> IO a
+withMutableByteArray (MutableByteArray ba _) act = do
+    r <- act (contents ba)
+    touch ba
+    return r
+
+-- | Turn a mutable array into an immutable one without copying. The mutable
+-- array must not be written to afterwards.
+unsafeFreezeByteArray :: MutableByteArray -> IO ByteArray
+unsafeFreezeByteArray (MutableByteArray ba n) = return (ByteArray ba 0 n)
+
+-- | Copy @n@ bytes starting at @off@ into a new immutable array.
+freezeByteArray :: MutableByteArray -> Int -> Int -> IO ByteArray
+freezeByteArray src off n = do
+    dst <- newByteArray n
+    copyMutableByteArray src off dst 0 n
+    unsafeFreezeByteArray dst
+
+sizeofByteArray :: ByteArray -> Int
+sizeofByteArray (ByteArray _ _ n) = n
+
+indexByteArray :: ByteArray -> Int -> Word8
+indexByteArray (ByteArray ba o n) i = checkIndex "indexByteArray" i n $
+    unsafePerformIO' (peekByteOff (contents ba) (o + i))
+
+-- | @sliceByteArray off n arr@ is the @n@ bytes of @arr@ starting at @off@,
+-- taken in constant time.
+sliceByteArray :: Int -> Int -> ByteArray -> ByteArray
+sliceByteArray off n (ByteArray ba o bn) = checkRange "sliceByteArray" off n bn $
+    ByteArray ba (o + off) n
+
+-- | Lexicographic comparison of the bytes.
+compareByteArrays :: ByteArray -> ByteArray -> Ordering
+compareByteArrays (ByteArray a ao an) (ByteArray b bo bn) = case unsafePerformIO' cmp of
+    r | r < 0 -> LT
+      | r > 0 -> GT
+      | otherwise -> compare an bn
+    where cmp = c_memcmp (contents a `plusPtr` ao) (contents b `plusPtr` bo) (fromIntegral (min an bn))
+
+-- | The index of the first occurrence of a byte.
+elemIndexByteArray :: Word8 -> ByteArray -> Maybe Int
+elemIndexByteArray v (ByteArray ba o n) = case unsafePerformIO' find of
+    p | p == nullPtr -> Nothing
+      | otherwise -> Just (p `minusPtr` start)
+    where start = contents ba `plusPtr` o
+          find = c_memchr start (fromIntegral v) (fromIntegral n)
+
+-- | Pass the address of the bytes to an action, the array is kept alive
+-- until it returns.
+withByteArray :: ByteArray -> (Ptr Word8 -> IO a) -> IO a
+withByteArray (ByteArray ba o _) act = do
+    r <- act (contents ba `plusPtr` o)
+    touch ba
+    return r
+
+-- | View @n@ bytes of memory held by a ForeignPtr as an array without copying
+-- them. They must not change for as long as the array is used.
+unsafeForeignPtrToByteArray :: ForeignPtr Word8 -> Int -> ByteArray
+unsafeForeignPtrToByteArray fp n = ByteArray (unsafeCoerce__ fp) 0 n
+
+packByteArray :: [Word8] -> ByteArray
+packByteArray ws = unsafePerformIO $ do
+    arr@(MutableByteArray ba _) <- newByteArray (length ws)
+    let f _ [] = return ()
+        f p (x:xs) = poke p x >> f (p `plusPtr` 1) xs
+    f (contents ba) ws
+    unsafeFreezeByteArray arr
+
+unpackByteArray :: ByteArray -> [Word8]
+unpackByteArray arr = f 0 where
+    n = sizeofByteArray arr
+    f i | i >= n = []
+        | otherwise = indexByteArray arr i : f (i + 1)
+
+instance Eq ByteArray where
+    a == b = sizeofByteArray a == sizeofByteArray b && compareByteArrays a b == EQ
+
+instance Ord ByteArray where
+    compare = compareByteArrays
+
+contents :: ByteArray_ -> Ptr Word8
+contents ba = Ptr (byteArrayContents__ ba)
+
+touch :: ByteArray_ -> IO ()
+touch ba = fromUIO_ (touchByteArray__ ba)
+
+checkIndex :: String -> Int -> Int -> a -> a
+checkIndex fn i n x
+    | i < 0 || i >= n = error ("Jhc.ByteArray." ++ fn ++ ": index out of range")
+    | otherwise = x
+
+checkRange :: String -> Int -> Int -> Int -> a -> a
+checkRange fn off n size x
+    | off < 0 || n < 0 || off + n > size = error ("Jhc.ByteArray." ++ fn ++ ": range out of bounds")
+    | otherwise = x
+
+foreign import ccall unsafe "string.h memcpy" c_memcpy :: Ptr Word8 -> Ptr Word8 -> CSize -> IO ()
+foreign import ccall unsafe "string.h memmove" c_memmove :: Ptr Word8 -> Ptr Word8 -> CSize -> IO ()
+foreign import ccall unsafe "string.h memset" c_memset :: Ptr Word8 -> CInt -> CSize -> IO ()
+foreign import ccall unsafe "string.h memcmp" c_memcmp :: Ptr Word8 -> Ptr Word8 -> CSize -> IO CInt
+foreign import ccall unsafe "string.h memchr" c_memchr :: Ptr Word8 -> CInt -> CSize -> IO (Ptr Word8)
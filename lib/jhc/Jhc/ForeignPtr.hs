@@ -2,6 +2,7 @@ module Jhc.ForeignPtr(
     ForeignPtr(),
     newPlainForeignPtr_,
     newForeignPtr_,
+    addForeignPtrFinalizer,
     mallocPlainForeignPtrAlignBytes,
     mallocForeignPtrAlignBytes,
     unsafeForeignPtrToPtr,
@@ -63,6 +64,12 @@ foreign import safe ccall gc_malloc_foreignptr
 foreign import safe ccall gc_new_foreignptr ::
     Ptr a -> UIO (Bang_ (ForeignPtr a))
 
+-- | Add a finalizer, it is called with the address of the ForeignPtr when
+-- the collector frees it. Finalizers run in the order they were added.
+-- Plain ForeignPtrs can not have finalizers.
+addForeignPtrFinalizer :: FinalizerPtr a -> ForeignPtr a -> IO ()
+addForeignPtrFinalizer fin fp = gc_add_foreignptr_finalizer (toBang_ fp) fin
+
 foreign import unsafe ccall gc_add_foreignptr_finalizer
     :: Bang_ (ForeignPtr a)
     -> FinalizerPtr a
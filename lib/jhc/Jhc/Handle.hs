@@ -6,6 +6,8 @@ module Jhc.Handle(
     stdout,
     stderr,
     withHandle,
+    hIsBinary,
+    hSetBinaryMode,
     hClose,
     hIsOpen,
     openBinaryPipe,
@@ -45,15 +47,16 @@ instance Show Handle where
 stdin, stdout, stderr :: Handle
 
 {-# INLINE make_builtin #-}
-make_builtin mode name std = Handle { handleName = name, handleFile = std, handleIOMode = mode, handleBinary = False, handleIsPipe = False }
+make_builtin mode name std bin = Handle { handleName = name, handleFile = std, handleIOMode = mode, handleBinary = bin, handleIsPipe = False }
 
-stdin = make_builtin ReadMode "stdin" c_stdin
-stdout = make_builtin WriteMode "stdout" c_stdout
-stderr = make_builtin WriteMode "stderr" c_stderr
+stdin = make_builtin ReadMode "stdin" c_stdin c_stdin_binary
+stdout = make_builtin WriteMode "stdout" c_stdout c_stdout_binary
+stderr = make_builtin WriteMode "stderr" c_stderr c_stderr_binary
 
 foreign import ccall "stdio.h &stdin" c_stdin :: Ptr FILE
 foreign import ccall "stdio.h &stdout" c_stdout :: Ptr FILE
 foreign import ccall "stdio.h &stderr" c_stderr :: Ptr FILE
+foreign import ccall "jhc_close" c_close :: FILE -> Int -> IO Int
 
 withHandle h action = do
     ptr <- peek (handleFile h)
@@ -65,8 +68,7 @@ hClose h = do
     ptr <- peek (handleFile h)
     case ptr == nullPtr of
         True -> return ()
-        False -> do ec <- if handleIsPipe h then c_pclose ptr
-                                            else c_fclose ptr
+        False -> do ec <- c_close ptr (if handleIsPipe h then 1 else 0)
                     if ec /= 0 then fail ("hClose "++handleName h++" failed")
                                else return ()
                     poke (handleFile h) nullPtr
@@ -75,6 +77,16 @@ hIsOpen h = do
     ptr <- peek (handleFile h)
     return (ptr /= nullPtr)
 
+-- | Whether characters are read and written as single bytes rather than
+-- as UTF-8.
+hIsBinary :: Handle -> IO Bool
+hIsBinary h = do
+    b <- peek (handleBinary h)
+    return (b /= 0)
+
+hSetBinaryMode :: Handle -> Bool -> IO ()
+hSetBinaryMode h b = poke (handleBinary h) (if b then 1 else 0)
+
 throwErrnoFN     :: String	-- ^ textual description of the error location
                -> String
 	       -> IO a
@@ -87,26 +99,30 @@ openFile fp m = do
     ptr <- withCString fp $ \cfp -> c_fopen cfp (Ptr (toStr m))
     if ptr == nullPtr then throwErrnoFN "openFile" fp  else do
         pptr <- new ptr
-        return Handle { handleBinary = False, handleIsPipe = False, handleName = fp, handleIOMode = m, handleFile = pptr }
+        bptr <- new 0
+        return Handle { handleBinary = bptr, handleIsPipe = False, handleName = fp, handleIOMode = m, handleFile = pptr }
 
 openPipe :: String -> IOMode -> IO Handle
 openPipe c m = do
     ptr <- withCString c $ \command -> c_popen command (Ptr (toStr m))
     -- if ptr == nullPtr then throwErrnoFN "openPipe" c else do
     pptr <- new ptr
-    return Handle { handleBinary = False, handleIsPipe = True, handleName = c, handleIOMode = m, handleFile = pptr }
+    bptr <- new 0
+    return Handle { handleBinary = bptr, handleIsPipe = True, handleName = c, handleIOMode = m, handleFile = pptr }
 
 openBinaryPipe :: String -> IOMode -> IO Handle
 openBinaryPipe c m = do
     ptr <- withCString c $ \command -> c_popen command (Ptr (toStr m))
     if ptr == nullPtr then throwErrnoFN "openPipe" c  else do
         pptr <- new ptr
-        return Handle { handleBinary = True, handleIsPipe = True, handleName = c, handleIOMode = m, handleFile = pptr }
+        bptr <- new 1
+        return Handle { handleBinary = bptr, handleIsPipe = True, handleName = c, handleIOMode = m, handleFile = pptr }
 
 openBinaryFile :: FilePath -> IOMode -> IO Handle
 openBinaryFile fp m = do
     h <- openFile fp m
-    return h { handleBinary = True }
+    hSetBinaryMode h True
+    return h
 
 toStr x = Addr_ (case x of
     ReadMode -> "r"#
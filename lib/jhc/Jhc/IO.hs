@@ -69,7 +69,7 @@ unsafeInterleaveIO action = fromUIO $ \w -> (# w , case action' w of (# _,  a #)
 
 showError :: IOError -> IO b
 --showError (IOError z) = putErrLn z `thenIO_` exitFailure
-showError ioe = putErrLn (ioeGetErrorString ioe) `thenIO_` exitFailure
+showError ioe = c_put_buffer_flush `thenIO_` putErrLn (ioeGetErrorString ioe) `thenIO_` exitFailure
 
 userError x = IOError User x Nothing Nothing
 
@@ -136,8 +136,10 @@ IO (ST a) `thenIO` b = IO $ ST $ \w -> case a w of
 returnIO :: a -> IO a
 returnIO x = IO $ ST (\w -> (# w, x #))
 
+-- what a failing string had already put in an output buffer comes out first.
 {-# NOINLINE error #-}
 error s = unsafePerformIO' $
+    c_put_buffer_flush `thenIO_`
     putErrLn "error:"  `thenIO_`
     putErrLn s         `thenIO_`
     exitFailure
@@ -150,4 +152,5 @@ putChar c = c_putwchar (charToInt c)
 
 foreign import primitive "U2U" charToInt :: Char -> Int
 foreign import ccall "stdio.h jhc_utf8_putchar" c_putwchar :: Int -> IO ()
+foreign import ccall "jhc_put_buffer_flush" c_put_buffer_flush :: IO ()
 foreign import primitive "error.raiseIO__" raiseError :: a
@@ -15,7 +15,10 @@ withJumpPoint__ :: (JumpPoint -> Bool -> IO a) -> IO a
 withJumpPoint__ action = do
     p <- _malloc jmp_buf_size
     let jp = (JumpPoint p)
+    d <- jhc_function_depth
     r <- jhc_setjmp jp
+    -- the jump skipped the profiling exits of the functions it unwound.
+    if r /= zero then jhc_function_unwind d else return ()
     r <- action jp (r /= zero)
     _free p
     return r
@@ -28,6 +31,8 @@ foreign import ccall "&jhc_uncaught" errorJumpPoint :: JumpPoint
 
 foreign import ccall jhc_setjmp :: JumpPoint -> IO Int
 foreign import ccall jhc_longjmp :: JumpPoint -> IO ()
+foreign import ccall jhc_function_depth :: IO Int
+foreign import ccall jhc_function_unwind :: Int -> IO ()
 foreign import primitive "const.sizeof(jmp_buf)" jmp_buf_size  :: Int
 foreign import ccall "malloc.h malloc" _malloc :: Int -> IO (Ptr a)
 foreign import ccall "malloc.h free" _free :: Ptr a -> IO ()
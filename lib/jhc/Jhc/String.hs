@@ -11,19 +11,32 @@ module Jhc.String(
 import Jhc.Type.Basic
 import Jhc.Prim.Prim
 
+-- String literals are NUL terminated UTF-8. ASCII is handled here, a byte at
+-- a time, anything else by the runtime.
+
 {-# VCONSTRUCTOR unpackString #-}
 {-# NOINLINE unpackString #-}
 unpackString :: Addr__ -> [Char]
-unpackString addr = f addr where
-    f addr = case constPeekByte addr of
-        '\0'# -> []
-        c -> (Char c:f (increment addr))
+unpackString addr = f (utf8End addr) [] where
+    -- the list is built from the end, a cell at a time, rather than as a
+    -- thunk per character.
+    f :: Addr__ -> [Char] -> [Char]
+    f end cs = case equalsAddr end addr of
+        1# -> cs
+        0# -> case decrement end of
+            p -> case constPeekByte p of
+                c -> case isAscii c of
+                    1# -> f p (Char c:cs)
+                    0# -> case utf8Prev end of
+                        p' -> f p' (Char (utf8Char p'):cs)
 
 unpackStringFoldr :: Addr__ -> (Char -> b -> b) -> b -> b
 unpackStringFoldr addr cons nil = f addr where
     f addr = case constPeekByte addr of
         '\0'# -> nil
-        c -> (Char c `cons` f (increment addr))
+        c -> case isAscii c of
+            1# -> Char c `cons` f (increment addr)
+            0# -> Char (utf8Char addr) `cons` f (utf8Next addr)
 
 {-# NOINLINE eqUnpackedString #-}
 eqUnpackedString :: Addr__ -> [Char] -> Bool_
@@ -32,9 +45,13 @@ eqUnpackedString addr cs = f addr cs where
     f offset [] = case constPeekByte offset of '\0'# -> 1#; _ -> 0#
     f offset (Char c:cs) = case constPeekByte offset of
         '\0'# -> 0#
-        uc -> case equalsChar uc c of
-            0# -> 0#
-            1# -> f (increment offset) cs
+        uc -> case isAscii uc of
+            1# -> case equalsChar uc c of
+                0# -> 0#
+                1# -> f (increment offset) cs
+            0# -> case equalsChar (utf8Char offset) c of
+                0# -> 0#
+                1# -> f (utf8Next offset) cs
 
 eqString :: [Char] -> [Char] -> Bool_
 eqString [] [] = 1#
@@ -43,34 +60,21 @@ eqString (Char x:xs) (Char y:ys) = case equalsChar x y of
     1# -> eqString xs ys
 eqString _ _ = 0#
 
+isAscii :: Char_ -> Bool_
+isAscii c = ltChar c '\x80'#
+
 foreign import primitive increment :: Addr__ -> Addr__
+foreign import primitive decrement :: Addr__ -> Addr__
 foreign import primitive "Eq" equalsChar :: Char_ -> Char_ -> Bool_
+foreign import primitive "ULt" ltChar :: Char_ -> Char_ -> Bool_
+foreign import primitive "Eq" equalsAddr :: Addr__ -> Addr__ -> Bool_
 foreign import primitive constPeekByte :: Addr__ -> Char_
+foreign import ccall unsafe "jhc_utf8_end" utf8End :: Addr__ -> Addr__
+foreign import ccall unsafe "jhc_utf8_prev" utf8Prev :: Addr__ -> Addr__
+foreign import ccall unsafe "jhc_utf8_next" utf8Next :: Addr__ -> Addr__
+foreign import ccall unsafe "jhc_utf8_char" utf8Char :: Addr__ -> Char_
 
 {-
-unpackFoldrString :: Addr__ -> (Char_ -> b -> b) -> b -> b
-unpackFoldrString addr f e = unpack addr where
-    unpack addr = case constPeekByte addr of
-      '\NUL'# -> e
-      ch  | ch `leChar_` '\x7F'# = ch `f` unpack (increment addr)
-          | ch `leChar_` '\xDF'# = (((ch .&. '\x1f') `shiftL` 6#) .|. (constPeekByte (increment addr) .&. '\x3f')) `f` unpack (increment (increment addr))
-           (chr# (((ord# ch                                  -# 0xC0#) `uncheckedIShiftL#`  6#) +#
-                     (ord# (indexCharArray# addr (nh +# 1#)) -# 0x80#))) `f`
-          unpack (nh +# 2#)
-      | ch `leChar#` '\xEF'# =
-           (chr# (((ord# ch                                  -# 0xE0#) `uncheckedIShiftL#` 12#) +#
-                    ((ord# (indexCharArray# addr (nh +# 1#)) -# 0x80#) `uncheckedIShiftL#`  6#) +#
-                     (ord# (indexCharArray# addr (nh +# 2#)) -# 0x80#))) `f`
-          unpack (nh +# 3#)
-      | otherwise            =
-           (chr# (((ord# ch                                  -# 0xF0#) `uncheckedIShiftL#` 18#) +#
-                    ((ord# (indexCharArray# addr (nh +# 1#)) -# 0x80#) `uncheckedIShiftL#` 12#) +#
-                    ((ord# (indexCharArray# addr (nh +# 2#)) -# 0x80#) `uncheckedIShiftL#`  6#) +#
-                     (ord# (indexCharArray# addr (nh +# 3#)) -# 0x80#))) `f`
-          unpack (nh +# 4#)
-      where
-	ch = indexCharArray# addr nh
-
 eqSingleChar :: Char_ -> [Char] -> Bool_
 eqSingleChar ch (Char c:cs) = case equalsChar ch c of
     0# -> 0#
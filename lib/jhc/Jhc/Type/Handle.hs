@@ -9,7 +9,7 @@ data IOMode = ReadMode | WriteMode | AppendMode | ReadWriteMode
 data Handle = Handle {
     handleName :: [Char],
     handleFile :: !(Ptr (Ptr CFile)),
-    handleBinary :: !Bool,
+    handleBinary :: !(Ptr Int),
     handleIsPipe :: !Bool,
     handleIOMode :: !IOMode
     }
@@ -17,17 +17,23 @@ module Prelude.IO(
     putChar,
     runExpr,
     getChar,
+    fileContents,
+    filePutStr,
     userError
     ) where
 
+import Foreign.C.Error(throwErrno)
 import Foreign.C.String
+import Foreign.Storable
 import Jhc.Addr
 import Jhc.Basics
+import Jhc.ForeignPtr
 import Jhc.IO
 import Jhc.Monad
 import Jhc.Order
 import Jhc.Show
 import Jhc.Type.C
+import Jhc.Type.Word
 import System.C.Stdio
 import Jhc.Prim.Wrapper
 import Jhc.Class.Num
@@ -39,7 +45,10 @@ type FilePath = String
 {-# RULES "putStr/++"      forall xs ys . putStr (xs ++ ys) = putStr xs >> putStr ys #-}
 
 putStr     :: String -> IO ()
-putStr s   =  mapM_ putChar s
+putStr s   =  do
+    file <- peek c_stdout
+    binary <- peek c_stdout_binary
+    filePutStr file (binary /= 0) s
 
 putStrLn   :: String -> IO ()
 putStrLn s =  do putStr s
@@ -55,23 +64,67 @@ getLine    =  do c <- getChar
                        return (c:s)
 
 getContents :: IO String
-getContents = unsafeInterleaveIO getContents' where
-    getContents' = do
-        ch <- c_getwchar
-        if ch == -1 then return [] else  do
-            xs <- unsafeInterleaveIO getContents'
-            return (unsafeChr ch:xs)
+getContents = do
+    file <- peek c_stdin
+    binary <- peek c_stdin_binary
+    fileContents file c_stdin (binary /= 0)
 
 readFile :: FilePath -> IO String
 readFile fn = do
     file <- withCString fn $ \fnc -> c_fopen fnc (Ptr (Addr_ "r"#))
-    if  (file == nullPtr) then (fail $ "Could not open file:" ++ fn) else do
-        let gc = do
-                ch <- c_fgetwc file
-                if ch == -1 then c_fclose file >> return [] else do
-                        xs <- unsafeInterleaveIO gc
-                        return (unsafeChr ch:xs)
-        unsafeInterleaveIO gc
+    if  (file == nullPtr) then (fail $ "Could not open file:" ++ fn) else
+        fileContents file nullPtr False
+
+-- | The rest of a stream as a lazy string, decoded as UTF-8 or, when binary
+-- is set, a byte per character. It is read a chunk at a time with one call
+-- into the runtime, which decodes it into a buffer of characters, so the
+-- string costs a call and a thunk per chunk rather than per character.
+-- handle is where the Handle the stream belongs to keeps it, the string ends
+-- when it is closed. When it is null the string owns the stream and closes
+-- it at the end. The reader is freed by a finalizer, so a string that is not
+-- read to the end does not leak it.
+fileContents :: FILE -> Ptr FILE -> Bool -> IO String
+fileContents file handle binary = unsafeInterleaveIO $ do
+    p <- c_reader_new file handle (if binary then 1 else 0)
+    r <- newForeignPtr_ p
+    addForeignPtrFinalizer p_reader_free r
+    chars <- c_reader_chars p
+    let chunk = do
+            n <- c_reader_fill p
+            if n < 0 then throwErrno "hGetContents" else if n == 0 then return [] else do
+                xs <- unsafeInterleaveIO chunk
+                cs <- decode xs (n - 1)
+                touchForeignPtr r
+                return cs
+        decode acc i = do
+            c <- peekElemOff chars i
+            let acc' = word32ToChar c:acc
+            if i == 0 then return acc' else decode acc' (i - 1)
+    chunk
+
+-- | Write a string to a stream as UTF-8 or, when binary is set, a byte per
+-- character. Unless the stream passes output on as it is written, such as a
+-- terminal, the characters are gathered in a buffer that the runtime
+-- encodes and hands to the stream with one call whenever it fills up and at
+-- the end. If forcing the string raises an exception what the buffer holds
+-- is written out before it propagates, and if it ends the program the
+-- runtime writes it out on the way.
+filePutStr :: FILE -> Bool -> String -> IO ()
+filePutStr file binary s = do
+    interactive <- c_stream_interactive file
+    if interactive then mapM_ put s else do
+        buf <- c_put_buffer_get file mode
+        let fill i [] = flush i
+            fill i cs | i == c_PUT_BUFFER_SIZE = flush i >> fill 0 cs
+            fill i (c:cs) = pokeElemOff buf i (charToWord32 c) >> fill (i + 1) cs
+            flush 0 = return ()
+            flush i = c_put_buffer_write buf i >> return ()
+        fill 0 s `catch` \e -> c_put_buffer_finish buf >> ioError e
+        c_put_buffer_release buf
+  where
+    mode = if binary then 1 else 0
+    put c | binary = c_fputc (ord c) file >> return ()
+          | otherwise = c_fputwc (ord c) file >> return ()
 
 -- | The 'interact' function takes a function of type @String->String@
 -- as its argument.  The entire input from the standard input device is
@@ -95,7 +148,7 @@ writeFile'  :: FilePath -> String -> Addr_ -> IO ()
 writeFile' fn s mode = do
     file <- withCString fn $ \fnc -> c_fopen fnc (Ptr mode)
     if  (file == nullPtr) then (fail $ "Could not open file: " ++ fn) else do
-        mapM_ (flip c_fputwc file . ord) s
+        filePutStr file False s
         c_fclose file
         return ()
 
@@ -106,7 +159,9 @@ appendFile  :: FilePath -> String -> IO ()
 appendFile fn s = writeFile' fn s (Addr_ "a"#)
 
 putChar :: Char -> IO ()
-putChar c = c_putwchar (ord c)
+putChar c = do
+    binary <- peek c_stdout_binary
+    if binary /= 0 then peek c_stdout >>= c_fputc (ord c) >> return () else c_putwchar (ord c)
 
 -- | this is wrapped around arbitrary showable expressions when used as the main entry point
 runExpr :: Show a => a -> World__ -> World__
@@ -115,8 +170,23 @@ runExpr x w = runNoWrapper (print x) w
 --TODO EOF == -1
 getChar :: IO Char
 getChar = do
-    ch <- c_getwchar
+    binary <- peek c_stdin_binary
+    ch <- if binary /= 0 then peek c_stdin >>= c_fgetc else c_getwchar
     if ch == -1 then fail "End of file." else return (unsafeChr ch)
 
+foreign import ccall "stdio.h &stdin" c_stdin :: Ptr FILE
+foreign import ccall "stdio.h &stdout" c_stdout :: Ptr FILE
+foreign import ccall "jhc_stream_interactive" c_stream_interactive :: FILE -> IO Bool
+foreign import ccall "jhc_put_buffer_get" c_put_buffer_get :: FILE -> Int -> IO (Ptr Word32)
+foreign import ccall "jhc_put_buffer_release" c_put_buffer_release :: Ptr Word32 -> IO ()
+foreign import ccall "jhc_put_buffer_finish" c_put_buffer_finish :: Ptr Word32 -> IO ()
+foreign import ccall "jhc_put_buffer_write" c_put_buffer_write :: Ptr Word32 -> Int -> IO Int
+foreign import primitive "const.JHC_PUT_BUFFER_SIZE" c_PUT_BUFFER_SIZE :: Int
+foreign import ccall "jhc_reader_new" c_reader_new :: FILE -> Ptr FILE -> Int -> IO (Ptr ())
+foreign import ccall "&jhc_reader_free" p_reader_free :: FunPtr (Ptr () -> IO ())
+foreign import ccall "jhc_reader_chars" c_reader_chars :: Ptr () -> IO (Ptr Word32)
+foreign import ccall "jhc_reader_fill" c_reader_fill :: Ptr () -> IO Int
+foreign import primitive "U2U" word32ToChar :: Word32 -> Char
+foreign import primitive "U2U" charToWord32 :: Char -> Word32
 foreign import primitive "I2I" cwintToChar :: CWint -> Char
 foreign import primitive "U2U" charToCWchar :: Char -> CWchar
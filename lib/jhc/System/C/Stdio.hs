@@ -15,6 +15,8 @@ foreign import ccall "stdio.h jhc_utf8_putchar" c_putwchar :: Int -> IO ()
 foreign import ccall "wchar.h jhc_utf8_getc" c_fgetwc      :: FILE -> IO Int
 foreign import ccall "wchar.h jhc_utf8_getchar" c_getwchar :: IO Int
 foreign import ccall "wchar.h jhc_utf8_putc" c_fputwc      :: Int -> FILE -> IO Int
+foreign import ccall "stdio.h getc_unlocked" c_fgetc       :: FILE -> IO Int
+foreign import ccall "stdio.h putc_unlocked" c_fputc       :: Int -> FILE -> IO Int
 foreign import ccall "stdio.h fwrite_unlocked" c_fwrite    :: Ptr a -> CSize -> CSize -> FILE -> IO CSize
 foreign import ccall "stdio.h fread_unlocked" c_fread      :: Ptr a -> CSize -> CSize -> FILE -> IO CSize
 foreign import ccall "stdio.h fflush" c_fflush             :: FILE -> IO ()
@@ -22,6 +24,9 @@ foreign import ccall "stdio.h feof" c_feof                 :: FILE -> IO Int
 foreign import ccall "stdio.h ftell" c_ftell               :: FILE -> IO IntMax
 foreign import ccall "stdio.h fseek" c_fseek               :: FILE -> IntMax -> CInt -> IO Int
 foreign import ccall "stdio.h fileno" c_fileno             :: FILE -> IO Int
+foreign import ccall "&jhc_stdin_binary" c_stdin_binary    :: Ptr Int
+foreign import ccall "&jhc_stdout_binary" c_stdout_binary  :: Ptr Int
+foreign import ccall "&jhc_stderr_binary" c_stderr_binary  :: Ptr Int
 foreign import primitive "const.SEEK_SET" c_SEEK_SET :: CInt
 foreign import primitive "const.SEEK_CUR" c_SEEK_CUR :: CInt
 foreign import primitive "const.SEEK_END" c_SEEK_END :: CInt
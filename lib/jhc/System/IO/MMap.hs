@@ -0,0 +1,52 @@
+{-# OPTIONS_JHC -fno-prelude -fffi #-}
+-- | Read only access to files by mapping them into memory. Nothing is copied
+-- into the heap, the pages are read in as they are touched and the mapping
+-- goes away when the collector frees the ForeignPtr holding it.
+module System.IO.MMap(
+    mmapFileForeignPtr,
+    mmapFileByteArray,
+    mmapFileRegion
+    ) where
+
+import Foreign.C.Error
+import Foreign.C.String
+import Foreign.Marshal.Utils
+import Foreign.Storable
+import Jhc.Addr
+import Jhc.Basics
+import Jhc.ByteArray
+import Jhc.ForeignPtr
+import Jhc.IO
+import Jhc.Monad
+import Jhc.Num
+import Jhc.Order
+import Jhc.Type.Word
+import Prelude.IO(FilePath)
+
+-- | Map a whole file, returning its contents and size.
+mmapFileForeignPtr :: FilePath -> IO (ForeignPtr Word8, Int)
+mmapFileForeignPtr fp = mmapFile fp 0 (-1)
+
+mmapFileByteArray :: FilePath -> IO ByteArray
+mmapFileByteArray fp = mmapFileRegion fp 0 (-1)
+
+-- | @mmapFileRegion path offset n@ maps @n@ bytes of the file starting at
+-- @offset@, fewer when the file ends before that and all of the rest of it
+-- when @n@ is negative. Windows of a file too large for a single array can be
+-- mapped one after the other.
+mmapFileRegion :: FilePath -> Integer -> Int -> IO ByteArray
+mmapFileRegion fp off n = do
+    (p, len) <- mmapFile fp off n
+    return (unsafeForeignPtrToByteArray p len)
+
+mmapFile :: FilePath -> Integer -> Int -> IO (ForeignPtr Word8, Int)
+mmapFile fp off n = with n $ \plen -> do
+    ptr <- withCString fp $ \cfp -> c_mmap_file cfp (fromInteger off) plen
+    if ptr == nullPtr then throwErrno ("mmapFile " ++ fp) else do
+        len <- peek plen
+        p <- newForeignPtr_ ptr
+        addForeignPtrFinalizer p_munmap_file p
+        return (p, len)
+
+foreign import ccall "jhc_mmap_file" c_mmap_file :: CString -> Int64 -> Ptr Int -> IO (Ptr Word8)
+foreign import ccall "&jhc_munmap_file" p_munmap_file :: FunPtr (Ptr Word8 -> IO ())
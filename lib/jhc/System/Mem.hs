@@ -1,7 +1,73 @@
 {-# OPTIONS_JHC -fno-prelude -fffi #-}
 
-module System.Mem where
+module System.Mem(
+    performGC,
+    GCStats(..),
+    GCCacheStats(..),
+    getGCStats,
+    getGCCacheStats
+    ) where
 
+import Foreign.Marshal.Array
+import Foreign.Ptr
+import Jhc.Basics
+import Jhc.IO
+import Jhc.Monad
+import Jhc.Num
+import Jhc.Order
 import Jhc.Prim.IO
+import Jhc.Type.Word
 
 foreign import ccall safe "hs_perform_gc" performGC :: IO ()
+
+-- | Garbage collector telemetry, mirrors 'struct jhc_gc_stats' in rts/gc.h.
+-- Only the jgc collector fills in everything, the other allocators report
+-- what they know and leave the rest zero.
+data GCStats = GCStats {
+    gcNumGCs         :: !Word64,  -- ^ collections performed
+    gcBytesAllocated :: !Word64,  -- ^ bytes allocated since startup
+    gcLiveBytes      :: !Word64,  -- ^ bytes live after the last collection
+    gcMaxLiveBytes   :: !Word64,  -- ^ high water mark of 'gcLiveBytes'
+    gcTotalPauseNs   :: !Word64,  -- ^ total nanoseconds spent collecting
+    gcMaxPauseNs     :: !Word64,  -- ^ longest single collection
+    gcMegablocks     :: !Word64,  -- ^ megablocks held by the heap
+    gcBlocksUsed     :: !Word64,  -- ^ blocks handed out to caches
+    gcPauseHistogram :: [Word64]  -- ^ entry 0 counts pauses under 1us, entry i pauses in [2^(i-1),2^i) us
+    }
+
+-- | Occupancy of a single allocation cache, mirrors 'struct jhc_gc_cache_stats'.
+data GCCacheStats = GCCacheStats {
+    cacheEntrySize  :: !Word64,   -- ^ bytes per entry
+    cacheNumPtrs    :: !Word64,   -- ^ leading pointers per entry
+    cacheNumEntries :: !Word64,   -- ^ entries per block
+    cacheBlocks     :: !Word64,   -- ^ partially filled blocks
+    cacheFullBlocks :: !Word64    -- ^ completely filled blocks
+    }
+
+gcPauseBuckets, gcStatsWords, gcCacheStatsWords :: Int
+gcPauseBuckets = 24
+gcStatsWords = 8 + gcPauseBuckets
+gcCacheStatsWords = 5
+
+getGCStats :: IO GCStats
+getGCStats = allocaArray gcStatsWords $ \p -> do
+    c_gc_get_stats p
+    ws <- peekArray gcStatsWords p
+    case ws of
+        (a:b:c:d:e:f:g:h:hist) -> return GCStats {
+            gcNumGCs = a, gcBytesAllocated = b, gcLiveBytes = c, gcMaxLiveBytes = d,
+            gcTotalPauseNs = e, gcMaxPauseNs = f, gcMegablocks = g, gcBlocksUsed = h,
+            gcPauseHistogram = hist }
+
+getGCCacheStats :: IO [GCCacheStats]
+getGCCacheStats = do
+    n <- c_gc_get_cache_stats nullPtr 0
+    allocaArray (fromIntegral n * gcCacheStatsWords) $ \p -> do
+        n' <- c_gc_get_cache_stats p n
+        ws <- peekArray (fromIntegral (min n n') * gcCacheStatsWords) p
+        return (chunk ws)
+  where chunk (a:b:c:d:e:xs) = GCCacheStats a b c d e : chunk xs
+        chunk _ = []
+
+foreign import ccall safe "jhc_gc_get_stats" c_gc_get_stats :: Ptr Word64 -> IO ()
+foreign import ccall unsafe "jhc_gc_get_cache_stats" c_gc_get_cache_stats :: Ptr Word64 -> Word -> IO Word
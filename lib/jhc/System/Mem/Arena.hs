@@ -0,0 +1,34 @@
+{-# OPTIONS_JHC -fno-prelude -fffi #-}
+
+-- | Bounded memory batch processing for the default, non collecting,
+-- allocator. Everything allocated after a mark can be freed at once by
+-- resetting the arena to it.
+--
+-- Nothing allocated after the mark may be reachable once the arena is reset,
+-- that includes thunks built before the mark that were forced after it, as
+-- they are updated with their value. Debugging builds overwrite the freed
+-- memory so such a value is reported when it is evaluated. Under the other
+-- collectors marks are ignored and nothing is freed.
+module System.Mem.Arena(
+    ArenaMark(),
+    markArena,
+    resetArena,
+    withArena_
+    ) where
+
+import Jhc.Addr
+import Jhc.Basics
+import Jhc.IO
+import Jhc.Monad
+
+newtype ArenaMark = ArenaMark (Ptr ())
+
+-- | Run an action and free everything it allocated, its result is discarded.
+withArena_ :: IO a -> IO ()
+withArena_ act = do
+    m <- markArena
+    act
+    resetArena m
+
+foreign import ccall unsafe "jhc_arena_mark" markArena :: IO ArenaMark
+foreign import ccall unsafe "jhc_arena_reset" resetArena :: ArenaMark -> IO ()
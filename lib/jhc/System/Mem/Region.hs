@@ -0,0 +1,29 @@
+{-# OPTIONS_JHC -fno-prelude -fffi #-}
+
+-- | Request scoped allocation for programs compiled with -fregion.
+module System.Mem.Region(withRegion) where
+
+import Jhc.Basics
+import Jhc.IO
+import Jhc.Monad
+import Jhc.Prim.Rts
+import Jhc.Type.Word
+
+-- | Run an action in a fresh region, everything it allocates is freed at once
+-- when it returns. The result is evaluated to WHNF and returned in that form,
+-- so a thunk built inside is not handed out.
+--
+-- If the result lives in the region, or the action made something older point
+-- into it by updating a thunk that was built outside, a CAF, or writing to an
+-- 'IORef' or array, the memory is kept until the outermost region concerned
+-- exits. Pointers stored outside of the Haskell heap, such as in a 'StablePtr',
+-- are not seen. Without -fregion this just runs the action.
+withRegion :: IO a -> IO a
+withRegion act = do
+    r <- c_region_enter
+    x <- act
+    case toBang_ x of
+        y -> c_region_leave r y >> return (fromBang_ y)
+
+foreign import ccall unsafe "jhc_region_enter" c_region_enter :: IO Word
+foreign import ccall unsafe "jhc_region_leave" c_region_leave :: Word -> Bang_ a -> IO ()
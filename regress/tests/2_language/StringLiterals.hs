@@ -0,0 +1,20 @@
+{-# LANGUAGE MagicHash #-}
+import Jhc.String(unpackString)
+
+-- string literals are kept as UTF-8, matching against them and unpacking
+-- them must give back the characters that were written.
+classify :: String -> Int
+classify "naïve" = 1
+classify "λ→x" = 2
+classify "plain" = 3
+classify "😀" = 4
+classify _ = 0
+
+main :: IO ()
+main = do
+    print (map classify ["naïve", "λ→x", "plain", "😀", "naive", "λ→", ""])
+    let s = unpackString "añb€c😀d"#
+    print (map fromEnum s)
+    putStrLn s
+    putStrLn (unpackString "tab\there \"quoted\" ??= back\\slash"#)
+    print (length (unpackString ""#), length (unpackString "naïve"#))
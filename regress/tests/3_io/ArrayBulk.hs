@@ -0,0 +1,35 @@
+import Data.Array.IO
+import Data.Int
+import Data.Word
+import System.Mem
+
+-- the bulk operations on boxed and unboxed arrays.
+main :: IO ()
+main = do
+    a <- newIOArray (0, 9) "x"
+    fillIOArray a 2 5 (concat ["y", "z"])
+    copyIOArray a 1 a 4 6
+    performGC
+    mapM (readIOArray a) [0 .. 9] >>= print
+    xs <- newIOUArray (1, 1000) (0 :: Int)
+    mapM_ (\i -> writeIOUArray xs i (if odd i then i else negate i)) [1 .. 1000]
+    sumIOUArray xs >>= print
+    minimumIOUArray xs >>= print
+    maximumIOUArray xs >>= print
+    ds <- newIOUArray (0, 6) (1.5 :: Double)
+    fillIOUArray ds 3 2 (-2)
+    mapM (readIOUArray ds) [0 .. 6] >>= print
+    (,) `fmap` sumIOUArray ds `ap` minimumIOUArray ds >>= print
+    bs <- newIOUArray (0, 99) (7 :: Word8)
+    sumIOUArray bs >>= print
+    cs <- newIOUArray (0, 99) (0 :: Word8)
+    copyIOUArray bs 0 cs 10 90
+    compareIOUArray bs 0 cs 10 90 >>= print
+    compareIOUArray bs 0 cs 0 20 >>= print
+    writeIOUArray cs 50 9
+    compareIOUArray bs 0 cs 10 90 >>= print
+    ws <- newIOUArray (0, 3) (maxBound :: Word64)
+    sumIOUArray ws >>= print
+    is <- newIOUArray (0, 2) (minBound :: Int64)
+    maximumIOUArray is >>= print
+    where ap mf mx = mf >>= \f -> fmap f mx
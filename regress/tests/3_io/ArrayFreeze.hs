@@ -0,0 +1,35 @@
+import Data.Array
+import Data.Array.IO
+import Data.Array.Unboxed(UArray)
+import qualified Data.Array.Unboxed as U
+import System.Mem
+
+-- building arrays in place, and moving them between the mutable and
+-- immutable types.
+main :: IO ()
+main = do
+    let hist = accumArray (+) 0 (0, 4) [(x `mod` 5, 1) | x <- [1 .. 23 :: Int]] :: Array Int Int
+        sq = listArray (1, 5) [x * x | x <- [1 ..]] :: Array Int Int
+        short = listArray (0, 9) "abc"
+    print hist
+    print (sq, sq // [(2, 0), (5, 1)])
+    print (accum (flip (:)) (listArray (0, 1) ["", ""]) [(0, 'a'), (1, 'b'), (0, 'c')])
+    print (take 3 (elems short), fmap negate sq ! 3)
+    m <- thawIOArray sq
+    writeIOArray m 1 100
+    frozen <- freezeIOArray m
+    writeIOArray m 1 200
+    performGC
+    print (sq ! 1, frozen ! 1)
+    u <- unsafeThawIOArray frozen
+    writeIOArray u 2 (-1)
+    unsafeFreezeIOArray u >>= print . elems
+    um <- newIOUArray (0, 3) (1.5 :: Double)
+    ua <- freezeIOUArray um
+    writeIOUArray um 0 2.5
+    ua' <- unsafeFreezeIOUArray um
+    print (U.elems ua, U.elems ua')
+    ut <- thawIOUArray (U.listArray (0, 2) [7, 8, 9] :: UArray Int Int)
+    writeIOUArray ut 1 0
+    sumIOUArray ut >>= print
+    print (U.accumArray (+) 0 (0, 2) [(0, 1), (2, 5), (0, 3)] :: UArray Int Int)
@@ -0,0 +1,32 @@
+import Data.Word
+import Foreign.Marshal.Alloc
+import Foreign.Marshal.Array
+import System.Directory
+import System.IO
+
+-- buffering modes read back as they were set, and output written through a
+-- small buffer comes out whole and in order.
+main :: IO ()
+main = do
+    let fn = "Buffering.tmp"
+    h <- openFile fn WriteMode
+    hGetBuffering h >>= print
+    mapM_ (\m -> hSetBuffering h m >> hGetBuffering h >>= print)
+        [NoBuffering, LineBuffering, BlockBuffering (Just 7), BlockBuffering Nothing]
+    hSetBuffering h (BlockBuffering (Just 7))
+    hPutStr h "written through a buffer of seven bytes\n"
+    withArray (map (fromIntegral . fromEnum) "raw bytes\n" :: [Word8]) $ \p -> hPutBuf h p 10
+    hSetBuffering h NoBuffering
+    hPutStr h "unbuffered\n"
+    hClose h
+    readFile fn >>= putStr
+    h <- openBinaryFile fn ReadMode
+    allocaBytes 100 $ \p -> do
+        n <- hGetBuf h p 8
+        s <- peekArray n p :: IO [Word8]
+        print (n, map (toEnum . fromIntegral) s :: String)
+        n <- hGetBufNonBlocking h p 100
+        m <- hGetBuf h p 100
+        print (n, m)
+    hClose h
+    removeFile fn
@@ -0,0 +1,32 @@
+import Data.Word
+import Jhc.ByteArray
+import System.Directory
+import System.IO.MMap
+import System.Mem
+
+-- count the lines of a mapped file with memchr, and map windows of it that
+-- do not start on a page boundary. Unreachable mappings are unmapped by
+-- their finalizers as the collector runs.
+countLines :: ByteArray -> Int
+countLines a = go a 0 where
+    go a n = case elemIndexByteArray 10 a of
+        Nothing -> n
+        Just i -> go (sliceByteArray (i + 1) (sizeofByteArray a - i - 1) a) (n + 1)
+
+toString :: ByteArray -> String
+toString = map (toEnum . fromIntegral) . unpackByteArray
+
+main :: IO ()
+main = do
+    let fn = "MMap.tmp"
+    writeFile fn (unlines (map show [0 .. 9999 :: Int]))
+    a <- mmapFileByteArray fn
+    print (sizeofByteArray a, countLines a)
+    w <- mmapFileRegion fn 5000 12
+    putStrLn (show (toString w))
+    e <- mmapFileRegion fn 48880 100
+    putStrLn (show (toString e))
+    ns <- mapM (\i -> mmapFileRegion fn (toInteger i * 5) 4 >>= return . toString) [1000 .. 2999]
+    performGC
+    print (length (filter (== "") ns), last ns)
+    removeFile fn
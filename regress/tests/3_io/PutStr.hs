@@ -0,0 +1,30 @@
+import System.Directory
+import System.IO
+import System.IO.Unsafe
+
+-- output goes through a buffer that is written when it fills up, strings
+-- longer than it and strings that write while they are evaluated must come
+-- out in order.
+noisy :: Int -> String
+noisy n = unsafePerformIO $ do
+    appendFile "PutStr.log" (show n ++ "\n")
+    return (show n)
+
+main :: IO ()
+main = do
+    let long = concat [ show n ++ "," | n <- [1 .. 2000 :: Int] ]
+        fn = "PutStr.tmp"
+    writeFile fn long
+    s <- readFile fn
+    print (length s, s == long)
+    h <- openFile fn AppendMode
+    hPutStr h "tail"
+    hClose h
+    readFile fn >>= print . drop (length long)
+    putStrLn (take 5000 (cycle "abcdefghij") ++ "!")
+    writeFile "PutStr.log" ""
+    writeFile fn (long ++ noisy 1 ++ long)
+    readFile fn >>= print . (== long ++ "1" ++ long)
+    readFile "PutStr.log" >>= putStr
+    removeFile fn
+    removeFile "PutStr.log"
@@ -0,0 +1,8 @@
+-- the part of a string put before forcing it fails is still written.
+
+{-# NOINLINE failing #-}
+failing :: String
+failing = "abc" ++ error "x"
+
+main :: IO ()
+main = putStr failing
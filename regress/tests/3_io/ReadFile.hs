@@ -0,0 +1,20 @@
+import System.Directory
+import System.IO
+
+-- readFile and hGetContents read a chunk at a time, the contents span
+-- several chunks and the lines must come back whole.
+main :: IO ()
+main = do
+    let ls = [ show n ++ replicate (n `mod` 97) 'x' | n <- [1 .. 3000 :: Int] ]
+        fn = "ReadFile.tmp"
+    writeFile fn (unlines ls)
+    s <- readFile fn
+    print (length s)
+    print (lines s == ls)
+    h <- openFile fn ReadMode
+    s' <- hGetContents h
+    print (s' == s)
+    hClose h
+    removeFile fn
+    i <- getContents
+    putStr i
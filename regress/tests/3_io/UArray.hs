@@ -0,0 +1,26 @@
+import Data.Array.IO
+import Data.Array.Unboxed
+import Data.Word
+import System.Mem
+
+-- unboxed arrays of each element type, kept alive across collections.
+main :: IO ()
+main = do
+    sieve <- newIOUArray (2, 1000) (1 :: Word8)
+    let cross p = mapM_ (\i -> writeIOUArray sieve i 0) [p * p, p * p + p .. 1000]
+    mapM_ (\p -> readIOUArray sieve p >>= \v -> if v == 1 then cross p else return ()) [2 .. 31]
+    performGC
+    primes <- mapM (readIOUArray sieve) [2 .. 1000]
+    print (length (filter (== 1) primes))
+    xs <- newIOUArray (0, 99) (0 :: Double)
+    mapM_ (\i -> writeIOUArray xs i (fromIntegral i / 4)) [0 .. 99]
+    d <- mapM (readIOUArray xs) [0 .. 99]
+    print (sum d)
+    ys <- newIOUArray ((0, 0), (3, 3)) (0 :: Int)
+    mapM_ (\(i, j) -> writeIOUArray ys (i, j) (i * 10 + j)) (range ((0, 0), (3, 3)))
+    readIOUArray ys (2, 3) >>= print
+    unsafeReadIOUArray ys 15 >>= print
+    boundsIOUArray ys >>= print
+    let f = listArray (1, 5) [0.5, 1.5, 2.5, 3.5, 4.5] :: UArray Int Float
+        w = listArray (0, 3) [maxBound, 1, 2, 3] :: UArray Int Word
+    print (f ! 3, elems w)
@@ -0,0 +1,23 @@
+import Data.Char
+import System.Directory
+import System.IO
+
+-- text is UTF-8 both ways, binary handles are a byte per character.
+main :: IO ()
+main = do
+    s <- getContents
+    mapM_ (print . length) (lines s)
+    putStr s
+    print (map ord (head (lines s)))
+    let fn = "Utf8.tmp"
+        short = "\955x\8364\128512"
+    writeFile fn short
+    readFile fn >>= print . map ord
+    h <- openBinaryFile fn ReadMode
+    hGetContents h >>= print . map ord
+    -- characters that straddle the chunks the input is read in
+    let long = concat (replicate 20000 ("a" ++ short))
+    writeFile fn long
+    t <- readFile fn
+    print (length t, t == long)
+    removeFile fn
@@ -0,0 +1,20 @@
+import Foreign.Marshal.Alloc
+import Foreign.Ptr
+import Foreign.Storable
+import System.Mem.Arena
+
+-- each record is processed in its own arena so the memory used stays bounded
+-- no matter how many records there are. The running total lives outside of
+-- the heap so nothing allocated in the arena is reachable after the reset.
+process :: Ptr Int -> Int -> IO ()
+process total n = withArena_ $ do
+    t <- peek total
+    poke total $! t + sum [n .. n + 1000] `mod` 10007
+
+main :: IO ()
+main = do
+    total <- malloc
+    poke total 0
+    mapM_ (process total) [1 .. 20000]
+    peek total >>= print
+    free total
@@ -0,0 +1,9 @@
+import Data.Array
+
+-- arrays larger than an allocation chunk of the default allocator.
+main :: IO ()
+main = do
+    let n = 400000 :: Int
+        a = listArray (0, n - 1) [ i * 3 | i <- [0 .. n - 1] ] :: Array Int Int
+    print (a ! 0, a ! (n `div` 2), a ! (n - 1))
+    print (sum (elems a) `mod` 1000003)
@@ -0,0 +1,8 @@
+-- thunks are black holed while evaluated, shared ones must still be updated.
+main :: IO ()
+main = do
+    let xs = map (* 2) [1 .. 100000 :: Int]
+    print (sum xs)
+    print (length xs)
+    let fibs = 0 : 1 : zipWith (+) fibs (tail fibs) :: [Integer]
+    print (fibs !! 200)
@@ -0,0 +1,13 @@
+-- a thunk that demands its own value is reported instead of overflowing
+-- the C stack, whether it is entered through eval or eval_known.
+
+{-# NOINLINE knot #-}
+knot :: Int -> [Int]
+knot n = xs where
+    xs = n : map (+ y) xs
+    y = head (tail xs)
+
+main :: IO ()
+main = do
+    putStrLn "start"
+    print (take 2 (knot 1))
@@ -0,0 +1,21 @@
+-- the free variables of a black holed thunk are not kept alive while it is
+-- evaluated, so the list consumed by total is collected as it goes.
+import Data.List
+import System.Mem
+
+{-# NOINLINE build #-}
+build :: Int -> [Int]
+build n = [1 .. n]
+
+{-# NOINLINE total #-}
+total :: [Int] -> Int
+total = foldl' (\a _ -> a + 1) 0
+
+main :: IO ()
+main = do
+    let xs = build 1000000
+        t = total xs
+    print t
+    s <- getGCStats
+    print (gcMaxLiveBytes s < 8 * 1024 * 1024)
+    print t
@@ -0,0 +1,26 @@
+import Data.Word
+import Jhc.ByteArray
+import System.Mem
+
+main :: IO ()
+main = do
+    m <- newByteArray 100000
+    fillByteArray m 0 100000 0x61
+    mapM_ (\i -> writeByteArray m i (fromIntegral i)) [0 .. 9]
+    writeByteArray m 99999 0x7a
+    performGC
+    a <- unsafeFreezeByteArray m
+    print (sizeofByteArray a, indexByteArray a 5, indexByteArray a 99999)
+    let s = sliceByteArray 10 99990 a
+    print (sizeofByteArray s, indexByteArray s 0)
+    print (elemIndexByteArray 0x7a s, elemIndexByteArray 0x7b s)
+    let hello = packByteArray (map (fromIntegral . fromEnum) "hello world")
+    print (unpackByteArray (sliceByteArray 6 5 hello))
+    print (compare hello (packByteArray [104]), hello == hello, sliceByteArray 0 5 hello < hello)
+    m' <- newByteArray 12
+    copyByteArray hello 6 m' 1 5
+    copyByteArray hello 5 m' 6 1
+    copyByteArray hello 0 m' 7 5
+    copyMutableByteArray m' 1 m' 0 11
+    b <- freezeByteArray m' 0 11
+    print (map (toEnum . fromIntegral) (unpackByteArray b) :: String)
@@ -0,0 +1,13 @@
+import System.Mem
+
+main :: IO ()
+main = do
+    print (sum [1 .. 1000 :: Int])
+    performGC
+    s <- getGCStats
+    print (gcNumGCs s >= 1)
+    print (gcBytesAllocated s > 0)
+    print (gcLiveBytes s <= gcMaxLiveBytes s)
+    print (sum (gcPauseHistogram s) == gcNumGCs s)
+    cs <- getGCCacheStats
+    print (not (null cs))
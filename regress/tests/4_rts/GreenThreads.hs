@@ -0,0 +1,40 @@
+import Control.Concurrent
+
+-- a ring of green threads passing a token around through MVars, and a
+-- channel with a duplicate reading the same items.
+ring :: Int -> Int -> IO Int
+ring size laps = do
+    first <- newEmptyMVar
+    done <- newEmptyMVar
+    let link from i | i == size = return from
+                    | otherwise = do
+            to <- newEmptyMVar
+            forkIO $ forward from to
+            link to (i + 1)
+        forward from to = do
+            t <- takeMVar from
+            putMVar to (t + 1)
+            forward from to
+    lst <- link first 1
+    forkIO $ let loop = do
+                    t <- takeMVar lst
+                    if t >= size * laps then putMVar done t else putMVar first (t + 1) >> loop
+             in loop
+    putMVar first 1
+    takeMVar done
+
+main :: IO ()
+main = do
+    ring 503 10 >>= print
+    c <- newChan
+    d <- dupChan c
+    forkIO $ writeList2Chan c [1 .. 100 :: Int]
+    xs <- fmap (take 100) (getChanContents c)
+    print (sum xs)
+    ys <- mapM (const (readChan d)) [1 .. 100 :: Int]
+    print (xs == ys)
+    m <- newEmptyMVar
+    mapM_ (\n -> forkIO (threadDelay (n * 10000) >> putMVar m n)) [3,1,2]
+    mapM (const (takeMVar m)) [1 .. 3 :: Int] >>= print
+    t <- myThreadId
+    print t
@@ -0,0 +1,28 @@
+import Control.Monad
+import System.Mem.Region
+
+-- every request allocates a fresh list that is gone once it has been summed.
+request :: Int -> IO Int
+request n = withRegion $ return $! sum [n .. n + 1000]
+
+-- a CAF first forced inside a region.
+{-# NOINLINE squares #-}
+squares :: [Int]
+squares = map (^ 2) [1 .. 1000]
+
+main :: IO ()
+main = do
+    rs <- mapM request [1 .. 1000]
+    print (sum rs)
+    -- the result points into the region, so the region must be kept.
+    s <- withRegion $ return $! show (product [1 .. 25 :: Integer])
+    putStrLn s
+    n <- withRegion $ withRegion $ return $! length (replicate 100000 'x')
+    print n
+    -- updating thunks built outside makes them point into the region, which
+    -- must then outlive it.
+    let evens = map (* 2) [1 .. 1000 :: Int]
+    a <- withRegion $ return $! sum evens
+    b <- withRegion $ return $! sum squares
+    print (a, sum evens)
+    print (b, sum squares)
@@ -0,0 +1,18 @@
+import Control.Concurrent
+import Data.IORef
+import System.IO
+import System.IO.Pipe
+
+-- reading from a pipe that is slow to produce parks the main thread, a
+-- ticking thread keeps running while it waits.
+main :: IO ()
+main = do
+    ticks <- newIORef (0 :: Int)
+    forkIO $ let tick = modifyIORef ticks (+ 1) >> threadDelay 10000 >> tick in tick
+    h <- openPipe "sleep 1; echo done" ReadMode
+    hWaitForInput h 50 >>= print
+    hGetLine h >>= putStrLn
+    n <- readIORef ticks
+    print (n > 10)
+    threadWaitWrite 1
+    hClose h
@@ -0,0 +1,19 @@
+import Control.Concurrent
+
+-- every thread forces the same shared thunk, it must be claimed by one of
+-- them and the others must see its value.
+worker :: Int -> Int -> MVar (Int,Int) -> IO ()
+worker shared n results = do
+    let local = sum [ x * n | x <- [1 .. 100000] ] `mod` 1000003
+    shared `seq` local `seq` putMVar results (local, shared)
+
+main :: IO ()
+main = do
+    let shared = sum [1 .. 200000 :: Int]
+    results <- newEmptyMVar
+    mapM_ (\n -> forkOS (worker shared n results)) [1 .. 4]
+    rs <- mapM (const (takeMVar results)) [1 .. 4 :: Int]
+    print (sum (map fst rs))
+    print (all ((== shared) . snd) rs)
+    print shared
+    print rtsSupportsBoundThreads
@@ -1,4 +1,5 @@
 import System
+import System.IO
 infinity = 1/0
 delta = sqrt e where e = encodeFloat (floatRadix e) (-floatDigits e)
 infixl 7 .*, *|
@@ -92,4 +93,5 @@ main = do
 	scene = create level (V 0 (-1) 4) 1  
 	scale x = 0.5 + 255 * x / (ss*ss)
 	picture = [ toEnum $ truncate $ scale $ pixel_vals n scene y x | y <- [n-1,n-2..0], x <- [0..n-1]]
+    hSetBinaryMode stdout True
     putStrLn $ "P5\n" ++ show ni ++ " " ++ show ni ++ "\n255\n" ++ picture
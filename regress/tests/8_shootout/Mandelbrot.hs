@@ -3,9 +3,10 @@
 -- Based on the SML version, written by Matthias Blume.
 -- Implemented in Haskell by Don Stewart
 --
-import System; import Data.Bits; import Data.Word; import Text.Printf; import Data.Char
+import System; import System.IO; import Data.Bits; import Data.Word; import Text.Printf; import Data.Char
 
 main = do (w::Word32) <- getArgs >>= readIO . head
+          hSetBinaryMode stdout True
           printf "P4\n%d %d\n" (fromIntegral w::Int) (fromIntegral w::Int) >> yl 0 w w
 
 yl y h w = if y < h then xl 0 y 0 8 h w else return ()
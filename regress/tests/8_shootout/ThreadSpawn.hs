@@ -0,0 +1,19 @@
+-- spawn n green threads that all block on one MVar before any of them may
+-- finish, then collect what each of them sends back.
+
+import Control.Concurrent
+import Control.Monad
+import System
+
+main :: IO ()
+main = do
+    n <- getArgs >>= readIO . head
+    start <- newEmptyMVar
+    results <- newChan
+    forM_ [1 .. n] $ \i -> forkIO $ do
+        k <- readMVar start
+        writeChan results (i * k `mod` 7)
+    putMVar start (3 :: Int)
+    rs <- replicateM n (readChan results)
+    print (length rs)
+    print (sum rs)
@@ -70,4 +70,5 @@ extern const void *const nh_stuff[];
 #include "rts/rts_support.h"
 #include "rts/gc.h"
 #include "rts/jhc_rts.h"
+#include "rts/threads.h"
 #include "lib/lib_cbits.h"
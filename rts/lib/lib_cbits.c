@@ -2,32 +2,967 @@
  * this file contains C only needed to help support the standard libraries
  */
 
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef __WIN32__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __GLIBC__
+#include <stdio_ext.h>
+#endif
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if _JHC_THREADED
+#include <pthread.h>
+#endif
 
 #include "HsFFI.h"
 #include "rts/cdefs.h"
+#include "rts/rts_support.h"
+#include "rts/threads.h"
+#include "lib/lib_cbits.h"
 
 HsInt jhc_stdrnd[2] A_UNUSED = { 1, 1 };
 HsInt jhc_data_unique A_UNUSED;
+// set by hSetBinaryMode on the standard handles, which are not allocated.
+HsInt jhc_stdin_binary A_UNUSED, jhc_stdout_binary A_UNUSED, jhc_stderr_binary A_UNUSED;
+
+#ifndef __WIN32__
+// stdio has no portable way to ask how much input a stream has buffered. With
+// its descriptor non-blocking a read takes what is buffered and then what the
+// descriptor has, and fails with EAGAIN rather than wait once both are used
+// up. The flags are shared with anything else that has the descriptor open,
+// so they are put back straight after.
+static int
+nonblocking_begin(FILE *f)
+{
+        int fl = fcntl(fileno(f), F_GETFL);
+        if (fl >= 0 && !(fl & O_NONBLOCK))
+                fcntl(fileno(f), F_SETFL, fl | O_NONBLOCK);
+        return fl;
+}
+
+static void
+nonblocking_end(FILE *f, int fl)
+{
+        if (fl >= 0 && !(fl & O_NONBLOCK))
+                fcntl(fileno(f), F_SETFL, fl);
+}
+
+// true when a read of f failed only because it would have had to wait.
+static bool
+would_block(FILE *f)
+{
+        if (ferror(f) && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                clearerr(f);
+                return true;
+        }
+        return false;
+}
+
+// wait until the descriptor of f has input, in the I/O manager once there are
+// other threads to run.
+static void
+wait_readable(FILE *f)
+{
+        if (jhc_threads_forked) {
+                jhc_io_wait(fileno(f), 0, -1);
+                return;
+        }
+        struct pollfd p = { fileno(f), POLLIN, 0 };
+        while (poll(&p, 1, -1) < 0 && errno == EINTR)
+                ;
+}
+
+// whether a read from f can be served without waiting. A byte is read to
+// find out and pushed back.
+static bool
+read_ready(FILE *f)
+{
+        int fl = nonblocking_begin(f);
+        int c = getc_unlocked(f);
+        bool r = c != EOF || !would_block(f);
+        if (c != EOF)
+                ungetc(c, f);
+        nonblocking_end(f, fl);
+        return r;
+}
+#endif
 
 HsBool A_UNUSED
 jhc_wait_for_input(FILE *f, HsInt timeout)
 {
-#if JHC_isPosix
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fileno(f), &fds);
-        struct timeval to = { 0, timeout * 1000 };
-        int retval = select(1, &fds, NULL, &fds, &to);
-        if (retval)
+#ifndef __WIN32__
+        if (read_ready(f))
                 return HS_BOOL_TRUE;
-        else
-                return HS_BOOL_FALSE;
+#endif
+        return jhc_io_wait(fileno(f), 0, timeout);
+}
+
+void
+jhc_wait_for_read(FILE *f)
+{
+#ifndef __WIN32__
+        while (!jhc_io_wait(fileno(f), 0, 0) && !read_ready(f))
+                jhc_io_wait(fileno(f), 0, -1);
+#endif
+}
+
+// read up to n bytes of what is available from f, blocking only when nothing
+// is and block is set. Returns 0 at the end of the file, or when nothing is
+// available without blocking, and -1 with errno set on an error.
+static HsInt
+read_available(FILE *f, HsPtr buf, HsInt n, bool block)
+{
+#ifndef __WIN32__
+        // the descriptor is non-blocking only while reading, never while
+        // waiting, as others may be using it meanwhile.
+        size_t got;
+        for (;;) {
+                int fl = nonblocking_begin(f);
+                got = fread(buf, 1, n, f);
+                bool again = would_block(f);
+                int e = errno;
+                nonblocking_end(f, fl);
+                errno = e;
+                if (!again || got || !block)
+                        break;
+                wait_readable(f);
+        }
+        return !got && ferror(f) ? -1 : (HsInt)got;
 #else
-        return HS_BOOL_FALSE;
+        // a line at a time so input typed at a terminal is seen as it comes.
+        unsigned char *p = buf;
+        int c = getc(f);
+        if (c == EOF)
+                return ferror(f) ? -1 : 0;
+        HsInt got = 0;
+        p[got++] = c;
+        while (got < n && c != '\n' && (c = getc(f)) != EOF)
+                p[got++] = c;
+        return got;
 #endif
 }
 
+// read up to n bytes of what is available from f, waiting only when nothing
+// is. A regular file is read a whole chunk at a time. Returns 0 at the end of
+// the file and -1 with errno set on an error.
+HsInt
+jhc_read_chunk(FILE *f, HsPtr buf, HsInt n)
+{
+        return read_available(f, buf, n, true);
+}
+
+// read n bytes from f into buf, fewer only at the end of the file. -1 on an
+// error before anything was read.
+HsInt
+jhc_get_buf(FILE *f, HsPtr buf, HsInt n)
+{
+        HsInt got = 0, r = 0;
+        while (got < n && (r = jhc_read_chunk(f, (char *)buf + got, n - got)) > 0)
+                got += r;
+        return got || r >= 0 ? got : -1;
+}
+
+// read up to n bytes of what is available from f without waiting for more,
+// 0 when there is nothing.
+HsInt
+jhc_get_buf_nonblocking(FILE *f, HsPtr buf, HsInt n)
+{
+        return read_available(f, buf, n, false);
+}
+
+/*
+ * Handle buffering
+ *
+ * The buffer of a handle is the one of its stream. hSetBuffering may give a
+ * stream a buffer of a size of its choosing, which is kept here until
+ * jhc_close closes the stream.
+ */
+
+struct stream_buffer {
+        struct stream_buffer *next;
+        FILE *file;
+        char *buf;                      // NULL when unbuffered
+        int mode;                       // _IONBF, _IOLBF or _IOFBF
+        HsInt size;
+};
+
+static struct stream_buffer *stream_buffers;
+#if _JHC_THREADED
+static pthread_mutex_t stream_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_BUFFERS() pthread_mutex_lock(&stream_buffers_lock)
+#define UNLOCK_BUFFERS() pthread_mutex_unlock(&stream_buffers_lock)
+#else
+#define LOCK_BUFFERS() do { } while (0)
+#define UNLOCK_BUFFERS() do { } while (0)
+#endif
+
+// find the entry of f, called with the lock held.
+static struct stream_buffer **
+find_buffer(FILE *f)
+{
+        struct stream_buffer **p = &stream_buffers;
+        while (*p && (*p)->file != f)
+                p = &(*p)->next;
+        return p;
+}
+
+// buffer f as mode says, with size bytes or BUFSIZ when size is 0. The
+// buffer is always one of ours, glibc would keep using the one f has when
+// given none. What f has to write is written first, input it has buffered
+// is dropped as setvbuf does. Returns 0 on success.
+HsInt
+jhc_set_buffering(FILE *f, HsInt mode, HsInt size)
+{
+        struct stream_buffer *b = malloc(sizeof(struct stream_buffer));
+        size_t len = size > 0 ? (size_t)size : BUFSIZ;
+        char *buf = NULL;
+        if (!b || (mode != _IONBF && !(buf = malloc(len)))) {
+                free(b);
+                return -1;
+        }
+        b->file = f;
+        b->buf = buf;
+        b->mode = mode;
+        b->size = mode == _IONBF ? 0 : size;
+        fflush(f);
+        LOCK_BUFFERS();
+        struct stream_buffer **p = find_buffer(f), *old = *p;
+        if (setvbuf(f, buf, mode, buf ? len : 0)) {
+                UNLOCK_BUFFERS();
+                free(buf);
+                free(b);
+                return -1;
+        }
+        // the stream no longer uses the buffer it had
+        b->next = old ? old->next : NULL;
+        *p = b;
+        UNLOCK_BUFFERS();
+        if (old) {
+                free(old->buf);
+                free(old);
+        }
+        return 0;
+}
+
+// how f is buffered, as _IONBF, _IOLBF or _IOFBF.
+HsInt
+jhc_buffer_mode(FILE *f)
+{
+        LOCK_BUFFERS();
+        struct stream_buffer *b = *find_buffer(f);
+        int mode = b ? b->mode : -1;
+        UNLOCK_BUFFERS();
+        if (mode >= 0)
+                return mode;
+#ifdef __GLIBC__
+        if (f->_IO_buf_base)
+                return f->_IO_buf_end - f->_IO_buf_base <= 1 ? _IONBF
+                    : __flbf(f) ? _IOLBF : _IOFBF;
+#endif
+        if (f == stderr)
+                return _IONBF;
+        return isatty(fileno(f)) ? _IOLBF : _IOFBF;
+}
+
+// the size hSetBuffering gave the buffer of f, 0 if it did not.
+HsInt
+jhc_buffer_size(FILE *f)
+{
+        LOCK_BUFFERS();
+        struct stream_buffer *b = *find_buffer(f);
+        HsInt size = b ? b->size : 0;
+        UNLOCK_BUFFERS();
+        return size;
+}
+
+static void put_buffer_close(FILE *f);
+
+// close f, which popen opened if pipe is set, and free its buffer.
+HsInt
+jhc_close(FILE *f, HsInt pipe)
+{
+        put_buffer_close(f);
+        LOCK_BUFFERS();
+        struct stream_buffer **p = find_buffer(f), *b = *p;
+        if (b)
+                *p = b->next;
+        UNLOCK_BUFFERS();
+        int r = pipe ? pclose(f) : fclose(f);
+        if (b) {
+                free(b->buf);
+                free(b);
+        }
+        return r;
+}
+
+// Files mapped by jhc_mmap_file. The mapping starts at the page holding the
+// address handed out, the finalizer looks it up here to unmap it.
+struct mapping {
+        struct mapping *next;
+        char *addr;
+        void *base;
+        size_t size;
+};
+
+static struct mapping *mappings;
+#if _JHC_THREADED
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_MAPPINGS() pthread_mutex_lock(&mappings_lock)
+#define UNLOCK_MAPPINGS() pthread_mutex_unlock(&mappings_lock)
+#else
+#define LOCK_MAPPINGS() do { } while (0)
+#define UNLOCK_MAPPINGS() do { } while (0)
+#endif
+
+// map *len bytes of the file at path starting at offset read only, or all of
+// the rest of it when *len is negative. *len is set to the number of bytes
+// mapped, which is less than asked for at the end of the file. Returns NULL
+// and sets errno on failure.
+HsPtr
+jhc_mmap_file(const char *path, int64_t offset, HsInt *len)
+{
+#ifndef __WIN32__
+        static char empty[1];
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return NULL;
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+                goto fail;
+        if (offset < 0 || offset > st.st_size) {
+                errno = EINVAL;
+                goto fail;
+        }
+        int64_t rest = st.st_size - offset;
+        if (*len < 0 || *len > rest) {
+                if (rest > INT32_MAX) {
+                        errno = EFBIG;
+                        goto fail;
+                }
+                *len = rest;
+        }
+        if (!*len) {
+                close(fd);
+                return empty;
+        }
+        size_t skip = offset % sysconf(_SC_PAGESIZE);
+        size_t size = skip + *len;
+        void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, offset - skip);
+        if (base == MAP_FAILED)
+                goto fail;
+        close(fd);
+        // the usual use is a single pass over the file, so read ahead and
+        // drop what was passed eagerly.
+        posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+        struct mapping *m = malloc(sizeof(*m));
+        m->addr = (char *)base + skip;
+        m->base = base;
+        m->size = size;
+        LOCK_MAPPINGS();
+        m->next = mappings;
+        mappings = m;
+        UNLOCK_MAPPINGS();
+        return m->addr;
+fail:
+        {
+                int e = errno;
+                close(fd);
+                errno = e;
+        }
+#else
+        errno = ENOSYS;
+#endif
+        return NULL;
+}
+
+// unmap what jhc_mmap_file returned, the finalizer of its ForeignPtr.
+void
+jhc_munmap_file(HsPtr addr)
+{
+        LOCK_MAPPINGS();
+        struct mapping **p = &mappings, *m;
+        while ((m = *p) && m->addr != addr)
+                p = &m->next;
+        if (m)
+                *p = m->next;
+        UNLOCK_MAPPINGS();
+        if (m) {
+#ifndef __WIN32__
+                munmap(m->base, m->size);
+#endif
+                free(m);
+        }
+}
+
+// whether f passes what is written on as it comes, such as a terminal, so
+// output to it must not be held back.
+HsBool
+jhc_stream_interactive(FILE *f)
+{
+        if (f == stderr)
+                return HS_BOOL_TRUE;
+#ifdef __GLIBC__
+        // once f has a buffer its mode is settled, unbuffered streams get a
+        // buffer of one byte.
+        if (f->_IO_buf_base)
+                return __flbf(f) || f->_IO_buf_end - f->_IO_buf_base <= 1;
+#endif
+        return isatty(fileno(f));
+}
+
+/*
+ * UTF-8
+ *
+ * Text is read and written as UTF-8 and binary handles as one byte per
+ * character. Malformed input becomes U+FFFD a byte at a time, as do
+ * surrogates and characters past U+10FFFF on output. Runs of ASCII, which
+ * is most of most text, are converted 16 or 32 bytes at a time.
+ */
+
+#define REPLACEMENT_CHAR 0xFFFD
+
+// the character of the sequence at s, of which n bytes are there. Returns its
+// length, 0 if it is cut off or, if it is malformed, minus the number of
+// bytes that stand for one U+FFFD.
+static int
+utf8_char(const uint8_t *s, size_t n, uint32_t *cp)
+{
+        uint8_t c = s[0], lo = 0x80, hi = 0xBF;
+        int len;
+        if (c < 0xC2)
+                return -1;
+        else if (c < 0xE0)
+                len = 2;
+        else if (c < 0xF0) {
+                len = 3;
+                if (c == 0xE0)
+                        lo = 0xA0;      // overlong
+                else if (c == 0xED)
+                        hi = 0x9F;      // surrogates
+        } else if (c < 0xF5) {
+                len = 4;
+                if (c == 0xF0)
+                        lo = 0x90;      // overlong
+                else if (c == 0xF4)
+                        hi = 0x8F;      // past U+10FFFF
+        } else
+                return -1;
+        uint32_t v = c & (0x7F >> len);
+        for (int i = 1; i < len; i++) {
+                if ((size_t)i == n)
+                        return 0;
+                if (s[i] < lo || s[i] > hi)
+                        return -i;
+                lo = 0x80;
+                hi = 0xBF;
+                v = v << 6 | (s[i] & 0x3F);
+        }
+        *cp = v;
+        return len;
+}
+
+// decode the n bytes at src into dst, which has room for n characters. A
+// sequence cut off at the end is left for the next call unless final is
+// set, *used gets the number of bytes decoded. Returns the number of
+// characters.
+static size_t
+utf8_decode(const uint8_t *src, size_t n, uint32_t *dst, size_t *used, bool final)
+{
+        const uint8_t *s = src, *end = src + n;
+        uint32_t *d = dst;
+        while (s < end) {
+#if defined(__AVX2__)
+                for (; end - s >= 32; s += 32, d += 32) {
+                        __m256i v = _mm256_loadu_si256((const __m256i *)s);
+                        if (_mm256_movemask_epi8(v))
+                                break;
+                        for (int i = 0; i < 4; i++)
+                                _mm256_storeu_si256((__m256i *)(d + 8 * i),
+                                    _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(s + 8 * i))));
+                }
+#endif
+#if defined(__SSE2__)
+                for (; end - s >= 16; s += 16, d += 16) {
+                        __m128i v = _mm_loadu_si128((const __m128i *)s);
+                        if (_mm_movemask_epi8(v))
+                                break;
+                        __m128i z = _mm_setzero_si128();
+                        __m128i lo = _mm_unpacklo_epi8(v, z), hi = _mm_unpackhi_epi8(v, z);
+                        _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(lo, z));
+                        _mm_storeu_si128((__m128i *)(d + 4), _mm_unpackhi_epi16(lo, z));
+                        _mm_storeu_si128((__m128i *)(d + 8), _mm_unpacklo_epi16(hi, z));
+                        _mm_storeu_si128((__m128i *)(d + 12), _mm_unpackhi_epi16(hi, z));
+                }
+#else
+                for (; end - s >= 8; s += 8, d += 8) {
+                        uint64_t w;
+                        memcpy(&w, s, 8);
+                        if (w & UINT64_C(0x8080808080808080))
+                                break;
+                        for (int i = 0; i < 8; i++)
+                                d[i] = s[i];
+                }
+#endif
+                // up to the next byte that is not ASCII
+                while (s < end && *s < 0x80)
+                        *d++ = *s++;
+                if (s == end)
+                        break;
+                uint32_t c;
+                int len = utf8_char(s, end - s, &c);
+                if (len > 0) {
+                        *d++ = c;
+                        s += len;
+                } else if (len < 0) {
+                        *d++ = REPLACEMENT_CHAR;
+                        s -= len;
+                } else if (final) {
+                        *d++ = REPLACEMENT_CHAR;
+                        s = end;
+                } else
+                        break;
+        }
+        *used = s - src;
+        return d - dst;
+}
+
+// encode c at d, returning its length.
+static int
+utf8_put(uint32_t c, uint8_t *d)
+{
+        if (c < 0x80) {
+                d[0] = c;
+                return 1;
+        } else if (c < 0x800) {
+                d[0] = 0xC0 | c >> 6;
+                d[1] = 0x80 | (c & 0x3F);
+                return 2;
+        }
+        if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF)
+                c = REPLACEMENT_CHAR;
+        if (c < 0x10000) {
+                d[0] = 0xE0 | c >> 12;
+                d[1] = 0x80 | (c >> 6 & 0x3F);
+                d[2] = 0x80 | (c & 0x3F);
+                return 3;
+        }
+        d[0] = 0xF0 | c >> 18;
+        d[1] = 0x80 | (c >> 12 & 0x3F);
+        d[2] = 0x80 | (c >> 6 & 0x3F);
+        d[3] = 0x80 | (c & 0x3F);
+        return 4;
+}
+
+// encode the n characters at src into dst, which has room for four bytes
+// each. Returns the number of bytes.
+static size_t
+utf8_encode(const uint32_t *src, size_t n, uint8_t *dst)
+{
+        const uint32_t *s = src, *end = src + n;
+        uint8_t *d = dst;
+        while (s < end) {
+#if defined(__AVX2__)
+                const __m256i high8 = _mm256_set1_epi32(~0x7F);
+                const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+                for (; end - s >= 32; s += 32, d += 32) {
+                        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+                        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 8));
+                        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 16));
+                        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 24));
+                        __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, e));
+                        if (!_mm256_testz_si256(any, high8))
+                                break;
+                        // the packs work within 128 bit lanes, the permute
+                        // puts the 32 bit groups back in order.
+                        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, e));
+                        _mm256_storeu_si256((__m256i *)d, _mm256_permutevar8x32_epi32(bytes, order));
+                }
+#endif
+#if defined(__SSE2__)
+                const __m128i high = _mm_set1_epi32(~0x7F);
+                for (; end - s >= 16; s += 16, d += 16) {
+                        __m128i a = _mm_loadu_si128((const __m128i *)s);
+                        __m128i b = _mm_loadu_si128((const __m128i *)(s + 4));
+                        __m128i c = _mm_loadu_si128((const __m128i *)(s + 8));
+                        __m128i e = _mm_loadu_si128((const __m128i *)(s + 12));
+                        __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, e));
+                        __m128i ascii = _mm_cmpeq_epi32(_mm_and_si128(any, high), _mm_setzero_si128());
+                        if (_mm_movemask_epi8(ascii) != 0xFFFF)
+                                break;
+                        _mm_storeu_si128((__m128i *)d,
+                            _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, e)));
+                }
+#endif
+                while (s < end && *s < 0x80)
+                        *d++ = *s++;
+                if (s < end)
+                        d += utf8_put(*s++, d);
+        }
+        return d - dst;
+}
+
+int
+jhc_utf8_getc_rest(FILE *f, int c)
+{
+        uint8_t b[4] = { c };
+        size_t n = 1;
+        uint32_t ch;
+        int len;
+        while (!(len = utf8_char(b, n, &ch))) {
+                int next = getc_unlocked(f);
+                if (next == EOF)
+                        return REPLACEMENT_CHAR;
+                b[n++] = next;
+        }
+        if (len > 0)
+                return ch;
+        // the byte that made it malformed may start the next character
+        if (n > (size_t)-len)
+                ungetc(b[n - 1], f);
+        return REPLACEMENT_CHAR;
+}
+
+int
+jhc_utf8_putc_rest(int c, FILE *f)
+{
+        uint8_t b[4];
+        int len = utf8_put(c, b);
+        return fwrite_unlocked(b, 1, len, f) == (size_t)len ? c : EOF;
+}
+
+// walking string literals, which the compiler emits as NUL terminated UTF-8,
+// for Jhc.String. Only characters past ASCII get here.
+
+uintptr_t
+jhc_utf8_end(uintptr_t s)
+{
+        return s + strlen((const char *)s);
+}
+
+// the start of the character that ends at p.
+uintptr_t
+jhc_utf8_prev(uintptr_t p)
+{
+        const uint8_t *s = (const uint8_t *)p;
+        do
+                s--;
+        while ((*s & 0xC0) == 0x80);
+        return (uintptr_t)s;
+}
+
+uintptr_t
+jhc_utf8_next(uintptr_t p)
+{
+        uint32_t c;
+        int len = utf8_char((const uint8_t *)p, 4, &c);
+        return p + (len > 0 ? len : 1);
+}
+
+uint32_t
+jhc_utf8_char(uintptr_t p)
+{
+        const uint8_t *s = (const uint8_t *)p;
+        uint32_t c;
+        if (*s < 0x80)
+                return *s;
+        return utf8_char(s, 4, &c) > 0 ? c : REPLACEMENT_CHAR;
+}
+
+// the state of fileContents, a chunk of input is decoded at a time. The
+// buffers are freed once the end is reached, the rest by the finalizer of the
+// ForeignPtr that holds it, so a string that is dropped before its end is
+// read does not leak them.
+struct reader {
+        FILE *file;
+        FILE **handle;                  // where a Handle keeps file, or NULL
+        bool binary;
+        size_t pending;                 // bytes of a cut off sequence
+        uint8_t *bytes;
+        uint32_t *chars;
+};
+
+// a reader for f. If handle is not NULL it is where the Handle f belongs to
+// keeps it and the reader stops once hClose clears it, otherwise the reader
+// owns f and closes it at the end.
+HsPtr
+jhc_reader_new(FILE *f, FILE **handle, HsInt binary)
+{
+        struct reader *r = malloc(sizeof(struct reader));
+        uint8_t *bytes = malloc(JHC_READ_CHUNK);
+        uint32_t *chars = malloc(JHC_READ_CHUNK * sizeof(uint32_t));
+        if (!r || !bytes || !chars) {
+                fputs("Out of memory!\n", stderr);
+                abort();
+        }
+        r->file = f;
+        r->handle = handle;
+        r->binary = binary;
+        r->pending = 0;
+        r->bytes = bytes;
+        r->chars = chars;
+        return r;
+}
+
+static void
+reader_end(struct reader *r)
+{
+        int e = errno;
+        if (!r->handle && r->file)
+                fclose(r->file);
+        r->file = NULL;
+        free(r->bytes);
+        free(r->chars);
+        r->bytes = NULL;
+        r->chars = NULL;
+        errno = e;
+}
+
+// the finalizer of a reader.
+void
+jhc_reader_free(HsPtr r)
+{
+        reader_end(r);
+        free(r);
+}
+
+HsPtr
+jhc_reader_chars(HsPtr r)
+{
+        return ((struct reader *)r)->chars;
+}
+
+// read and decode the next chunk, returning the number of characters, 0 at
+// the end of the file and -1 with errno set on a read error.
+HsInt
+jhc_reader_fill(HsPtr rp)
+{
+        struct reader *r = rp;
+        if (r->handle && r->file != *r->handle)
+                reader_end(r);
+        if (!r->file)
+                return 0;
+        for (;;) {
+                HsInt n = jhc_read_chunk(r->file, r->bytes + r->pending,
+                                         JHC_READ_CHUNK - r->pending);
+                if (n < 0) {
+                        reader_end(r);
+                        return -1;
+                }
+                if (r->binary) {
+                        for (HsInt i = 0; i < n; i++)
+                                r->chars[i] = r->bytes[i];
+                        if (!n)
+                                reader_end(r);
+                        return n;
+                }
+                if (!n && !r->pending) {
+                        reader_end(r);
+                        return 0;
+                }
+                size_t have = r->pending + n, used;
+                size_t k = utf8_decode(r->bytes, have, r->chars, &used, !n);
+                r->pending = have - used;
+                memmove(r->bytes, r->bytes + used, r->pending);
+                // a chunk that only starts a sequence needs the next one
+                if (k)
+                        return k;
+        }
+}
+
+// buffers hPutStr encodes into, one is kept per OS thread. A call made while
+// it is in use, from a string that writes as it is evaluated, gets a fresh
+// one. Haskell code sees only chars, slots it has not filled yet hold
+// PUT_UNUSED so the characters of a buffer whose string failed part way
+// can still be found and written.
+struct put_buffer {
+        struct put_buffer *older;       // the buffer in use before this one
+        FILE *f;
+        HsInt binary;
+        uint32_t chars[JHC_PUT_BUFFER_SIZE];
+        uint8_t bytes[JHC_PUT_BUFFER_SIZE * 4];
+};
+
+#define PUT_UNUSED 0xffffffff
+#define PUT_BUFFER(b) ((struct put_buffer *)((char *)(b) - offsetof(struct put_buffer, chars)))
+
+static JHC_THREAD_LOCAL struct put_buffer *put_buffer;
+// buffers in use, the newest first.
+static JHC_THREAD_LOCAL struct put_buffer *put_filling;
+
+HsPtr
+jhc_put_buffer_get(FILE *f, HsInt binary)
+{
+        struct put_buffer *p = put_buffer;
+        if (p)
+                put_buffer = NULL;
+        else if (!(p = malloc(sizeof *p))) {
+                fputs("Out of memory!\n", stderr);
+                abort();
+        }
+        memset(p->chars, 0xff, sizeof p->chars);
+        p->f = f;
+        p->binary = binary;
+        p->older = put_filling;
+        put_filling = p;
+        jhc_exit_flush = jhc_put_buffer_flush;
+        return p->chars;
+}
+
+void
+jhc_put_buffer_release(HsPtr b)
+{
+        struct put_buffer *p = PUT_BUFFER(b), **pp = &put_filling;
+        while (*pp != p)
+                pp = &(*pp)->older;
+        *pp = p->older;
+        if (put_buffer)
+                free(p);
+        else
+                put_buffer = p;
+}
+
+// write the first n characters of a put buffer to its stream.
+HsInt
+jhc_put_buffer_write(HsPtr b, HsInt n)
+{
+        struct put_buffer *p = PUT_BUFFER(b);
+        size_t len = n;
+        if (!p->f) {
+                // its stream was closed while the string was being forced.
+                memset(p->chars, 0xff, n * sizeof *p->chars);
+                return 0;
+        }
+        if (p->binary)
+                for (HsInt i = 0; i < n; i++)
+                        p->bytes[i] = p->chars[i];
+        else
+                len = utf8_encode(p->chars, n, p->bytes);
+        memset(p->chars, 0xff, n * sizeof *p->chars);
+        return fwrite_unlocked(p->bytes, 1, len, p->f);
+}
+
+static void
+put_buffer_write_filled(struct put_buffer *p)
+{
+        HsInt n = 0;
+        while (n < JHC_PUT_BUFFER_SIZE && p->chars[n] != PUT_UNUSED)
+                n++;
+        jhc_put_buffer_write(p->chars, n);
+}
+
+// write out what a buffer holds and release it, for a string whose forcing
+// raised an exception.
+void
+jhc_put_buffer_finish(HsPtr b)
+{
+        put_buffer_write_filled(PUT_BUFFER(b));
+        jhc_put_buffer_release(b);
+}
+
+// write out and release the buffers in use, oldest first. Called when the
+// program exits, which it does while a buffer is in use when forcing the
+// string being written fails.
+void
+jhc_put_buffer_flush(void)
+{
+        while (put_filling) {
+                struct put_buffer *p = put_filling;
+                while (p->older)
+                        p = p->older;
+                jhc_put_buffer_finish(p->chars);
+        }
+}
+
+// a stream being closed by a string that is being written to it. What was
+// put before comes out now, anything later is dropped.
+static void
+put_buffer_close(FILE *f)
+{
+        for (struct put_buffer *p = put_filling; p; p = p->older)
+                if (p->f == f) {
+                        put_buffer_write_filled(p);
+                        p->f = NULL;
+                }
+}
+
+// copy the first element of an unboxed array of n elements, each of size
+// bytes, over the rest of it. The run copied doubles each time so it takes a
+// few large memcpys rather than n small ones.
+void
+jhc_array_replicate(HsPtr p, HsInt size, HsInt n)
+{
+        if (n <= 1)
+                return;
+        if (size == 1) {
+                memset((char *)p + 1, *(uint8_t *)p, n - 1);
+                return;
+        }
+        char *d = p;
+        size_t total = (size_t)size * n, done = size;
+        while (done < total) {
+                size_t k = done < total - done ? done : total - done;
+                memcpy(d + done, d, k);
+                done += k;
+        }
+}
+
+// Reductions and comparisons over unboxed arrays, one set per element type.
+// The reductions are plain loops the C compiler can vectorize, integer sums
+// wrap as they do in Haskell so they are accumulated unsigned. min and max
+// are never called on empty arrays.
+#define ARRAY_OPS(name, t, acc)                                         \
+t                                                                       \
+jhc_array_sum_##name(const t *p, HsInt n)                               \
+{                                                                       \
+        acc s = 0;                                                      \
+        for (HsInt i = 0; i < n; i++)                                   \
+                s += (acc)p[i];                                         \
+        return (t)s;                                                    \
+}                                                                       \
+t                                                                       \
+jhc_array_min_##name(const t *p, HsInt n)                               \
+{                                                                       \
+        t m = p[0];                                                     \
+        for (HsInt i = 1; i < n; i++)                                   \
+                m = p[i] < m ? p[i] : m;                                \
+        return m;                                                       \
+}                                                                       \
+t                                                                       \
+jhc_array_max_##name(const t *p, HsInt n)                               \
+{                                                                       \
+        t m = p[0];                                                     \
+        for (HsInt i = 1; i < n; i++)                                   \
+                m = p[i] > m ? p[i] : m;                                \
+        return m;                                                       \
+}                                                                       \
+HsInt                                                                   \
+jhc_array_compare_##name(const t *a, const t *b, HsInt n)               \
+{                                                                       \
+        for (HsInt i = 0; i < n; i++)                                   \
+                if (a[i] != b[i])                                       \
+                        return a[i] < b[i] ? -1 : 1;                    \
+        return 0;                                                       \
+}
+
+ARRAY_OPS(int, HsInt, HsWord)
+ARRAY_OPS(word, HsWord, HsWord)
+ARRAY_OPS(word8, uint8_t, uint8_t)
+ARRAY_OPS(int64, int64_t, uint64_t)
+ARRAY_OPS(word64, uint64_t, uint64_t)
+ARRAY_OPS(float, HsFloat, HsFloat)
+ARRAY_OPS(double, HsDouble, HsDouble)
+
 uint32_t
 jhc_hash32(uint32_t key)
 {
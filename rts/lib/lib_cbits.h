@@ -6,37 +6,94 @@ struct FILE;
 
 extern HsInt jhc_stdrnd[2];
 extern HsInt jhc_data_unique;
+extern HsInt jhc_stdin_binary, jhc_stdout_binary, jhc_stderr_binary;
 HsBool jhc_wait_for_input(FILE *f, HsInt timeout);
+void jhc_wait_for_read(FILE *f);
+HsInt jhc_read_chunk(FILE *f, HsPtr buf, HsInt n);
+HsInt jhc_get_buf(FILE *f, HsPtr buf, HsInt n);
+HsInt jhc_get_buf_nonblocking(FILE *f, HsPtr buf, HsInt n);
+
+HsInt jhc_set_buffering(FILE *f, HsInt mode, HsInt size);
+HsInt jhc_buffer_mode(FILE *f);
+HsInt jhc_buffer_size(FILE *f);
+HsInt jhc_close(FILE *f, HsInt pipe);
+
+HsPtr jhc_mmap_file(const char *path, int64_t offset, HsInt *len);
+void jhc_munmap_file(HsPtr addr);
+
+void jhc_array_replicate(HsPtr p, HsInt size, HsInt n);
+#define ARRAY_OPS_DECL(name, t)                                         \
+        t jhc_array_sum_##name(const t *p, HsInt n);                    \
+        t jhc_array_min_##name(const t *p, HsInt n);                    \
+        t jhc_array_max_##name(const t *p, HsInt n);                    \
+        HsInt jhc_array_compare_##name(const t *a, const t *b, HsInt n);
+ARRAY_OPS_DECL(int, HsInt)
+ARRAY_OPS_DECL(word, HsWord)
+ARRAY_OPS_DECL(word8, uint8_t)
+ARRAY_OPS_DECL(int64, int64_t)
+ARRAY_OPS_DECL(word64, uint64_t)
+ARRAY_OPS_DECL(float, HsFloat)
+ARRAY_OPS_DECL(double, HsDouble)
+#undef ARRAY_OPS_DECL
+
+#define JHC_READ_CHUNK 32768
+HsPtr jhc_reader_new(FILE *f, FILE **handle, HsInt binary);
+void jhc_reader_free(HsPtr r);
+HsPtr jhc_reader_chars(HsPtr r);
+HsInt jhc_reader_fill(HsPtr r);
+
+#define JHC_PUT_BUFFER_SIZE 1024
+HsBool jhc_stream_interactive(FILE *f);
+HsPtr jhc_put_buffer_get(FILE *f, HsInt binary);
+void jhc_put_buffer_release(HsPtr b);
+HsInt jhc_put_buffer_write(HsPtr b, HsInt n);
+void jhc_put_buffer_finish(HsPtr b);
+void jhc_put_buffer_flush(void);
+
+uintptr_t jhc_utf8_end(uintptr_t s);
+uintptr_t jhc_utf8_prev(uintptr_t p);
+uintptr_t jhc_utf8_next(uintptr_t p);
+uint32_t jhc_utf8_char(uintptr_t p);
+
+int jhc_utf8_getc_rest(FILE *f, int c);
+int jhc_utf8_putc_rest(int c, FILE *f);
 
 #ifdef __WIN32__
 #define getchar_unlocked() getchar()
 #define putchar_unlocked(x) putchar(x)
 #define getc_unlocked(x) getc(x)
 #define putc_unlocked(x,y) putc(x,y)
+#define fwrite_unlocked(p,s,n,f) fwrite(p,s,n,f)
 #endif
 
+// ASCII is handled inline, anything else by the _rest functions. Once there
+// are other threads to run, wait for input in the I/O manager rather than in
+// read.
 inline static int A_UNUSED
-jhc_utf8_getchar(void)
+jhc_utf8_getc(FILE *f)
 {
-        return getchar_unlocked();
+        if (__predict_false(jhc_threads_forked))
+                jhc_wait_for_read(f);
+        int c = getc_unlocked(f);
+        return __predict_true(c < 0x80) ? c : jhc_utf8_getc_rest(f, c);
 }
 
 inline static int A_UNUSED
-jhc_utf8_getc(FILE *f)
+jhc_utf8_getchar(void)
 {
-        return getc_unlocked(f);
+        return jhc_utf8_getc(stdin);
 }
 
 inline static int A_UNUSED
-jhc_utf8_putchar(int ch)
+jhc_utf8_putc(int ch, FILE *f)
 {
-        return putchar_unlocked(ch);
+        return __predict_true((unsigned)ch < 0x80) ? putc_unlocked(ch, f) : jhc_utf8_putc_rest(ch, f);
 }
 
 inline static int A_UNUSED
-jhc_utf8_putc(int ch, FILE *f)
+jhc_utf8_putchar(int ch)
 {
-        return putc_unlocked(ch, f);
+        return jhc_utf8_putc(ch, stdout);
 }
 
 #endif
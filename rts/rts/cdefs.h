@@ -43,4 +43,15 @@
 #define A_COLD
 #define A_FALIGNED
 
+// _JHC_THREADED is set by -fthreaded, every OS thread then gets its own copy
+// of the runtime state marked JHC_THREAD_LOCAL.
+#ifndef _JHC_THREADED
+#define _JHC_THREADED 0
+#endif
+#if _JHC_THREADED
+#define JHC_THREAD_LOCAL __thread
+#else
+#define JHC_THREAD_LOCAL
+#endif
+
 #endif
@@ -1,6 +1,8 @@
 #ifndef JHC_GC_H
 #define JHC_GC_H
 
+#include <stdint.h>
+
 #define _JHC_GC_NONE   0
 #define _JHC_GC_JGC    1
 #define _JHC_GC_BOEHM  2
@@ -10,9 +12,50 @@
 #define _JHC_GC _JHC_GC_NONE
 #endif
 
+#include "rts/cdefs.h"
+
+#if _JHC_THREADED && _JHC_GC != _JHC_GC_JGC
+#error "_JHC_THREADED requires the jgc garbage collector."
+#endif
+
 void jhc_alloc_init(void);
 void jhc_alloc_fini(void);
 
+// Garbage collector telemetry. Every field is a uint64_t so the layout can be
+// read from Haskell as a plain array of Word64.
+
+// pause_histogram[0] counts pauses under 1us, pause_histogram[i] counts pauses
+// in [2^(i-1),2^i) microseconds, the last bucket catches everything longer.
+#define JHC_GC_PAUSE_BUCKETS 24
+
+struct jhc_gc_stats {
+        uint64_t num_gcs;          // number of garbage collections performed
+        uint64_t bytes_allocated;  // total bytes allocated since startup
+        uint64_t live_bytes;       // bytes live after the most recent gc
+        uint64_t max_live_bytes;   // high water mark of live_bytes
+        uint64_t total_pause_ns;   // total time spent collecting
+        uint64_t max_pause_ns;     // longest single collection
+        uint64_t megablocks;       // megablocks held by the heap
+        uint64_t blocks_used;      // blocks handed out to caches
+        uint64_t pause_histogram[JHC_GC_PAUSE_BUCKETS];
+};
+
+struct jhc_gc_cache_stats {
+        uint64_t size;             // size of an entry in bytes
+        uint64_t num_ptrs;         // number of leading pointers in an entry
+        uint64_t num_entries;      // entries per block
+        uint64_t blocks;           // partially filled blocks
+        uint64_t full_blocks;      // completely filled blocks
+};
+
+void jhc_gc_get_stats(struct jhc_gc_stats *stats);
+// fills in at most n entries and returns the total number of caches.
+unsigned jhc_gc_get_cache_stats(struct jhc_gc_cache_stats *cs, unsigned n);
+
+// A pinned array of size bytes, an atomic heap object whose first word holds
+// the address of the bytes following it. With jgc saved_gc must be set.
+void *gc_new_bytearray(size_t size) A_STD;
+
 #include "rts/gc_none.h"
 #include "rts/gc_jgc.h"
 
@@ -7,20 +7,71 @@
 
 #if _JHC_GC == _JHC_GC_JGC
 
+#if _JHC_THREADED
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define GC_STACK_ENTRIES (1UL << 18)
+
 #ifdef _JHC_JGC_FIXED_MEGABLOCK
 static char aligned_megablock_1[MEGABLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
 static char gc_stack_base_area[(1UL << 8)*sizeof(gc_t)];
 #endif
-gc_t saved_gc;
+JHC_THREAD_LOCAL gc_t saved_gc;
 struct s_arena *arena;
-static gc_t gc_stack_base;
+static LIST_HEAD(, gc_stack) gc_stacks = LIST_HEAD_INITIALIZER(gc_stacks);
+static struct jhc_gc_stats gc_stats;
+// words in slab blocks that survived the last collection, used to work out
+// how much was allocated in between without counting in s_alloc.
+static uint64_t live_slab_words;
+
+#if _JHC_THREADED
+// With -fthreaded every OS thread running haskell code owns a capability
+// with an arena of its own so allocation takes no locks, and uses the gc
+// stack of whichever haskell thread it runs. The caches the generated code
+// allocates from belong to the main arena, other capabilities allocate from
+// a copy found by the index of the cache.
+//
+// Collection stops the world. The collecting thread raises gc_requested and
+// waits for every running capability to reach a safe point, which is its
+// next allocation or a call that leaves the capability before blocking, then
+// marks from all of their stacks and sweeps every arena. A thread that never
+// allocates holds up a collection for as long as it runs.
+struct capability {
+        LIST_ENTRY(capability) link;
+        struct gc_stack *stack;         // the gc stack in use, if any
+        gc_t top;                       // top of it while stopped
+        struct gc_stack own;            // the stack of the attached thread
+        struct s_arena *arena;
+        struct s_cache **caches;        // copies of the main arena caches
+        unsigned num_caches;
+        bool attached;                  // owned by a thread
+};
+
+static LIST_HEAD(, capability) capabilities = LIST_HEAD_INITIALIZER(capabilities);
+static JHC_THREAD_LOCAL struct capability *current_cap;
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cap_cond = PTHREAD_COND_INITIALIZER;
+static unsigned caps_running;           // capabilities not at a safe point
+static bool gc_requested;
+
+#define CUR_ARENA (current_cap->arena)
+#define CUR_STACK (current_cap->stack)
+#else
+static struct gc_stack main_stack;
+static struct gc_stack *current_stack;
+
+#define CUR_ARENA arena
+#define CUR_STACK current_stack
+#endif
 
-#define TO_GCPTR(x) (entry_t *)(FROM_SPTR(x))
+#define TO_GCPTR(x) (entry_t *)(FROM_WPTR(x))
 
 void gc_perform_gc(gc_t gc) A_STD;
 static bool s_set_used_bit(void *val) A_UNUSED;
-static void clear_used_bits(struct s_arena *arena) A_UNUSED;
-static void s_cleanup_blocks(struct s_arena *arena);
+static uint64_t clear_used_bits(struct s_arena *arena) A_UNUSED;
+static uint64_t s_cleanup_blocks(struct s_arena *arena);
 static struct s_block *get_free_block(gc_t gc, struct s_arena *arena, bool retry);
 static void *jhc_aligned_alloc(unsigned size);
 
@@ -75,8 +126,15 @@ void gc_add_root(gc_t gc, void *root)
         if (IS_PTR(root)) {
                 entry_t *nroot = TO_GCPTR(root);
                 if (gc_check_heap(nroot)) {
+#if _JHC_THREADED
+                        // CAFs may be evaluated by any thread.
+                        pthread_mutex_lock(&cap_lock);
+#endif
                         stack_check(&root_stack, 1);
                         root_stack.stack[root_stack.ptr++] = nroot;
+#if _JHC_THREADED
+                        pthread_mutex_unlock(&cap_lock);
+#endif
                 }
         }
 }
@@ -99,6 +157,11 @@ gc_mark_deeper(struct stack *stack, unsigned *number_redirects)
                         VALGRIND_MAKE_MEM_DEFINED(e, pg->u.pi.size * sizeof(uintptr_t));
                 debugf("Processing Grey: %p\n", e);
                 unsigned num_ptrs = pg->flags & SLAB_MONOLITH ? pg->u.m.num_ptrs : pg->u.pi.num_ptrs;
+#if JHC_BLACKHOLING
+                // a thunk under evaluation has already loaded its free variables
+                if (num_ptrs && (fptr_t)e->ptrs[0] == BLACK_HOLE)
+                        num_ptrs = 0;
+#endif
                 stack_check(stack, num_ptrs);
                 for (unsigned i = 0; i < num_ptrs; i++) {
                         if (1 && (P_LAZY == GET_PTYPE(e->ptrs[i]))) {
@@ -124,42 +187,125 @@ gc_mark_deeper(struct stack *stack, unsigned *number_redirects)
 #define DO_GC_MARK_DEEPER(S,N)  do { } while (/* CONSTCOND */ 0)
 #endif
 
-void A_STD
-gc_perform_gc(gc_t gc)
+#if _JHC_PROFILE
+// the live bytes of the caches of one kind, summed over every arena.
+struct census_entry {
+        const char *node_name;
+        const char *site_name;
+        unsigned size, num_ptrs;
+        unsigned long live;
+};
+
+struct census {
+        struct census_entry *entries;
+        unsigned num_entries, size;
+        unsigned long large;
+};
+
+static void
+census_add(struct census *c, struct s_cache *sc, unsigned long live)
 {
-        profile_push(&gc_gc_time);
-        arena->number_gcs++;
-        unsigned number_redirects = 0;
-        unsigned number_stack = 0;
-        unsigned number_ptr = 0;
-        struct stack stack = EMPTY_STACK;
-        clear_used_bits(arena);
-        debugf("Setting Roots:");
-        stack_check(&stack, root_stack.ptr);
-        for (unsigned i = 0; i < root_stack.ptr; i++) {
-                gc_add_grey(&stack, root_stack.stack[i]);
-                debugf(" %p", root_stack.stack[i]);
-                DO_GC_MARK_DEEPER(&stack, &number_redirects);
+        struct census_entry *e;
+        for (unsigned i = 0; i < c->num_entries; i++) {
+                e = &c->entries[i];
+                if (e->node_name == sc->node_name && e->site_name == sc->site_name &&
+                    e->size == sc->size && e->num_ptrs == sc->num_ptrs) {
+                        e->live += live;
+                        return;
+                }
         }
-        debugf(" # ");
-        struct StablePtr *sp;
-        LIST_FOREACH(sp, &root_StablePtrs, link) {
-                gc_add_grey(&stack, (entry_t *)sp);
-                debugf(" %p", sp);
-                DO_GC_MARK_DEEPER(&stack, &number_redirects);
+        if (c->num_entries == c->size) {
+                c->size = c->size ? 2 * c->size : 64;
+                c->entries = realloc(c->entries, c->size * sizeof(c->entries[0]));
         }
-        debugf("\n");
-        debugf("Trace:");
+        e = &c->entries[c->num_entries++];
+        e->node_name = sc->node_name;
+        e->site_name = sc->site_name;
+        e->size = sc->size;
+        e->num_ptrs = sc->num_ptrs;
+        e->live = live;
+}
+
+static void
+census_arena(struct census *c, struct s_arena *arena)
+{
+        struct s_cache *sc;
+        struct s_block *pg;
+        SLIST_FOREACH(sc, &arena->caches, next) {
+                unsigned long live = 0;
+                SLIST_FOREACH(pg, &sc->blocks, link)
+                live += sc->num_entries - pg->u.pi.num_free;
+                SLIST_FOREACH(pg, &sc->full_blocks, link)
+                live += sc->num_entries - pg->u.pi.num_free;
+                if (live)
+                        census_add(c, sc, live * sc->size * sizeof(uintptr_t));
+        }
+        SLIST_FOREACH(pg, &arena->monolithic_blocks, link)
+        if (pg->used[0])
+                c->large += pg->u.m.size * sizeof(uintptr_t);
+}
+
+// must be called between marking and s_cleanup_blocks, at which point the
+// free count of every block reflects exactly its live entries. With
+// -fthreaded the arenas of all capabilities are counted together.
+static void
+heap_census(void)
+{
+        FILE *f = jhc_heap_profile_begin();
+        if (!f)
+                return;
+        struct census c = { NULL, 0, 0, 0 };
+#if _JHC_THREADED
+        struct capability *cap;
+        LIST_FOREACH(cap, &capabilities, link)
+        census_arena(&c, cap->arena);
+#else
+        census_arena(&c, arena);
+#endif
+        for (unsigned i = 0; i < c.num_entries; i++) {
+                struct census_entry *e = &c.entries[i];
+                if (e->node_name)
+                        fprintf(f, "%s/%s\t%lu\n", e->node_name, e->site_name, e->live);
+                else
+                        fprintf(f, "(%u/%u)\t%lu\n", e->size, e->num_ptrs, e->live);
+        }
+        if (c.large)
+                fprintf(f, "(large)\t%lu\n", c.large);
+        free(c.entries);
+        jhc_heap_profile_end();
+}
+#endif
+
+static void
+gc_record_pause(uint64_t ns)
+{
+        gc_stats.num_gcs++;
+        gc_stats.total_pause_ns += ns;
+        if (ns > gc_stats.max_pause_ns)
+                gc_stats.max_pause_ns = ns;
+        uint64_t us = ns / 1000;
+        unsigned bucket = us ? 64 - __builtin_clzll(us) : 0;
+        if (bucket >= JHC_GC_PAUSE_BUCKETS)
+                bucket = JHC_GC_PAUSE_BUCKETS - 1;
+        gc_stats.pause_histogram[bucket]++;
+}
+
+// mark everything reachable from the gc stack between base and top, returns
+// the number of stack entries.
+static unsigned
+gc_scan_stack(struct stack *stack, gc_t base, gc_t top,
+              unsigned *number_redirects, unsigned *number_ptr)
+{
 #if defined(_JHC_JGC_SAVING_MALLOC_HEAP)
-        stack_check(&stack, 1); // Just alloc
+        stack_check(stack, 1); // Just alloc
 #else
-        stack_check(&stack, gc - gc_stack_base);
+        stack_check(stack, top - base);
 #endif
-        number_stack = gc - gc_stack_base;
+        unsigned number_stack = top - base;
         for (unsigned i = 0; i < number_stack; i++) {
                 debugf(" |");
                 // TODO - short circuit redirects on stack
-                sptr_t ptr = gc_stack_base[i];
+                sptr_t ptr = base[i];
                 if (1 && (IS_LAZY(ptr))) {
                         assert(GET_PTYPE(ptr) == P_LAZY);
                         VALGRIND_MAKE_MEM_DEFINED(FROM_SPTR(ptr), sizeof(uintptr_t));
@@ -167,7 +313,7 @@ gc_perform_gc(gc_t gc)
                                 void *gptr = TO_GCPTR(ptr);
                                 if (gc_check_heap(gptr))
                                         s_set_used_bit(gptr);
-                                number_redirects++;
+                                number_redirects[0]++;
                                 debugf(" *");
                                 ptr = (sptr_t)GETHEAD(FROM_SPTR(ptr));
                         }
@@ -176,16 +322,285 @@ gc_perform_gc(gc_t gc)
                         debugf(" -");
                         continue;
                 }
-                number_ptr++;
+                number_ptr[0]++;
                 entry_t *e = TO_GCPTR(ptr);
                 debugf(" %p", (void *)e);
-                gc_add_grey(&stack, e);
+                gc_add_grey(stack, e);
+                DO_GC_MARK_DEEPER(stack, number_redirects);
+        }
+        return number_stack;
+}
+
+static void
+gc_stack_insert(struct gc_stack *s, gc_t base)
+{
+        s->base = s->top = base;
+        s->in_use = false;
+        LIST_INSERT_HEAD(&gc_stacks, s, link);
+}
+
+void
+jhc_gc_stack_register(struct gc_stack *s, gc_t base)
+{
+#if _JHC_THREADED
+        pthread_mutex_lock(&cap_lock);
+#endif
+        gc_stack_insert(s, base);
+#if _JHC_THREADED
+        pthread_mutex_unlock(&cap_lock);
+#endif
+}
+
+void
+jhc_gc_stack_unregister(struct gc_stack *s)
+{
+#if _JHC_THREADED
+        pthread_mutex_lock(&cap_lock);
+#endif
+        LIST_REMOVE(s, link);
+#if _JHC_THREADED
+        pthread_mutex_unlock(&cap_lock);
+#endif
+}
+
+struct gc_stack *
+jhc_gc_stack_current(void)
+{
+        return CUR_STACK;
+}
+
+gc_t
+jhc_gc_stack_switch(gc_t gc, struct gc_stack *s)
+{
+        if (CUR_STACK) {
+                CUR_STACK->top = gc;
+                CUR_STACK->in_use = false;
+        }
+        if ((CUR_STACK = s)) {
+                s->in_use = true;
+                gc = s->top;
+        }
+        return saved_gc = gc;
+}
+
+#if _JHC_THREADED
+static void
+cap_wait_for_gc(void)
+{
+        while (gc_requested)
+                pthread_cond_wait(&cap_cond, &cap_lock);
+}
+
+// returns true with every other capability stopped and cap_lock held, or
+// false when another thread collected while we waited.
+static bool
+cap_stop_world(gc_t gc)
+{
+        pthread_mutex_lock(&cap_lock);
+        current_cap->top = gc;
+        caps_running--;
+        if (gc_requested) {
+                pthread_cond_broadcast(&cap_cond);
+                cap_wait_for_gc();
+                caps_running++;
+                pthread_mutex_unlock(&cap_lock);
+                return false;
+        }
+        __atomic_store_n(&gc_requested, true, __ATOMIC_RELAXED);
+        while (caps_running)
+                pthread_cond_wait(&cap_cond, &cap_lock);
+        return true;
+}
+
+static void
+cap_start_world(void)
+{
+        __atomic_store_n(&gc_requested, false, __ATOMIC_RELAXED);
+        caps_running++;
+        pthread_cond_broadcast(&cap_cond);
+        pthread_mutex_unlock(&cap_lock);
+}
+
+void
+jhc_cap_leave(gc_t gc)
+{
+        pthread_mutex_lock(&cap_lock);
+        current_cap->top = gc;
+        caps_running--;
+        if (gc_requested)
+                pthread_cond_broadcast(&cap_cond);
+        pthread_mutex_unlock(&cap_lock);
+}
+
+void
+jhc_cap_enter(void)
+{
+        pthread_mutex_lock(&cap_lock);
+        cap_wait_for_gc();
+        caps_running++;
+        pthread_mutex_unlock(&cap_lock);
+}
+
+static inline void
+cap_safepoint(gc_t gc)
+{
+        if (__predict_false(__atomic_load_n(&gc_requested, __ATOMIC_RELAXED))) {
+                jhc_cap_leave(gc);
+                jhc_cap_enter();
+        }
+}
+
+void
+jhc_cap_yield(gc_t gc)
+{
+        if (__atomic_load_n(&gc_requested, __ATOMIC_RELAXED)) {
+                jhc_cap_leave(gc);
+                jhc_cap_enter();
+        } else
+                sched_yield();
+}
+
+static struct capability *
+new_capability(gc_t stack_base, struct s_arena *arena)
+{
+        struct capability *cap = malloc(sizeof(*cap));
+        memset(cap, 0, sizeof(*cap));
+        cap->own.base = stack_base;
+        cap->arena = arena;
+        LIST_INSERT_HEAD(&capabilities, cap, link);
+        return cap;
+}
+
+// capabilities of threads that exited are handed to new ones, their arenas
+// may still hold data other threads use.
+void
+jhc_cap_attach(void)
+{
+        pthread_mutex_lock(&cap_lock);
+        struct capability *cap;
+        LIST_FOREACH(cap, &capabilities, link)
+        if (!cap->attached)
+                break;
+        if (!cap)
+                cap = new_capability(malloc(GC_STACK_ENTRIES * sizeof(gc_t)), new_arena());
+        cap->attached = true;
+        gc_stack_insert(&cap->own, cap->own.base);
+        cap->own.in_use = true;
+        cap->stack = &cap->own;
+        cap->top = cap->own.base;
+        current_cap = cap;
+        saved_gc = cap->own.base;
+        cap_wait_for_gc();
+        caps_running++;
+        pthread_mutex_unlock(&cap_lock);
+}
+
+void
+jhc_cap_detach(void)
+{
+        pthread_mutex_lock(&cap_lock);
+        LIST_REMOVE(&current_cap->own, link);
+        current_cap->attached = false;
+        current_cap->stack = NULL;
+        current_cap = NULL;
+        caps_running--;
+        if (gc_requested)
+                pthread_cond_broadcast(&cap_cond);
+        pthread_mutex_unlock(&cap_lock);
+}
+
+// the copy of a cache of the main arena belonging to cap.
+static struct s_cache *
+cap_cache(struct capability *cap, struct s_cache *sc)
+{
+        if (__predict_false(sc->index >= cap->num_caches)) {
+                unsigned n = sc->index + 16;
+                cap->caches = realloc(cap->caches, n * sizeof(cap->caches[0]));
+                memset(cap->caches + cap->num_caches, 0,
+                       (n - cap->num_caches) * sizeof(cap->caches[0]));
+                cap->num_caches = n;
+        }
+        struct s_cache *csc = cap->caches[sc->index];
+        if (__predict_false(!csc)) {
+                csc = new_cache(cap->arena, sc->size, sc->num_ptrs);
+                csc->node_name = sc->node_name;
+                csc->site_name = sc->site_name;
+                cap->caches[sc->index] = csc;
+        }
+        return csc;
+}
+#endif
+
+void A_STD
+gc_perform_gc(gc_t gc)
+{
+#if _JHC_THREADED
+        if (!cap_stop_world(gc))
+                return;
+        struct capability *cap;
+#endif
+        profile_push(&gc_gc_time);
+        uint64_t start_time = jhc_clock_ns();
+        arena->number_gcs++;
+        unsigned number_redirects = 0;
+        unsigned number_stack = 0;
+        unsigned number_ptr = 0;
+        struct stack stack = EMPTY_STACK;
+        uint64_t used_words = 0;
+#if _JHC_THREADED
+        LIST_FOREACH(cap, &capabilities, link)
+        used_words += clear_used_bits(cap->arena);
+#else
+        used_words = clear_used_bits(arena);
+#endif
+        gc_stats.bytes_allocated += (used_words - live_slab_words) * sizeof(uintptr_t);
+        debugf("Setting Roots:");
+        stack_check(&stack, root_stack.ptr);
+        for (unsigned i = 0; i < root_stack.ptr; i++) {
+                gc_add_grey(&stack, root_stack.stack[i]);
+                debugf(" %p", root_stack.stack[i]);
+                DO_GC_MARK_DEEPER(&stack, &number_redirects);
+        }
+        debugf(" # ");
+        struct StablePtr *sp;
+        LIST_FOREACH(sp, &root_StablePtrs, link) {
+                gc_add_grey(&stack, (entry_t *)sp);
+                debugf(" %p", sp);
                 DO_GC_MARK_DEEPER(&stack, &number_redirects);
         }
         debugf("\n");
+        debugf("Trace:");
+#if _JHC_THREADED
+        LIST_FOREACH(cap, &capabilities, link)
+        if (cap->attached && cap->stack)
+                number_stack += gc_scan_stack(&stack, cap->stack->base, cap->top,
+                                              &number_redirects, &number_ptr);
+#else
+        number_stack = gc_scan_stack(&stack, current_stack->base, gc,
+                                     &number_redirects, &number_ptr);
+#endif
+        struct gc_stack *gs;
+        LIST_FOREACH(gs, &gc_stacks, link)
+        if (!gs->in_use)
+                number_stack += gc_scan_stack(&stack, gs->base, gs->top,
+                                              &number_redirects, &number_ptr);
+        debugf("\n");
         gc_mark_deeper(&stack, &number_redirects); // Final marking
         free(stack.stack);
-        s_cleanup_blocks(arena);
+#if _JHC_PROFILE
+        heap_census();
+#endif
+        uint64_t live_words = 0;
+        live_slab_words = 0;
+#if _JHC_THREADED
+        LIST_FOREACH(cap, &capabilities, link)
+        live_words += s_cleanup_blocks(cap->arena);
+#else
+        live_words = s_cleanup_blocks(arena);
+#endif
+        gc_stats.live_bytes = live_words * sizeof(uintptr_t);
+        if (gc_stats.live_bytes > gc_stats.max_live_bytes)
+                gc_stats.max_live_bytes = gc_stats.live_bytes;
         if (JHC_STATUS) {
                 fprintf(stderr, "%3u - %6u Used: %4u Thresh: %4u Ss: %5u Ps: %5u Rs: %5u Root: %3u\n",
                         arena->number_gcs,
@@ -199,7 +614,11 @@ gc_perform_gc(gc_t gc)
                        );
                 arena->number_allocs = 0;
         }
+        gc_record_pause(jhc_clock_ns() - start_time);
         profile_pop(&gc_gc_time);
+#if _JHC_THREADED
+        cap_start_world();
+#endif
 }
 
 // 7 to share caches with the first 7 tuples
@@ -214,11 +633,21 @@ jhc_alloc_init(void)
 {
         VALGRIND_PRINTF("Jhc-Valgrind mode active.\n");
 #ifdef _JHC_JGC_FIXED_MEGABLOCK
-        saved_gc = gc_stack_base = (void *) gc_stack_base_area;
+        gc_t gc_stack_base = (void *) gc_stack_base_area;
 #else
-        saved_gc = gc_stack_base = malloc((1UL << 18) * sizeof(gc_stack_base[0]));
+        gc_t gc_stack_base = malloc(GC_STACK_ENTRIES * sizeof(gc_stack_base[0]));
 #endif
         arena = new_arena();
+#if _JHC_THREADED
+        current_cap = new_capability(gc_stack_base, arena);
+        current_cap->attached = true;
+        caps_running = 1;
+        gc_stack_insert(&current_cap->own, gc_stack_base);
+        jhc_gc_stack_switch(gc_stack_base, &current_cap->own);
+#else
+        gc_stack_insert(&main_stack, gc_stack_base);
+        jhc_gc_stack_switch(gc_stack_base, &main_stack);
+#endif
         if (nh_stuff[0]) {
                 nh_end = nh_start = nh_stuff[0];
                 for (int i = 1; nh_stuff[i]; i++) {
@@ -241,6 +670,11 @@ jhc_alloc_fini(void)
                 fprintf(stderr, "arena: %p\n", arena);
                 fprintf(stderr, "  block_used: %i\n", arena->block_used);
                 fprintf(stderr, "  block_threshold: %i\n", arena->block_threshold);
+                fprintf(stderr, "  gcs: %lu max_pause: %luus total_pause: %luus max_live: %lu bytes\n",
+                        (unsigned long)gc_stats.num_gcs,
+                        (unsigned long)(gc_stats.max_pause_ns / 1000),
+                        (unsigned long)(gc_stats.total_pause_ns / 1000),
+                        (unsigned long)gc_stats.max_live_bytes);
                 struct s_cache *sc;
                 SLIST_FOREACH(sc, &arena->caches, next)
                 print_cache(sc);
@@ -265,6 +699,9 @@ s_monoblock(struct s_arena *arena, unsigned size, unsigned nptrs, unsigned flags
         b->color = (sizeof(struct s_block) + BITARRAY_SIZE_IN_BYTES(1) +
                     sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
         b->u.m.num_ptrs = nptrs;
+        b->u.m.size = size;
+        __atomic_fetch_add(&gc_stats.bytes_allocated, size * sizeof(uintptr_t), __ATOMIC_RELAXED);
+        alloc_sample("(large)", "(large)", size, nptrs);
         SLIST_INSERT_HEAD(&arena->monolithic_blocks, b, link);
         b->used[0] = 1;
         return (void *)b + b->color * sizeof(uintptr_t);
@@ -280,8 +717,8 @@ gc_array_alloc(gc_t gc, unsigned count)
         if (count <= GC_STATIC_ARRAY_NUM)
                 return (wptr_t)s_alloc(gc, array_caches[count - 1]);
         if (count < GC_MAX_BLOCK_ENTRIES)
-                return s_alloc(gc, find_cache(NULL, arena, count, count));
-        return s_monoblock(arena, count, count, 0);
+                return s_alloc(gc, find_cache(NULL, CUR_ARENA, count, count));
+        return s_monoblock(CUR_ARENA, count, count, 0);
         abort();
 }
 
@@ -295,8 +732,8 @@ gc_array_alloc_atomic(gc_t gc, unsigned count, unsigned flags)
         if (count <= GC_STATIC_ARRAY_NUM && !flags)
                 return (wptr_t)s_alloc(gc, array_caches_atomic[count - 1]);
         if (count < GC_MAX_BLOCK_ENTRIES && !flags)
-                return s_alloc(gc, find_cache(NULL, arena, count, 0));
-        return s_monoblock(arena, count, count, flags);
+                return s_alloc(gc, find_cache(NULL, CUR_ARENA, count, 0));
+        return s_monoblock(CUR_ARENA, count, count, flags);
         abort();
 }
 
@@ -361,6 +798,7 @@ s_new_megablock(struct s_arena *arena)
 #endif
         VALGRIND_MAKE_MEM_NOACCESS(mb->base, MEGABLOCK_SIZE);
         mb->next_free = 0;
+        __atomic_fetch_add(&gc_stats.megablocks, 1, __ATOMIC_RELAXED);
         return mb;
 }
 
@@ -412,13 +850,18 @@ void hs_foreignptr_env_helper(HsPtr env, HsPtr arg)
         ((finalizer_ptr)env)(arg);
 }
 
-static void
+// sweep the blocks of an arena after marking, returns the number of words
+// still live in it. The live words in slab blocks are added to
+// live_slab_words.
+static uint64_t
 s_cleanup_blocks(struct s_arena *arena)
 {
+        uint64_t live_words = 0, slab_words = 0;
         struct s_block *pg = SLIST_FIRST(&arena->monolithic_blocks);
         SLIST_INIT(&arena->monolithic_blocks);
         while (pg) {
                 if (pg->used[0]) {
+                        live_words += pg->u.m.size;
                         SLIST_INSERT_HEAD(&arena->monolithic_blocks, pg, link);
                         pg = SLIST_NEXT(pg, link);
                 } else {
@@ -429,6 +872,7 @@ s_cleanup_blocks(struct s_arena *arena)
                                         do {
                                                 fp[0](ptr[pg->color]);
                                         } while (*++fp);
+                                        free(ptr[pg->color + 1]);
                                 }
                         }
                         void *ptr = pg;
@@ -457,6 +901,7 @@ s_cleanup_blocks(struct s_arena *arena)
                 }
                 while (pg) {
                         struct s_block *npg = SLIST_NEXT(pg, link);
+                        slab_words += (sc->num_entries - pg->u.pi.num_free) * sc->size;
                         if (__predict_false(pg->u.pi.num_free == 0)) {
                                 // Add full blockes to the cache's full block list.
                                 SLIST_INSERT_HEAD(&sc->full_blocks, pg, link);
@@ -488,6 +933,8 @@ s_cleanup_blocks(struct s_arena *arena)
                 if (best)
                         SLIST_INSERT_HEAD(&sc->blocks, best, link);
         }
+        live_slab_words += slab_words;
+        return live_words + slab_words;
 }
 
 inline static void
@@ -510,16 +957,24 @@ clear_block_used_bits(unsigned num_entries, struct s_block *pg)
 heap_t A_STD
 s_alloc(gc_t gc, struct s_cache *sc)
 {
+#if _JHC_THREADED
+        cap_safepoint(gc);
+        if (sc->arena != current_cap->arena)
+                sc = cap_cache(current_cap, sc);
+#endif
 #if _JHC_PROFILE
         sc->allocations++;
         sc->arena->number_allocs++;
 #endif
+        alloc_sample(sc->site_name, sc->node_name, sc->size, sc->num_ptrs);
         bool retry = false;
         struct s_block *pg;
 retry_s_alloc:
         pg = SLIST_FIRST(&sc->blocks);
         if (__predict_false(!pg)) {
+                profile_push(&gc_alloc_time);
                 pg = get_free_block(gc, sc->arena, retry);
+                profile_pop(&gc_alloc_time);
                 if (__predict_false(!pg)) {
                         retry = true;
                         goto retry_s_alloc;
@@ -578,23 +1033,49 @@ new_cache(struct s_arena *arena, unsigned short size, unsigned short num_ptrs)
         SLIST_INIT(&sc->blocks);
         SLIST_INIT(&sc->full_blocks);
         SLIST_INSERT_HEAD(&arena->caches, sc, next);
+#if _JHC_THREADED
+        sc->index = arena->num_caches++;
+#endif
         return sc;
 }
 
-// clear all used bits, must be followed by a marking phase.
-static void
+// number of words occupied in slab blocks.
+static uint64_t
+slab_words_used(struct s_arena *arena)
+{
+        uint64_t words = 0;
+        struct s_block *pg;
+        struct s_cache *sc;
+        SLIST_FOREACH(sc, &arena->caches, next) {
+                SLIST_FOREACH(pg, &sc->blocks, link)
+                words += (sc->num_entries - pg->u.pi.num_free) * sc->size;
+                SLIST_FOREACH(pg, &sc->full_blocks, link)
+                words += sc->num_entries * sc->size;
+        }
+        return words;
+}
+
+// clear all used bits, must be followed by a marking phase. returns the
+// number of words that were in use in slab blocks before clearing.
+static uint64_t
 clear_used_bits(struct s_arena *arena)
 {
+        uint64_t words = 0;
         struct s_block *pg;
         SLIST_FOREACH(pg, &arena->monolithic_blocks, link)
         pg->used[0] = 0;
         struct s_cache *sc = SLIST_FIRST(&arena->caches);
         for (; sc; sc = SLIST_NEXT(sc, next)) {
-                SLIST_FOREACH(pg, &sc->blocks, link)
-                clear_block_used_bits(sc->num_entries, pg);
-                SLIST_FOREACH(pg, &sc->full_blocks, link)
-                clear_block_used_bits(sc->num_entries, pg);
+                SLIST_FOREACH(pg, &sc->blocks, link) {
+                        words += (sc->num_entries - pg->u.pi.num_free) * sc->size;
+                        clear_block_used_bits(sc->num_entries, pg);
+                }
+                SLIST_FOREACH(pg, &sc->full_blocks, link) {
+                        words += sc->num_entries * sc->size;
+                        clear_block_used_bits(sc->num_entries, pg);
+                }
         }
+        return words;
 }
 
 // Set a used bit. returns true if the tagged node should be scanned by the GC.
@@ -628,7 +1109,7 @@ find_cache(struct s_cache **rsc, struct s_arena *arena,
                 return *rsc;
         struct s_cache *sc = SLIST_FIRST(&arena->caches);
         for (; sc; sc = SLIST_NEXT(sc, next)) {
-                if (sc->size == size && sc->num_ptrs == num_ptrs)
+                if (sc->size == size && sc->num_ptrs == num_ptrs && !sc->node_name)
                         goto found;
         }
         sc = new_cache(arena, size, num_ptrs);
@@ -638,6 +1119,21 @@ found:
         return sc;
 }
 
+// create a cache that is never shared by find_cache, so everything allocated
+// from it can be attributed to the given node and allocation site.
+struct s_cache *
+new_named_cache(struct s_cache **rsc, struct s_arena *arena,
+                unsigned short size, unsigned short num_ptrs,
+                const char *node, const char *site)
+{
+        struct s_cache *sc = new_cache(arena, size, num_ptrs);
+        sc->node_name = node;
+        sc->site_name = site;
+        if (rsc)
+                *rsc = sc;
+        return sc;
+}
+
 struct s_arena *
 new_arena(void)
 {
@@ -649,6 +1145,9 @@ new_arena(void)
         arena->block_used = 0;
         arena->block_threshold = 8;
         arena->current_megablock = NULL;
+#if _JHC_THREADED
+        arena->num_caches = 0;
+#endif
         return arena;
 }
 
@@ -662,9 +1161,12 @@ get_heap_flags(void *sp)
         case P_LAZY:
                 ret |= SLAB_VIRTUAL_LAZY;
         case P_WHNF:
+                // strip the ptype and any constructor tag before looking at
+                // the address.
+                sp = FROM_WPTR(sp);
                 if (S_BLOCK(sp) == NULL)
                         return (ret | SLAB_VIRTUAL_SPECIAL);
-                if ((void *)sp >= nh_start && (void *)sp <= nh_end)
+                if (sp >= nh_start && sp <= nh_end)
                         return (ret | SLAB_VIRTUAL_CONSTANT);
                 return ret |= S_BLOCK(sp)->flags;
         }
@@ -687,6 +1189,14 @@ gc_malloc_foreignptr(unsigned alignment, unsigned size, bool finalizer)
         return TO_SPTR(P_WHNF, res);
 }
 
+heap_t A_STD
+gc_new_bytearray(size_t size)
+{
+        uintptr_t *res = gc_array_alloc_atomic(saved_gc, 1 + TO_BLOCKS(size), SLAB_FLAG_NONE);
+        res[0] = (uintptr_t)(res + 1);
+        return TO_SPTR(P_WHNF, res);
+}
+
 heap_t A_STD
 gc_new_foreignptr(HsPtr ptr)
 {
@@ -741,4 +1251,53 @@ void hs_perform_gc(void)
         gc_perform_gc(saved_gc);
 }
 
+void
+jhc_gc_get_stats(struct jhc_gc_stats *stats)
+{
+#if _JHC_THREADED
+        // the arenas of other threads can only be looked at while they are
+        // stopped, saved_gc is set as this is a safe call.
+        while (!cap_stop_world(saved_gc))
+                ;
+        uint64_t words = 0, blocks = 0;
+        struct capability *cap;
+        LIST_FOREACH(cap, &capabilities, link) {
+                words += slab_words_used(cap->arena);
+                blocks += cap->arena->block_used;
+        }
+        *stats = gc_stats;
+        stats->bytes_allocated += (words - live_slab_words) * sizeof(uintptr_t);
+        stats->blocks_used = blocks;
+        cap_start_world();
+#else
+        *stats = gc_stats;
+        stats->bytes_allocated += (slab_words_used(arena) - live_slab_words) * sizeof(uintptr_t);
+        stats->blocks_used = arena->block_used;
+#endif
+}
+
+unsigned
+jhc_gc_get_cache_stats(struct jhc_gc_cache_stats *cs, unsigned n)
+{
+        unsigned i = 0;
+        struct s_cache *sc;
+        struct s_block *pg;
+        // with -fthreaded these are the caches of the calling thread.
+        SLIST_FOREACH(sc, &CUR_ARENA->caches, next) {
+                if (i < n) {
+                        cs[i].size = sc->size * sizeof(uintptr_t);
+                        cs[i].num_ptrs = sc->num_ptrs;
+                        cs[i].num_entries = sc->num_entries;
+                        cs[i].blocks = 0;
+                        cs[i].full_blocks = 0;
+                        SLIST_FOREACH(pg, &sc->blocks, link)
+                        cs[i].blocks++;
+                        SLIST_FOREACH(pg, &sc->full_blocks, link)
+                        cs[i].full_blocks++;
+                }
+                i++;
+        }
+        return i;
+}
+
 #endif
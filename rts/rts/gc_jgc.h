@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include "sys/queue.h"
 #include "HsFFI.h"
+#include "rts/cdefs.h"
 
 struct sptr;
 struct s_arena;
@@ -29,7 +30,7 @@ typedef void *heap_t;  // a pointer into the GCed heap.
 #define TO_BLOCKS(x) (((x) + sizeof(uintptr_t) - 1)/sizeof(uintptr_t))
 
 extern struct s_arena *arena;
-extern gc_t saved_gc;
+extern JHC_THREAD_LOCAL gc_t saved_gc;
 
 void print_cache(struct s_cache *sc);
 struct s_cache *new_cache(struct s_arena *arena, unsigned short size,
@@ -37,6 +38,9 @@ struct s_cache *new_cache(struct s_arena *arena, unsigned short size,
 struct s_arena *new_arena(void);
 struct s_cache *find_cache(struct s_cache **rsc, struct s_arena *arena,
                            unsigned short size, unsigned short num_ptrs);
+struct s_cache *new_named_cache(struct s_cache **rsc, struct s_arena *arena,
+                                unsigned short size, unsigned short num_ptrs,
+                                const char *node, const char *site);
 void gc_add_root(gc_t gc, void *root);
 void A_STD gc_perform_gc(gc_t gc);
 uint32_t get_heap_flags(void *sp);
@@ -50,6 +54,35 @@ heap_t gc_malloc_foreignptr(unsigned alignment, unsigned size, bool finalizer) A
 heap_t gc_new_foreignptr(HsPtr ptr) A_STD;
 bool gc_add_foreignptr_finalizer(struct sptr *fp, HsFunPtr finalizer) A_STD;
 
+// Every haskell thread has a gc stack of its own. The collector scans the
+// stack in use up to the current top and every other registered stack up to
+// the top it had when it was switched away from. jhc_gc_stack_switch makes s
+// the stack of the calling OS thread, or none when s is NULL, and returns the
+// gc to continue with, which is also left in saved_gc.
+struct gc_stack {
+        LIST_ENTRY(gc_stack) link;
+        gc_t base;
+        gc_t top;                       // valid while not in use
+        bool in_use;
+};
+
+void jhc_gc_stack_register(struct gc_stack *s, gc_t base);
+void jhc_gc_stack_unregister(struct gc_stack *s);
+struct gc_stack *jhc_gc_stack_current(void);
+gc_t jhc_gc_stack_switch(gc_t gc, struct gc_stack *s);
+
+#if _JHC_THREADED
+// Every thread running haskell code owns a capability. A thread must attach
+// before it first allocates and leave its capability around anything that
+// may block, so that it does not hold up a collection, with gc the top of
+// its gc stack. jhc_cap_yield is a safe point for threads that spin.
+void jhc_cap_attach(void);
+void jhc_cap_detach(void);
+void jhc_cap_leave(gc_t gc);
+void jhc_cap_enter(void);
+void jhc_cap_yield(gc_t gc);
+#endif
+
 #define gc_frame0(gc,n,...) void *ptrs[n] = { __VA_ARGS__ }; \
         for(int i = 0; i < n; i++) gc[i] = (sptr_t)ptrs[i]; \
         gc_t sgc = gc;  gc_t gc = sgc + n;
@@ -64,4 +97,8 @@ struct StablePtr {
 
 extern LIST_HEAD(StablePtr_list, StablePtr) root_StablePtrs;
 
+struct sptr *c_newStablePtr(struct sptr *c);
+void c_freeStablePtr(struct sptr *wp);
+struct sptr *c_derefStablePtr(struct sptr *wp);
+
 #endif
@@ -17,6 +17,9 @@ struct s_arena {
         SLIST_HEAD(, s_megablock) megablocks;
         unsigned number_gcs;    // number of garbage collections
         unsigned number_allocs; // number of allocations since last garbage collection
+#if _JHC_THREADED
+        unsigned num_caches;    // caches created so far, for their index
+#endif
 };
 
 struct s_megablock {
@@ -40,6 +43,7 @@ struct s_block {
                 // A monolithic block.
                 struct {
                         unsigned num_ptrs;
+                        unsigned size;  // in words
                 } m;
         } u;
         bitarray_t used[];
@@ -55,9 +59,18 @@ struct s_cache {
         unsigned char flags;
         unsigned short num_entries;
         struct s_arena *arena;
+        // what is allocated from this cache, for heap profiles. NULL for
+        // caches shared by every node of the same shape.
+        const char *node_name;
+        const char *site_name;
 #if _JHC_PROFILE
         unsigned allocations;
 #endif
+#if _JHC_THREADED
+        // position of a cache of the main arena in the cache table of
+        // every other capability.
+        unsigned index;
+#endif
 };
 #endif
 #endif
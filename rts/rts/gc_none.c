@@ -1,8 +1,8 @@
-#include <stdio.h>
-#include <stdlib.h>
+#include "jhc_rts_header.h"
 
-#include "rts/gc.h"
-#include "rts/profile.h"
+#if JHC_isPosix
+#include <sys/mman.h>
+#endif
 
 #if _JHC_GC == _JHC_GC_BOEHM
 
@@ -17,23 +17,128 @@ void jhc_alloc_init(void)
 }
 void jhc_alloc_fini(void) { }
 
+void
+jhc_gc_get_stats(struct jhc_gc_stats *stats)
+{
+        memset(stats, 0, sizeof(*stats));
+        stats->num_gcs = GC_get_gc_no();
+        stats->bytes_allocated = GC_get_total_bytes();
+        stats->live_bytes = GC_get_heap_size() - GC_get_free_bytes();
+}
+
+unsigned
+jhc_gc_get_cache_stats(struct jhc_gc_cache_stats *cs, unsigned n)
+{
+        return 0;
+}
+
 #elif _JHC_GC == _JHC_GC_NONE
 
-// memory allocated in 1MB chunks.
-#define JHC_MEM_CHUNK_SIZE (1 << 20)
+// memory is bump allocated out of chunks of JHC_MEM_CHUNK_SIZE bytes, each
+// starting with a link to the chunk allocated before it so the arena can be
+// reset to an earlier mark. Requests over JHC_MEM_LARGE get a mapping of
+// their own, so big arrays work and a grow never throws away more than
+// JHC_MEM_LARGE bytes of the old chunk.
+#ifndef _JHC_MEM_CHUNK_SHIFT
+#define _JHC_MEM_CHUNK_SHIFT 20
+#endif
+#define JHC_MEM_CHUNK_SIZE (1UL << (_JHC_MEM_CHUNK_SHIFT))
+#define JHC_MEM_LARGE (JHC_MEM_CHUNK_SIZE / 8)
+// chunks freed by a reset that are kept around for the next grow.
+#define JHC_MEM_SPARE_CHUNKS 4
+
+struct mem_chunk {
+        struct mem_chunk *prev;
+        uintptr_t data[];
+};
+
+struct mem_large {
+        struct mem_large *prev;
+        uint64_t position;      // arena position it was allocated at
+        size_t size;            // size of the whole mapping
+        uintptr_t data[];
+};
 
-static char initial_chunk[JHC_MEM_CHUNK_SIZE];
+static union {
+        struct mem_chunk chunk;
+        char space[JHC_MEM_CHUNK_SIZE];
+} initial_chunk;
 
-static void *jhc_current_chunk = initial_chunk;
-static unsigned mem_chunks, mem_offset;
+static struct mem_chunk *jhc_current_chunk = &initial_chunk.chunk;
+static unsigned mem_chunks, mem_offset = sizeof(struct mem_chunk);
+static struct mem_chunk *mem_spare_chunks;
+static unsigned mem_num_spare_chunks;
+static struct mem_large *mem_large;
 
-void jhc_alloc_init(void) {}
+// bytes given back by jhc_arena_reset, so the totals still count them.
+static uint64_t mem_reset_bytes;
+static uint64_t mem_max_live;
+static uint64_t mem_large_bytes, mem_large_total, mem_large_count;
+static uint64_t mem_chunks_mapped, mem_chunks_reused;
+static uint64_t mem_start_ns;
+
+#define MEM_POSITION() ((uint64_t)JHC_MEM_CHUNK_SIZE * mem_chunks + mem_offset)
+
+// the arena only shrinks on a reset, so the high water mark is taken there
+// and whenever it is asked for.
+static uint64_t
+mem_update_max_live(void)
+{
+        uint64_t live = MEM_POSITION() + mem_large_bytes;
+        if (live > mem_max_live)
+                mem_max_live = live;
+        return live;
+}
+
+static void * A_COLD
+mem_map(size_t size)
+{
+#if JHC_isPosix && defined(MAP_ANONYMOUS)
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                p = NULL;
+#else
+        void *p = malloc(size);
+#endif
+        if (!p) {
+                fputs("Out of memory!\n", stderr);
+                abort();
+        }
+        return p;
+}
+
+static void
+mem_unmap(void *p, size_t size)
+{
+#if JHC_isPosix && defined(MAP_ANONYMOUS)
+        munmap(p, size);
+#else
+        free(p);
+#endif
+}
+
+void
+jhc_alloc_init(void)
+{
+        mem_start_ns = jhc_clock_ns();
+}
 
 void
 jhc_alloc_fini(void)
 {
         if (_JHC_PROFILE) {
-                fprintf(stderr, "Memory Allocated: %u bytes\n", (JHC_MEM_CHUNK_SIZE * (mem_chunks)) + mem_offset);
+                uint64_t total = MEM_POSITION() + mem_reset_bytes + mem_large_total;
+                double secs = (jhc_clock_ns() - mem_start_ns) / 1e9;
+                fprintf(stderr, "Memory Allocated: %llu bytes\n", (unsigned long long)total);
+                if (secs > 0)
+                        fprintf(stderr, "Allocation Rate: %.1f MB/s\n", total / secs / (1 << 20));
+                fprintf(stderr, "Chunks: %llu mapped, %llu reused, %u bytes each\n",
+                        (unsigned long long)mem_chunks_mapped, (unsigned long long)mem_chunks_reused,
+                        (unsigned)JHC_MEM_CHUNK_SIZE);
+                fprintf(stderr, "Large Allocations: %llu totalling %llu bytes\n",
+                        (unsigned long long)mem_large_count, (unsigned long long)mem_large_total);
+                mem_update_max_live();
+                fprintf(stderr, "Maximum Live: %llu bytes\n", (unsigned long long)mem_max_live);
                 print_alloc_size_stats();
         }
 }
@@ -41,29 +146,140 @@ jhc_alloc_fini(void)
 static void
 jhc_malloc_grow(void)
 {
-        void *c = malloc(JHC_MEM_CHUNK_SIZE);
-        if (!c) {
-                fputs("Out of memory!\n", stderr);
-                abort();
+        struct mem_chunk *c = mem_spare_chunks;
+        if (c) {
+                mem_spare_chunks = c->prev;
+                mem_num_spare_chunks--;
+                mem_chunks_reused++;
+        } else {
+                c = mem_map(JHC_MEM_CHUNK_SIZE);
+                mem_chunks_mapped++;
         }
+        c->prev = jhc_current_chunk;
         mem_chunks++;
         jhc_current_chunk = c;
-        mem_offset = 0;
+        mem_offset = sizeof(struct mem_chunk);
 }
 
 #define M_ALIGN(a,n) ((n) - 1 + ((a) - ((n) - 1) % (a)))
 
+static void *jhc_malloc_large(size_t n);
+
 static inline void *A_MALLOC
 jhc_malloc_basic(size_t n)
 {
         n = M_ALIGN(sizeof(void *), n);
-        if (n > (JHC_MEM_CHUNK_SIZE - mem_offset))
+        if (n > (JHC_MEM_CHUNK_SIZE - mem_offset)) {
+                if (n > JHC_MEM_LARGE)
+                        return jhc_malloc_large(n);
                 jhc_malloc_grow();
-        void *ret = jhc_current_chunk + mem_offset;
+        }
+        void *ret = (char *)jhc_current_chunk + mem_offset;
         mem_offset += n;
         return ret;
 }
 
+// large allocations are only made once they no longer fit in the current
+// chunk, so a chunk that has room is never wasted on them. A word of the
+// arena is taken as well so a reset can tell whether the allocation
+// happened after its mark.
+static void * A_COLD
+jhc_malloc_large(size_t n)
+{
+        uint64_t position = MEM_POSITION();
+        jhc_malloc_basic(sizeof(uintptr_t));
+        size_t size = sizeof(struct mem_large) + n;
+        struct mem_large *l = mem_map(size);
+        l->prev = mem_large;
+        l->position = position;
+        l->size = size;
+        mem_large = l;
+        mem_large_bytes += size;
+        mem_large_total += size;
+        mem_large_count++;
+        return l->data;
+}
+
+void *
+jhc_arena_mark(void)
+{
+        return (char *)jhc_current_chunk + mem_offset;
+}
+
+static bool
+chunk_contains(struct mem_chunk *c, char *p)
+{
+        return p >= (char *)c->data && p <= (char *)c + JHC_MEM_CHUNK_SIZE;
+}
+
+static void
+release_chunk(struct mem_chunk *c)
+{
+        if (_JHC_ARENA_POISON) {
+                // poisoned chunks are never reused, so anything still
+                // pointing into them keeps seeing the poison.
+                memset(c->data, JHC_ARENA_POISON_BYTE, JHC_MEM_CHUNK_SIZE - sizeof(struct mem_chunk));
+        } else if (mem_num_spare_chunks < JHC_MEM_SPARE_CHUNKS) {
+                c->prev = mem_spare_chunks;
+                mem_spare_chunks = c;
+                mem_num_spare_chunks++;
+        } else
+                mem_unmap(c, JHC_MEM_CHUNK_SIZE);
+}
+
+void
+jhc_arena_reset(void *mark)
+{
+        char *m = mark;
+        mem_update_max_live();
+        uint64_t before = MEM_POSITION();
+        unsigned end = mem_offset;
+        while (!chunk_contains(jhc_current_chunk, m)) {
+                struct mem_chunk *c = jhc_current_chunk;
+                if (c == &initial_chunk.chunk) {
+                        fprintf(stderr, "jhc_arena_reset: %p is not a mark of this arena\n", mark);
+                        abort();
+                }
+                jhc_current_chunk = c->prev;
+                mem_chunks--;
+                end = JHC_MEM_CHUNK_SIZE;
+                release_chunk(c);
+        }
+        unsigned offset = m - (char *)jhc_current_chunk;
+        if (offset > end) {
+                fprintf(stderr, "jhc_arena_reset: mark %p lies beyond the end of the arena\n", mark);
+                abort();
+        }
+        if (_JHC_ARENA_POISON)
+                memset(m, JHC_ARENA_POISON_BYTE, end - offset);
+        mem_offset = offset;
+        mem_reset_bytes += before - MEM_POSITION();
+        while (mem_large && mem_large->position >= MEM_POSITION()) {
+                struct mem_large *l = mem_large;
+                mem_large = l->prev;
+                mem_large_bytes -= l->size;
+                if (_JHC_ARENA_POISON)
+                        memset(l->data, JHC_ARENA_POISON_BYTE, l->size - sizeof(struct mem_large));
+                else
+                        mem_unmap(l, l->size);
+        }
+}
+
+void
+jhc_gc_get_stats(struct jhc_gc_stats *stats)
+{
+        memset(stats, 0, sizeof(*stats));
+        stats->bytes_allocated = MEM_POSITION() + mem_reset_bytes + mem_large_total;
+        stats->live_bytes = mem_update_max_live();
+        stats->max_live_bytes = mem_max_live;
+}
+
+unsigned
+jhc_gc_get_cache_stats(struct jhc_gc_cache_stats *cs, unsigned n)
+{
+        return 0;
+}
+
 #if _JHC_DEBUG
 
 void *A_MALLOC
@@ -95,3 +311,61 @@ jhc_malloc_atomic(size_t n)
 #endif
 
 #endif
+
+#if _JHC_GC != _JHC_GC_JGC
+void *A_STD
+gc_new_bytearray(size_t size)
+{
+        uintptr_t *res = jhc_malloc_atomic(sizeof(uintptr_t) + size);
+        res[0] = (uintptr_t)(res + 1);
+        return TO_SPTR(P_WHNF, res);
+}
+
+// A ForeignPtr is laid out as with jgc, the address followed by a NULL
+// terminated list of finalizers. Only Boehm collects it and runs them.
+#if _JHC_GC == _JHC_GC_BOEHM
+typedef void (*finalizer_ptr)(HsPtr arg);
+
+static void
+run_foreignptr_finalizers(void *obj, void *env)
+{
+        HsPtr *res = obj;
+        finalizer_ptr *fp = res[1];
+        for (unsigned i = 0; fp[i]; i++)
+                fp[i](res[0]);
+        free(fp);
+}
+#endif
+
+heap_t A_STD
+gc_new_foreignptr(HsPtr ptr)
+{
+        HsPtr *res = jhc_malloc_atomic(2 * sizeof(HsPtr));
+        res[0] = ptr;
+        res[1] = NULL;
+        return TO_SPTR(P_WHNF, res);
+}
+
+bool A_STD
+gc_add_foreignptr_finalizer(wptr_t fp, HsFunPtr finalizer)
+{
+#if _JHC_GC == _JHC_GC_BOEHM
+        HsPtr *res = (HsPtr *)FROM_SPTR(fp);
+        finalizer_ptr *list = res[1];
+        unsigned len = 0;
+        while (list && list[len])
+                len++;
+        if (!(list = realloc(list, (len + 2) * sizeof(finalizer_ptr))))
+                abort();
+        list[len] = (finalizer_ptr)finalizer;
+        list[len + 1] = NULL;
+        if (!res[1])
+                GC_register_finalizer(res, run_foreignptr_finalizers, NULL, NULL, NULL);
+        res[1] = list;
+        return true;
+#else
+        (void)fp; (void)finalizer;
+        return false;
+#endif
+}
+#endif
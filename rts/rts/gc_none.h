@@ -26,6 +26,62 @@ void *A_MALLOC jhc_malloc(size_t n);
 void *A_MALLOC jhc_malloc_atomic(size_t n);
 #endif
 
+// The arena can be reset to a mark taken earlier, which frees everything
+// allocated since in one go. With _JHC_ARENA_POISON the freed memory is
+// overwritten with JHC_ARENA_POISON_BYTE and never reused, so pointers that
+// escaped the reset are caught when they are evaluated.
+void *jhc_arena_mark(void);
+void jhc_arena_reset(void *mark);
+
+// poisoning is on unless NDEBUG is given, like the rest of the debug checks.
+#ifndef _JHC_ARENA_POISON
+#ifdef NDEBUG
+#define _JHC_ARENA_POISON 0
+#else
+#define _JHC_ARENA_POISON 1
+#endif
+#endif
+// 0xa5 has P_LAZY in its low bits, so a poisoned head always takes the
+// out of line path of eval.
+#define JHC_ARENA_POISON_BYTE 0xa5
+#define JHC_ARENA_POISON_WORD (UINTPTR_MAX / 0xff * JHC_ARENA_POISON_BYTE)
+
+#elif _JHC_GC == _JHC_GC_REGION
+
+void *A_MALLOC jhc_malloc(size_t n);
+void *A_MALLOC jhc_malloc_atomic(size_t n);
+
+// enter a new innermost region, and leave it again. 'result' is the value
+// the region produced, if it points into the region, or jhc_region_write saw
+// something older made to point into it, the region's memory is kept by the
+// outermost region that refers to it.
+unsigned jhc_region_enter(void);
+void jhc_region_leave(unsigned region, void *result);
+
+// write barrier for stores of 'value' into the existing node 'target', thunk
+// updates and writes to IORefs and arrays. Values that aren't pointers and
+// stores made outside of any region can't make an older region refer to a
+// newer one, so only the rest is looked at out of line.
+extern unsigned jhc_current_region;
+void jhc_region_escape(void *target, void *value);
+#define jhc_region_write(t,v) \
+        do { if (jhc_current_region && !((uintptr_t)(v) & 0x2)) \
+                jhc_region_escape((void *)(t), (void *)(v)); } while (0)
+
+#endif
+
+#if _JHC_GC != _JHC_GC_REGION
+// without the region allocator withRegion just runs its action.
+#define jhc_region_enter()    0u
+#define jhc_region_leave(r,x) ((void)(r), (void)(x))
+#define jhc_region_write(t,v) ((void)0)
+#endif
+
+#if _JHC_GC != _JHC_GC_NONE
+// only the static allocator has an arena to reset.
+#define jhc_arena_mark()  ((void *)0)
+#define jhc_arena_reset(m) ((void)(m))
+#define _JHC_ARENA_POISON 0
 #endif
 
 #endif
@@ -61,6 +61,20 @@ heap or stack and hence the garbage collector should follow it. The format of
 the memory pointed to by the whnf location is unspecified and dependent on the
 actual type being represented.
 
+On 64 bit platforms nodes are aligned to 8 bytes, which leaves a third spare
+bit, P_TAG (0x4), in a whnf location:
+
+    -------------------------
+    |    whnf location  |T00|
+    -------------------------
+
+      T - set on pointers to the second constructor of a type with exactly two
+          constructors taking arguments, so case expressions can tell them apart
+          without loading the tag from memory.
+
+Anything that uses a whnf location as an address must strip it with FROM_WPTR
+rather than FROM_SPTR. On 32 bit platforms P_TAG is 0 and no tag is set.
+
 Partial (unsaturated) applications are normal WHNF values. Saturated
 applications which may be 'eval'ed and updated are called thunks and must not
 be pointed to by WHNF pointers. Their representation follows.
@@ -106,12 +120,6 @@ redirection to a whnf value.
 
 #include "jhc_rts_header.h"
 
-#if _JHC_GC == _JHC_GC_JGC
-typedef wptr_t (*eval_fn)(gc_t gc, node_t *node) A_STD;
-#else
-typedef wptr_t (*eval_fn)(node_t *node) A_STD;
-#endif
-
 // like eval but you know the target is in WHNF or is a already evaluated indirection
 static inline wptr_t A_STD A_UNUSED  A_HOT
 follow(sptr_t s)
@@ -125,23 +133,53 @@ follow(sptr_t s)
         return (wptr_t)s;
 }
 
+#if _JHC_THREADED
+// another thread claimed the thunk, wait for it to write the value, letting
+// the other threads of this worker run in case it is one of them. A thunk
+// that depends on itself is never written so <<loop>> turns into a hang.
+static wptr_t A_COLD
+wait_for_thunk(gc_t gc, void *ds)
+{
+        fptr_t h;
+        while ((h = LOAD_HEAD(ds)) == BLACK_HOLE) {
+                saved_gc = gc;
+                jhc_yield();
+        }
+        return (wptr_t)h;
+}
+#endif
+
 wptr_t A_STD A_UNUSED  A_HOT
 #if _JHC_GC == _JHC_GC_JGC
-eval(gc_t gc, sptr_t s)
+eval_thunk(gc_t gc, sptr_t s)
 #else
-eval(sptr_t s)
+eval_thunk(sptr_t s)
 #endif
 {
         assert(jhc_valid_lazy(s));
         if (IS_LAZY(s)) {
                 assert(GET_PTYPE(s) == P_LAZY);
                 void *ds = FROM_SPTR(s);
-                sptr_t h = (sptr_t)(GETHEAD(ds));
-                assert((fptr_t)h != BLACK_HOLE);
+                sptr_t h = (sptr_t)(LOAD_HEAD(ds));
+#if _JHC_THREADED
+                if (__predict_false((fptr_t)h == BLACK_HOLE))
+                        return wait_for_thunk(gc, ds);
+#elif JHC_BLACKHOLING
+                if (__predict_false((fptr_t)h == BLACK_HOLE))
+                        jhc_error("<<loop>>");
+#endif
+#if _JHC_ARENA_POISON
+                if (__predict_false((uintptr_t)h == JHC_ARENA_POISON_WORD))
+                        jhc_error("evaluated a value that was freed by jhc_arena_reset");
+#endif
                 if (IS_LAZY(h)) {
                         eval_fn fn = (eval_fn)FROM_SPTR(h);
                         assert(GET_PTYPE(h) == P_FUNC);
-#if _JHC_DEBUG
+#if _JHC_THREADED
+                        if (!__atomic_compare_exchange_n(&GETHEAD(ds), (fptr_t *)&h, BLACK_HOLE,
+                                                         false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+                                return IS_LAZY(h) ? wait_for_thunk(gc, ds) : (wptr_t)h;
+#elif JHC_BLACKHOLING
                         GETHEAD(ds) = BLACK_HOLE;
 #endif
                         fn = (eval_fn)SET_THUMB_BIT(fn);
@@ -150,9 +188,8 @@ eval(sptr_t s)
 #else
                         wptr_t r = (*fn)(NODEP(ds));
 #endif
-#if _JHC_DEBUG
-                        assert(GETHEAD(ds) != BLACK_HOLE);
-#endif
+                        // single entry thunks are not updated and stay black
+                        // holed, so entering one twice is caught above.
                         return r;
                 }
                 return (wptr_t)h;
@@ -30,6 +30,16 @@ typedef struct dnode {
 #define P_VALUE 0x2
 #define P_FUNC  0x3
 
+// Nodes are word aligned, so on 64 bit platforms pointers to evaluated nodes
+// have a third spare bit. For types with exactly two constructors that take
+// arguments the code generator sets it on pointers to the second one, which
+// lets case expressions find the constructor without loading its tag.
+#if UINTPTR_MAX > 0xffffffffu
+#define P_TAG   0x4
+#else
+#define P_TAG   0x0
+#endif
+
 #define IS_LAZY(x)     (bool)(((uintptr_t)(x)) & 0x1)
 #define IS_PTR(x)      (bool)(!(((uintptr_t)(x)) & 0x2))
 
@@ -37,6 +47,8 @@ typedef struct dnode {
 #define GET_PTYPE(x)   ((uintptr_t)(x) & 0x3)               // return the ptype associated with a smart pointer
 #define TO_SPTR(t,x)   (typeof (x))((uintptr_t)(x) | (t))   // attach a ptype to a smart pointer
 #define TO_SPTR_C(t,x) (typeof (x))((uintptr_t)(x) + (t))   // attach a ptype to a smart pointer, suitable for use by constant initialializers
+#define FROM_WPTR(x)   (typeof (x))((uintptr_t)(x) & ~(uintptr_t)(0x3 | P_TAG))  // remove a ptype and pointer tag
+#define HAS_PTAG(x)    (bool)(((uintptr_t)(x)) & P_TAG)
 
 #define GETHEAD(x)   (NODEP(x)->head)
 #define NODEP(x)     ((node_t *)(x))
@@ -65,15 +77,146 @@ typedef struct dnode {
 #define FETCH_MEM_TAG(x)  (DNODEP(x)->what)
 #define SET_MEM_TAG(x,v)  (DNODEP(x)->what = (what_t)RAW_SET_16(v))
 
+// tag of a value whose type has a single constructor with arguments, t.
+#define FETCH_KNOWN_TAG(x,t) (IS_PTR(x) ? (t) : FETCH_RAW_TAG(x))
+// tag of a value whose type has two constructors with arguments, t0 and t1,
+// pointers to t1 carry P_TAG where it is available.
+#if P_TAG
+#define FETCH_PTR_TAG(x,t0,t1) (IS_PTR(x) ? (HAS_PTAG(x) ? (t1) : (t0)) : FETCH_RAW_TAG(x))
+#else
+#define FETCH_PTR_TAG(x,t0,t1) FETCH_TAG(x)
+#endif
+
 #define BLACK_HOLE TO_FPTR(0xDEADBEE0)
 
-wptr_t A_STD
+// Thunks under evaluation have their head overwritten with BLACK_HOLE. This
+// is always done when debugging, _JHC_EAGER_BLACKHOLE turns it on for
+// release builds so the collector can drop the free variables of a thunk
+// as soon as its code has loaded them.
+#ifndef _JHC_EAGER_BLACKHOLE
+#define _JHC_EAGER_BLACKHOLE 0
+#endif
+//
+// With -fthreaded black holing is how a thunk is claimed, the thread whose
+// compare and swap of the head succeeds evaluates it and any other waits
+// for the value. Heads are read with acquire and written with release so
+// the fields of a value are visible before the redirection to it.
+#define JHC_BLACKHOLING (_JHC_DEBUG || _JHC_EAGER_BLACKHOLE || _JHC_THREADED)
+
+#if _JHC_THREADED
+#define LOAD_HEAD(x)    __atomic_load_n(&GETHEAD(x), __ATOMIC_ACQUIRE)
+#define STORE_HEAD(x,v) __atomic_store_n(&GETHEAD(x), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_HEAD(x)    GETHEAD(x)
+#define STORE_HEAD(x,v) (GETHEAD(x) = (v))
+#endif
+
 #if _JHC_GC == _JHC_GC_JGC
-eval(gc_t gc, sptr_t s);
+typedef wptr_t (*eval_fn)(gc_t gc, node_t *node) A_STD;
 #else
-eval(sptr_t s);
+typedef wptr_t (*eval_fn)(node_t *node) A_STD;
 #endif
 
+// run the code of a thunk, the out of line part of eval.
+wptr_t A_STD A_HOT
+#if _JHC_GC == _JHC_GC_JGC
+eval_thunk(gc_t gc, sptr_t s);
+#else
+eval_thunk(sptr_t s);
+#endif
+
+// Most values are already evaluated by the time they are examined, so eval
+// checks for a WHNF or an indirection to one inline and only calls out to
+// eval_thunk when there is actually code to run. eval_known is used when
+// the code generator knows the only thunk the location can hold, which
+// turns the indirect call through the head into a direct one.
+#if _JHC_GC == _JHC_GC_JGC
+static inline wptr_t A_STD A_UNUSED A_HOT
+eval(gc_t gc, sptr_t s)
+#else
+static inline wptr_t A_STD A_UNUSED A_HOT
+eval(sptr_t s)
+#endif
+{
+        if (__predict_true(!IS_LAZY(s)))
+                return (wptr_t)s;
+        fptr_t h = LOAD_HEAD(FROM_SPTR(s));
+        if (!IS_LAZY(h))
+                return (wptr_t)h;
+#if _JHC_GC == _JHC_GC_JGC
+        return eval_thunk(gc, s);
+#else
+        return eval_thunk(s);
+#endif
+}
+
+#if _JHC_GC == _JHC_GC_JGC
+static inline wptr_t A_STD A_UNUSED A_HOT
+eval_known(gc_t gc, sptr_t s, eval_fn fn)
+#else
+static inline wptr_t A_STD A_UNUSED A_HOT
+eval_known(sptr_t s, eval_fn fn)
+#endif
+{
+        if (__predict_true(!IS_LAZY(s)))
+                return (wptr_t)s;
+        fptr_t h = LOAD_HEAD(FROM_SPTR(s));
+        if (!IS_LAZY(h))
+                return (wptr_t)h;
+#if _JHC_DEBUG || _JHC_THREADED
+        // keep the black hole checks of the generic path, with threads the
+        // thunk has to be claimed there.
+        (void)fn;
+#if _JHC_GC == _JHC_GC_JGC
+        return eval_thunk(gc, s);
+#else
+        return eval_thunk(s);
+#endif
+#else
+#if _JHC_EAGER_BLACKHOLE
+        // a thunk that demands its own value finds its head black holed,
+        // eval_thunk reports the loop.
+        if (__predict_false(h == BLACK_HOLE))
+#if _JHC_GC == _JHC_GC_JGC
+                return eval_thunk(gc, s);
+#else
+                return eval_thunk(s);
+#endif
+        assert(FROM_SPTR(h) == FROM_SPTR((fptr_t)fn));
+        GETHEAD(FROM_SPTR(s)) = BLACK_HOLE;
+#else
+        assert(FROM_SPTR(h) == FROM_SPTR((fptr_t)fn));
+#endif
+#if _JHC_GC == _JHC_GC_JGC
+        return fn(gc, NODEP(FROM_SPTR(s)));
+#else
+        return fn(NODEP(FROM_SPTR(s)));
+#endif
+#endif
+}
+
+// the bulk operations on arrays of boxed values, copyArray__ and fillArray__
+// are compiled to calls of these. Offsets and counts are in elements. They
+// store into an existing array, so the region allocator sees the values.
+static inline void A_UNUSED
+jhc_array_copy(unsigned soff, unsigned doff, unsigned n, sptr_t *src, sptr_t *dst)
+{
+#if _JHC_GC == _JHC_GC_REGION
+        for (unsigned i = 0; i < n; i++)
+                jhc_region_write(dst, src[soff + i]);
+#endif
+        memmove(dst + doff, src + soff, n * sizeof(sptr_t));
+}
+
+static inline void A_UNUSED
+jhc_array_fill(unsigned off, unsigned n, sptr_t v, sptr_t *arr)
+{
+        if (n)
+                jhc_region_write(arr, v);
+        for (unsigned i = 0; i < n; i++)
+                arr[off + i] = v;
+}
+
 // both promote and demote evaluate to nothing when debugging is not enabled
 // otherwise, they check that their arguments are in the correct form.
 #if _JHC_DEBUG
@@ -85,7 +228,8 @@ void   A_STD update(void *, wptr_t);
 #define demote(x) DEMOTE(x)
 inline static void update(void *t, wptr_t n)
 {
-        GETHEAD(t) = (fptr_t)n;
+        jhc_region_write(t, n);
+        STORE_HEAD(t, (fptr_t)n);
 }
 #endif
 
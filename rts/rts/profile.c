@@ -6,13 +6,23 @@
 #define HAVE_TIMES 1
 #endif
 
+#if defined(__WIN32__) || defined(__ARM_EABI__)
+#define HAVE_CLOCK_GETTIME 0
+#else
+#define HAVE_CLOCK_GETTIME 1
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #if HAVE_TIMES
 #include <sys/times.h>
-#include <time.h>
 #endif
 #include <unistd.h>
+#if _JHC_THREADED
+#include <pthread.h>
+#endif
 
 #include "jhc_rts_header.h"
 
@@ -23,36 +33,218 @@ profile_print_header(FILE *file, char *value_unit)
         for (int i = 0; i < jhc_argc; i++)
                 fprintf(file, " %s", jhc_argv[i]);
         fprintf(file, "\"\n");
-        fprintf(file, "DATE \"%s\"\n", ctime(NULL));
+        time_t now = time(NULL);
+        char date[32];
+        strftime(date, sizeof(date), "%a %b %e %H:%M %Y", localtime(&now));
+        fprintf(file, "DATE \"%s\"\n", date);
         fprintf(file, "SAMPLE_UNIT \"seconds\"\n");
         fprintf(file, "VALUE_UNIT \"%s\"\n", value_unit ? value_unit : "bytes");
 }
 
-#if HAVE_TIMES
-struct profile_stack {
-        struct tms tm_total;
-        struct tms tm_pushed;
+#if _JHC_PROFILE
+/*
+ * heap profiling, enabled by setting JHC_RTS_HEAP_PROFILE in the environment.
+ * A census is taken after the marking phase of a garbage collection and
+ * written in hp2ps format to <progname>.hp. If the variable is set to a
+ * number, samples are taken at most once every that many milliseconds.
+ */
+
+static FILE *heap_profile;
+static uint64_t heap_profile_start;
+static uint64_t heap_profile_last;
+static uint64_t heap_profile_interval;
+
+static void
+heap_profile_stamp(char *what, uint64_t now)
+{
+        fprintf(heap_profile, "%s %.2f\n", what,
+                (double)(now - heap_profile_start) / 1e9);
+}
+
+void
+jhc_heap_profile_init(void)
+{
+        char *interval = getenv("JHC_RTS_HEAP_PROFILE");
+        if (!interval)
+                return;
+        heap_profile_interval = strtoul(interval, NULL, 10) * 1000000;
+        char *base = strrchr(jhc_progname, '/');
+        base = base ? base + 1 : jhc_progname;
+        char fn[strlen(base) + 4];
+        sprintf(fn, "%s.hp", base);
+        if (!(heap_profile = fopen(fn, "w"))) {
+                perror(fn);
+                return;
+        }
+        profile_print_header(heap_profile, "bytes");
+        heap_profile_start = jhc_clock_ns();
+        heap_profile_stamp("BEGIN_SAMPLE", heap_profile_start);
+        heap_profile_stamp("END_SAMPLE", heap_profile_start);
+}
+
+// returns the file to write a sample to, or NULL if no sample is due.
+FILE *
+jhc_heap_profile_begin(void)
+{
+        if (!heap_profile)
+                return NULL;
+        uint64_t now = jhc_clock_ns();
+        if (heap_profile_last && now - heap_profile_last < heap_profile_interval)
+                return NULL;
+        heap_profile_last = now;
+        heap_profile_stamp("BEGIN_SAMPLE", now);
+        return heap_profile;
+}
+
+void
+jhc_heap_profile_end(void)
+{
+        heap_profile_stamp("END_SAMPLE", heap_profile_last);
+        fflush(heap_profile);
+}
+
+static void
+heap_profile_fini(void)
+{
+        if (!heap_profile)
+                return;
+        uint64_t now = jhc_clock_ns();
+        heap_profile_stamp("BEGIN_SAMPLE", now);
+        heap_profile_stamp("END_SAMPLE", now);
+        fclose(heap_profile);
+        heap_profile = NULL;
+}
+#endif
+
+#if _JHC_ALLOC_PROFILE
+/*
+ * sampling allocation profiler. Rather than counting every allocation, a
+ * countdown of words is kept and whenever it runs out the allocation that
+ * crossed it is charged with the whole sampling interval, once for every
+ * interval it spans. The interval in bytes can be set with
+ * JHC_RTS_ALLOC_SAMPLE and is jittered to avoid aliasing with periodic
+ * allocation patterns. At exit the samples are written
+ * to <progname>.alloc as folded stacks of the form 'site;node bytes', ready to
+ * be fed to flamegraph.pl.
+ */
+
+#define ALLOC_SAMPLE_SLOTS 4096
+
+struct alloc_sample {
+        const char *site;
+        const char *node;
+        unsigned words;
+        unsigned nptrs;
+        unsigned long samples;
 };
 
-struct profile_stack gc_alloc_time;
-struct profile_stack gc_gc_time;
+// the countdown and the jitter are kept per thread so capabilities allocating
+// in parallel do not share them, the table of samples is shared and locked.
+JHC_THREAD_LOCAL long jhc_alloc_sample_countdown = 512 * 1024 / sizeof(uintptr_t);
+static long alloc_sample_interval = 512 * 1024 / sizeof(uintptr_t);
+static JHC_THREAD_LOCAL uint32_t alloc_sample_seed = 2463534242U;
+static unsigned long alloc_samples_dropped;
+static struct alloc_sample alloc_samples[ALLOC_SAMPLE_SLOTS];
+#if _JHC_THREADED
+static pthread_mutex_t alloc_samples_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_SAMPLES() pthread_mutex_lock(&alloc_samples_lock)
+#define UNLOCK_SAMPLES() pthread_mutex_unlock(&alloc_samples_lock)
+#else
+#define LOCK_SAMPLES() do { } while (0)
+#define UNLOCK_SAMPLES() do { } while (0)
+#endif
 
 void
-jhc_profile_push(struct profile_stack *ps)
+jhc_alloc_profile_init(void)
 {
-        times(&ps->tm_pushed);
+        char *interval = getenv("JHC_RTS_ALLOC_SAMPLE");
+        if (interval && strtoul(interval, NULL, 10) >= sizeof(uintptr_t))
+                alloc_sample_interval = strtoul(interval, NULL, 10) / sizeof(uintptr_t);
+        jhc_alloc_sample_countdown = alloc_sample_interval;
 }
 
 void
-jhc_profile_pop(struct profile_stack *ps)
+jhc_alloc_sample(const char *site, const char *node, unsigned words, unsigned nptrs)
 {
-        struct tms tm;
-        times(&tm);
-        ps->tm_total.tms_utime += tm.tms_utime - ps->tm_pushed.tms_utime;
-        ps->tm_total.tms_stime += tm.tms_stime - ps->tm_pushed.tms_stime;
+        alloc_sample_seed ^= alloc_sample_seed << 13;
+        alloc_sample_seed ^= alloc_sample_seed >> 17;
+        alloc_sample_seed ^= alloc_sample_seed << 5;
+        // an allocation larger than the interval crosses it several times, and
+        // whatever it went past the last crossing counts towards the next one.
+        long over = -jhc_alloc_sample_countdown;
+        unsigned long n = 1 + over / alloc_sample_interval;
+        long countdown = alloc_sample_interval / 2 +
+                         alloc_sample_seed % (alloc_sample_interval + 1) -
+                         over % alloc_sample_interval;
+        for (; countdown <= 0; n++)
+                countdown += alloc_sample_interval;
+        jhc_alloc_sample_countdown = countdown;
+        uintptr_t h = ((uintptr_t)site * 31 + (uintptr_t)node) * 31 + words * 7 + nptrs;
+        LOCK_SAMPLES();
+        for (unsigned i = 0; i < ALLOC_SAMPLE_SLOTS; i++) {
+                struct alloc_sample *as = &alloc_samples[(h + i) % ALLOC_SAMPLE_SLOTS];
+                if (!as->samples) {
+                        as->site = site;
+                        as->node = node;
+                        as->words = words;
+                        as->nptrs = nptrs;
+                }
+                if (as->site == site && as->node == node &&
+                    as->words == words && as->nptrs == nptrs) {
+                        as->samples += n;
+                        UNLOCK_SAMPLES();
+                        return;
+                }
+        }
+        alloc_samples_dropped += n;
+        UNLOCK_SAMPLES();
 }
 
-void print_times(struct tms *tm)
+void
+jhc_alloc_profile_fini(void)
+{
+        char *base = strrchr(jhc_progname, '/');
+        base = base ? base + 1 : jhc_progname;
+        char fn[strlen(base) + 7];
+        sprintf(fn, "%s.alloc", base);
+        FILE *f = fopen(fn, "w");
+        if (!f) {
+                perror(fn);
+                return;
+        }
+        unsigned long bytes = alloc_sample_interval * sizeof(uintptr_t);
+        for (unsigned i = 0; i < ALLOC_SAMPLE_SLOTS; i++) {
+                struct alloc_sample *as = &alloc_samples[i];
+                if (!as->samples)
+                        continue;
+                if (as->site)
+                        fprintf(f, "%s;%s", as->site, as->node);
+                else
+                        fprintf(f, "(unknown);(%u/%u)", as->words, as->nptrs);
+                fprintf(f, " %lu\n", as->samples * bytes);
+        }
+        if (alloc_samples_dropped)
+                fprintf(f, "(dropped) %lu\n", alloc_samples_dropped * bytes);
+        fclose(f);
+}
+#endif
+
+// a monotonic clock in nanoseconds, suitable for timing short intervals.
+uint64_t
+jhc_clock_ns(void)
+{
+#if HAVE_CLOCK_GETTIME
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+        return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+#if HAVE_TIMES
+static void
+print_times(struct tms *tm)
 {
 #if  !defined(__WIN32__) && !defined(__ARM_EABI__)
         float cpt = (float)sysconf(_SC_CLK_TCK);
@@ -62,17 +254,257 @@ void print_times(struct tms *tm)
 #endif
         return;
 }
-#else
+#endif
 
-struct profile_stack;
-void jhc_profile_push(struct profile_stack *ps) {}
-void jhc_profile_pop(struct profile_stack *ps) {}
+#if _JHC_PROFILE
+/*
+ * profile regions are timed with the monotonic clock. Regions may nest, in
+ * which case time spent in an inner region is also subtracted from the self
+ * time of the enclosing one. Each region keeps a log2 histogram of its
+ * durations from which percentiles are estimated.
+ */
+
+struct profile_stack gc_alloc_time = PROFILE_STACK_INIT("alloc");
+struct profile_stack gc_gc_time = PROFILE_STACK_INIT("gc");
 
+static struct profile_stack *profile_current;
+static struct profile_stack *profile_regions;
+
+void
+jhc_profile_push(struct profile_stack *ps)
+{
+        if (ps->depth++)
+                return;
+        if (!ps->registered) {
+                ps->registered = true;
+                ps->enclosing = profile_current ? profile_current->name : NULL;
+                ps->next = profile_regions;
+                profile_regions = ps;
+        }
+        ps->parent = profile_current;
+        profile_current = ps;
+        ps->pushed = jhc_clock_ns();
+}
+
+void
+jhc_profile_pop(struct profile_stack *ps)
+{
+        if (--ps->depth)
+                return;
+        uint64_t elapsed = jhc_clock_ns() - ps->pushed;
+        if (!ps->calls++ || elapsed < ps->min_ns)
+                ps->min_ns = elapsed;
+        if (elapsed > ps->max_ns)
+                ps->max_ns = elapsed;
+        ps->total_ns += elapsed;
+        ps->histogram[elapsed ? 63 - __builtin_clzll(elapsed) : 0]++;
+        profile_current = ps->parent;
+        if (profile_current)
+                profile_current->child_ns += elapsed;
+}
+
+// estimate a percentile as the upper bound of the histogram bucket it lands in.
+static uint64_t
+profile_percentile(struct profile_stack *ps, unsigned percent)
+{
+        unsigned long want = (ps->calls * percent + 99) / 100, seen = 0;
+        for (int i = 0; i < PROFILE_BUCKETS; i++) {
+                seen += ps->histogram[i];
+                if (seen >= want) {
+                        uint64_t bound = i >= 63 ? UINT64_MAX : (uint64_t)2 << i;
+                        return bound < ps->max_ns ? bound : ps->max_ns;
+                }
+        }
+        return ps->max_ns;
+}
+
+static void
+print_regions(void)
+{
+        struct profile_stack *ps;
+        fprintf(stderr, "%-16s %-10s %10s %12s %12s %10s %10s %10s %10s %10s\n",
+                "Region", "Inside", "Calls", "Total(us)", "Self(us)",
+                "Min(us)", "P50(us)", "P90(us)", "P99(us)", "Max(us)");
+        for (ps = profile_regions; ps; ps = ps->next)
+                fprintf(stderr, "%-16s %-10s %10lu %12.1f %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                        ps->name, ps->enclosing ? ps->enclosing : "-", ps->calls,
+                        ps->total_ns / 1e3, (ps->total_ns - ps->child_ns) / 1e3,
+                        ps->min_ns / 1e3, profile_percentile(ps, 50) / 1e3,
+                        profile_percentile(ps, 90) / 1e3, profile_percentile(ps, 99) / 1e3,
+                        ps->max_ns / 1e3);
+}
+
+/*
+ * function profiling. The code generator calls jhc_function_enter on entry to
+ * every function and jhc_function_leave before each return or tail call, and
+ * hands us the table of counters at initialization. Cycles are read from the
+ * time stamp counter where there is one and are nanoseconds otherwise.
+ *
+ * A longjmp skips the leaves of the functions it unwinds, so a JumpPoint
+ * notes jhc_function_depth when it is set and calls jhc_function_unwind with
+ * it when it is jumped to.
+ */
+
+struct jhc_function_profile *const *jhc_function_profiles;
+JHC_THREAD_LOCAL struct jhc_function_state jhc_function_state;
+
+void
+jhc_function_grow(void)
+{
+        struct jhc_function_state *st = &jhc_function_state;
+        if (!st->depths) {
+                unsigned n = 0;
+                if (jhc_function_profiles)
+                        while (jhc_function_profiles[n])
+                                n++;
+                if (!(st->depths = calloc(n + 1, sizeof(unsigned))))
+                        abort();
+        }
+        st->size = st->size ? 2 * st->size : 256;
+        if (!(st->frames = realloc(st->frames, st->size * sizeof(struct jhc_function_frame))))
+                abort();
+}
+
+void
+jhc_function_unwind(unsigned sp)
+{
+        while (jhc_function_state.sp > sp)
+                jhc_function_leave();
+}
+
+// a green thread being switched away from takes its functions with it, the
+// time until it runs again is charged to nothing.
+void
+jhc_function_save(struct jhc_function_state *st)
+{
+        struct jhc_function_state *cur = &jhc_function_state;
+        if (cur->sp)
+                PROFILE_ADD(cur->frames[cur->sp - 1].fp->self_cycles, jhc_cycles() - cur->mark);
+        *st = *cur;
+        memset(cur, 0, sizeof(*cur));
+}
+
+void
+jhc_function_restore(struct jhc_function_state *st)
+{
+        jhc_function_state = *st;
+        jhc_function_state.mark = jhc_cycles();
+}
+
+void
+jhc_function_free(void)
+{
+        free(jhc_function_state.frames);
+        free(jhc_function_state.depths);
+        memset(&jhc_function_state, 0, sizeof(jhc_function_state));
+}
+
+#define FUNCTION_PROFILE_TOP 50
+
+static int
+function_profile_cmp(const void *x, const void *y)
+{
+        const struct jhc_function_profile *a = *(struct jhc_function_profile *const *)x;
+        const struct jhc_function_profile *b = *(struct jhc_function_profile *const *)y;
+        return a->self_cycles < b->self_cycles ? 1 : a->self_cycles > b->self_cycles ? -1 : 0;
+}
+
+static void
+print_functions(void)
+{
+        if (!jhc_function_profiles)
+                return;
+        // exiting skips the leaves of the functions still running.
+        jhc_function_unwind(0);
+        unsigned n = 0;
+        uint64_t total = 0;
+        for (struct jhc_function_profile *const *fp = jhc_function_profiles; *fp; fp++)
+                if ((*fp)->entries)
+                        n++;
+        struct jhc_function_profile **fs = malloc(n * sizeof *fs);
+        if (!fs)
+                return;
+        n = 0;
+        for (struct jhc_function_profile *const *fp = jhc_function_profiles; *fp; fp++)
+                if ((*fp)->entries) {
+                        fs[n++] = *fp;
+                        total += (*fp)->self_cycles;
+                }
+        qsort(fs, n, sizeof *fs, function_profile_cmp);
+        fprintf(stderr, "\n%12s %16s %6s %16s  %s\n", "Entries", "Self(cycles)", "%", "Inclusive", "Function");
+        for (unsigned i = 0; i < n && i < FUNCTION_PROFILE_TOP; i++)
+                fprintf(stderr, "%12lu %16llu %6.2f %16llu  %s\n", fs[i]->entries,
+                        (unsigned long long)fs[i]->self_cycles,
+                        total ? 100.0 * fs[i]->self_cycles / total : 0.0,
+                        (unsigned long long)fs[i]->inclusive_cycles, fs[i]->name);
+        if (n > FUNCTION_PROFILE_TOP)
+                fprintf(stderr, "%u more functions not shown\n", n - FUNCTION_PROFILE_TOP);
+        free(fs);
+}
+
+// write s as a quoted JSON string.
+static void
+print_json_string(FILE *f, const char *s)
+{
+        putc('"', f);
+        for (; *s; s++) {
+                unsigned char c = *s;
+                if (c == '"' || c == '\\')
+                        fprintf(f, "\\%c", c);
+                else if (c < 0x20)
+                        fprintf(f, "\\u%04x", c);
+                else
+                        putc(c, f);
+        }
+        putc('"', f);
+}
+
+// machine readable version of the profile, written to the file named by
+// JHC_RTS_PROFILE_JSON or stderr if it is "-".
+static void
+print_regions_json(char *fn)
+{
+        FILE *f = strcmp(fn, "-") ? fopen(fn, "w") : stderr;
+        if (!f) {
+                perror(fn);
+                return;
+        }
+        fprintf(f, "{\"program\": ");
+        print_json_string(f, jhc_progname);
+        fprintf(f, ", \"regions\": [");
+        struct profile_stack *ps;
+        for (ps = profile_regions; ps; ps = ps->next) {
+                fprintf(f, "%s\n  {\"name\": ", ps == profile_regions ? "" : ",");
+                print_json_string(f, ps->name);
+                fprintf(f, ", \"parent\": ");
+                if (ps->enclosing)
+                        print_json_string(f, ps->enclosing);
+                else
+                        fprintf(f, "null");
+                fprintf(f, ", \"calls\": %lu, \"total_ns\": %llu, \"self_ns\": %llu, "
+                        "\"min_ns\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+                        "\"p99_ns\": %llu, \"max_ns\": %llu}",
+                        ps->calls, (unsigned long long)ps->total_ns,
+                        (unsigned long long)(ps->total_ns - ps->child_ns),
+                        (unsigned long long)ps->min_ns,
+                        (unsigned long long)profile_percentile(ps, 50),
+                        (unsigned long long)profile_percentile(ps, 90),
+                        (unsigned long long)profile_percentile(ps, 99),
+                        (unsigned long long)ps->max_ns);
+        }
+        fprintf(f, "\n]}\n");
+        if (f != stderr)
+                fclose(f);
+}
 #endif
 
 void A_COLD
 jhc_print_profile(void)
 {
+#if _JHC_PROFILE
+        heap_profile_fini();
+#endif
+        jhc_alloc_profile_fini();
         if (!(_JHC_PROFILE || getenv("JHC_RTS_PROFILE"))) return;
         fprintf(stderr, "\n-----------------\n");
         fprintf(stderr, "Profiling: %s\n", jhc_progname);
@@ -85,8 +517,11 @@ jhc_print_profile(void)
         print_times(&tm);
 #endif
 #if _JHC_PROFILE
-        print_times(&gc_gc_time.tm_total);
-        print_times(&gc_alloc_time.tm_total);
+        print_regions();
+        print_functions();
+        char *json = getenv("JHC_RTS_PROFILE_JSON");
+        if (json)
+                print_regions_json(json);
 #endif
         fprintf(stderr, "-----------------\n");
 }
@@ -97,7 +532,7 @@ jhc_print_profile(void)
 static unsigned alloced[BUCKETS];
 static unsigned alloced_atomic[BUCKETS];
 
-static void
+void
 alloc_count(int n, int atomic)
 {
         n = n ? ((n - 1) / sizeof(void *)) + 1 : 0;
@@ -105,7 +540,7 @@ alloc_count(int n, int atomic)
         (atomic ? alloced_atomic : alloced)[n]++;
 }
 
-static void
+void
 print_alloc_size_stats(void)
 {
         char fmt[] = "%10s %10s %10s %10s %10s\n";
@@ -144,7 +579,7 @@ char *
 gc_lookup(void *ptr)
 {
         PWord_t pval;
-        JLG(pval, mem_annotate, (Word_t)ptr & ~(Word_t)3);
+        JLG(pval, mem_annotate, (Word_t)FROM_WPTR(ptr));
         return pval ? (char *)*pval : "(none)";
 }
 
@@ -174,12 +609,13 @@ jhc_valid_lazy(sptr_t s)
         assert(GET_PTYPE(s) == P_LAZY);
         node_t *ds = (node_t *)FROM_SPTR(s);
         assert(jhc_malloc_sanity(ds, P_LAZY));
-        if (IS_LAZY(ds->head)) {
-                if (ds->head == BLACK_HOLE) return true;
-                assert(GET_PTYPE(ds->head) == P_FUNC);
+        fptr_t h = LOAD_HEAD(ds);
+        if (IS_LAZY(h)) {
+                if (h == BLACK_HOLE) return true;
+                assert(GET_PTYPE(h) == P_FUNC);
                 return true;
         } else
-                return jhc_valid_whnf((wptr_t)ds->head);
+                return jhc_valid_whnf((wptr_t)h);
 }
 
 #endif
@@ -206,7 +642,8 @@ update(void *thunk, wptr_t new)
 {
         assert(GETHEAD(thunk) == BLACK_HOLE);
         assert(!IS_LAZY(new));
-        GETHEAD(thunk) = (fptr_t)new;
+        jhc_region_write(thunk, new);
+        STORE_HEAD(thunk, (fptr_t)new);
 }
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef RTS_PROFILE_H
 #define RTS_PROFILE_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "rts/cdefs.h"
 
@@ -16,6 +18,10 @@
 #define _JHC_PROFILE 0
 #endif
 
+#ifndef _JHC_ALLOC_PROFILE
+#define _JHC_ALLOC_PROFILE 0
+#endif
+
 #if JHC_VALGRIND
 #include <valgrind/valgrind.h>
 #include <valgrind/memcheck.h>
@@ -32,22 +38,150 @@
 
 void A_UNUSED profile_print_header(FILE *file, char *value_unit);
 void A_COLD jhc_print_profile(void);
+uint64_t jhc_clock_ns(void);
 
 #if _JHC_PROFILE
-struct profile_stack;
+#define PROFILE_BUCKETS 64
+
+// a named, possibly nested, timed region of code.
+struct profile_stack {
+        const char *name;
+        const char *enclosing;         // region active when first entered
+        struct profile_stack *next;    // all regions entered so far
+        struct profile_stack *parent;  // region to return to on pop
+        bool registered;
+        unsigned depth;                // recursion depth, only the outermost entry is timed
+        unsigned long calls;
+        uint64_t pushed;
+        uint64_t total_ns;
+        uint64_t child_ns;             // time spent in nested regions
+        uint64_t min_ns;
+        uint64_t max_ns;
+        unsigned long histogram[PROFILE_BUCKETS];  // durations by floor(log2(ns))
+};
+
+#define PROFILE_STACK_INIT(n) { .name = (n) }
+
 extern struct profile_stack gc_alloc_time;
 extern struct profile_stack gc_gc_time;
 void jhc_profile_push(struct profile_stack *ps);
 void jhc_profile_pop(struct profile_stack *ps);
 #define profile_push(x) jhc_profile_push(x)
 #define profile_pop(x)  jhc_profile_pop(x)
+void alloc_count(int n, int atomic);
+void print_alloc_size_stats(void);
+void jhc_heap_profile_init(void);
+FILE *jhc_heap_profile_begin(void);
+void jhc_heap_profile_end(void);
+
+// per function counters, one per grin function, emitted by the C backend.
+// They are shared by all threads, id indexes the per thread depths.
+struct jhc_function_profile {
+        const char *name;
+        unsigned id;
+        unsigned long entries;
+        uint64_t self_cycles;       // cycles spent in the function itself
+        uint64_t inclusive_cycles;  // including callees, outermost activation only
+};
+
+struct jhc_function_frame {
+        struct jhc_function_profile *fp;
+        uint64_t entered;
+};
+
+// the functions a thread is running, innermost last. Each green thread has
+// its own, the running one's is in jhc_function_state.
+struct jhc_function_state {
+        struct jhc_function_frame *frames;
+        unsigned sp, size;
+        unsigned *depths;           // activations of each function by id
+        uint64_t mark;              // when the running function was charged last
+};
+
+extern struct jhc_function_profile *const *jhc_function_profiles;
+extern JHC_THREAD_LOCAL struct jhc_function_state jhc_function_state;
+
+void jhc_function_grow(void);
+void jhc_function_unwind(unsigned sp);
+void jhc_function_save(struct jhc_function_state *st);
+void jhc_function_restore(struct jhc_function_state *st);
+void jhc_function_free(void);
+#define jhc_function_depth() (jhc_function_state.sp)
+
+#if _JHC_THREADED
+#define PROFILE_ADD(x,n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
 #else
+#define PROFILE_ADD(x,n) ((x) += (n))
+#endif
+
+static inline uint64_t
+jhc_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return jhc_clock_ns();
+#endif
+}
+
+// charge the cycles since the last transition to the running function and
+// make fp the running one.
+static inline void
+jhc_function_enter(struct jhc_function_profile *fp)
+{
+        struct jhc_function_state *st = &jhc_function_state;
+        uint64_t now = jhc_cycles();
+        if (st->sp)
+                PROFILE_ADD(st->frames[st->sp - 1].fp->self_cycles, now - st->mark);
+        if (__predict_false(st->sp == st->size))
+                jhc_function_grow();
+        st->frames[st->sp++] = (struct jhc_function_frame){ fp, now };
+        st->depths[fp->id]++;
+        PROFILE_ADD(fp->entries, 1);
+        st->mark = now;
+}
+
+// called before the function returns, or makes a tail call which then runs
+// as if called by the caller.
+static inline void
+jhc_function_leave(void)
+{
+        struct jhc_function_state *st = &jhc_function_state;
+        uint64_t now = jhc_cycles();
+        struct jhc_function_frame *f = &st->frames[--st->sp];
+        PROFILE_ADD(f->fp->self_cycles, now - st->mark);
+        if (!--st->depths[f->fp->id])
+                PROFILE_ADD(f->fp->inclusive_cycles, now - f->entered);
+        st->mark = now;
+}
+#else
+#define jhc_heap_profile_init()  do { } while(0)
+#define jhc_function_depth()     0u
+#define jhc_function_unwind(sp)  do { (void)(sp); } while(0)
+#define jhc_function_save(st)    do { } while(0)
+#define jhc_function_restore(st) do { } while(0)
+#define jhc_function_free()      do { } while(0)
 #define profile_push(x)          do { } while(0)
 #define profile_pop(x)           do { } while(0)
 #define alloc_count(x,y)         do { } while(0)
 #define print_alloc_size_stats() do { } while(0)
 #endif
 
+#if _JHC_ALLOC_PROFILE
+// counts down the words until the next allocation sample is due.
+extern JHC_THREAD_LOCAL long jhc_alloc_sample_countdown;
+void jhc_alloc_sample(const char *site, const char *node, unsigned words, unsigned nptrs);
+void jhc_alloc_profile_init(void);
+void jhc_alloc_profile_fini(void);
+#define alloc_sample(site,node,words,nptrs) \
+        do { if (__predict_false((jhc_alloc_sample_countdown -= (words)) < 0)) \
+                jhc_alloc_sample(site,node,words,nptrs); } while(0)
+#else
+#define alloc_sample(site,node,words,nptrs) do { } while(0)
+#define jhc_alloc_profile_init()  do { } while(0)
+#define jhc_alloc_profile_fini()  do { } while(0)
+#endif
+
 #if JHC_STATUS > 1
 #define debugf(...) fprintf(stderr,__VA_ARGS__)
 #else
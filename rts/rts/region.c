@@ -1,99 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-#elif _JHC_GC == _JHC_GC_REGION
+#include "rts/gc.h"
+#include "rts/profile.h"
 
-#undef _JHC_GC_CONTEXT
-#define _JHC_GC_CONTEXT 1
+#if _JHC_GC == _JHC_GC_REGION
 
-typedef unsigned jhc_gc_context_t;
+#include "sys/queue.h"
 
-#include <sys/queue.h>
+// Region allocator, selected by -fregion. Allocation bumps a pointer through
+// the pages of the innermost region on the region stack and leaving a region
+// releases all of its pages at once, there is no collector. Region 0 is
+// entered at startup and is never left, so whatever is allocated outside of
+// withRegion lives until the program exits.
+//
+// A region can only be thrown away if nothing older refers to it. Objects are
+// immutable once built except for thunk updates and writes to IORefs and
+// arrays, including the bulk jhc_array_fill and jhc_array_copy, and those go
+// through jhc_region_write, which notes the outermost
+// region that was made to point into a newer one. So when a region is left
+// it is enough to look at where its result lives and at what the barrier
+// recorded: if either refers into the region its pages are handed to the
+// outermost region concerned and freed when that one is left.
 
-static inline void jhc_malloc_init(void)
-{
-        return;
-}
+#ifndef _JHC_REGION_PAGE_SHIFT
+#define _JHC_REGION_PAGE_SHIFT 12
+#endif
 
-// Region chunk size
-#define JHC_MEM_CHUNK_SIZE (1 << 12)
+#define REGION_PAGE_SIZE (1UL << (_JHC_REGION_PAGE_SHIFT))
+#define REGION_STACK_INITIAL 64
+#define REGION_CHUNK_PAGES 64
+#define R_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+// pages are REGION_PAGE_SIZE aligned, a large page covers several of them.
+struct region_page {
+        SLIST_ENTRY(region_page) next;
+        size_t size;            // size of the page including this header
+        unsigned level;         // the region the page belongs to
+        uintptr_t data[];
+};
 
 struct region {
         SLIST_HEAD(, region_page) pages;
-        unsigned offset;
+        size_t offset;          // first free byte of the first page
+        unsigned escape;        // outermost region that refers into this one
 };
 
-struct region_page {
-        SLIST_ENTRY(region_page) next;
-        uintptr_t data[];
+static struct region initial_regions[REGION_STACK_INITIAL] = {
+        [0] = { .offset = REGION_PAGE_SIZE }
 };
+static struct region *region_stack = initial_regions;
+static unsigned region_stack_size = REGION_STACK_INITIAL;
+unsigned jhc_current_region;
+#define current_region jhc_current_region
 
-#define JHC_REGION_STACK_SIZE  1024
-static struct region region_stack[JHC_REGION_STACK_SIZE];
+// fresh pages are carved out of aligned chunks, they are never given back to
+// malloc but are recycled through free_pages.
+static char *chunk_next, *chunk_end;
 
-SLIST_HEAD(, region_page) free_pages;
+// open addressed table from page number to the header of the region page
+// covering it, used to find the region an arbitrary pointer belongs to.
+static struct region_page **page_table;
+static uintptr_t *page_table_keys;
+static size_t page_table_size, page_table_used;
 
-static struct region_page *
-new_region_page(unsigned current_region)
-{
-        if (SLIST_EMPTY(&free_pages)) {
-                unsigned cr = current_region;
-                while (cr < JHC_REGION_STACK_SIZE && !SLIST_EMPTY(&region_stack[cr].pages)) {
-                        struct region_page *next = SLIST_FIRST(&region_stack[cr].pages);
-                        SLIST_FIRST(&region_stack[cr].pages) = NULL;
-                        while (next) {
-                                struct region_page *nnext = SLIST_NEXT(next, next);
-                                SLIST_INSERT_HEAD(&free_pages, next, next);
-                                next = nnext;
-                        }
-                        cr++;
-                }
-                if (cr == current_region) {
-                        return malloc(JHC_MEM_CHUNK_SIZE);
+// pages of regions that have been left, most recently released first so a
+// new region starts out on memory that is still in the cache.
+static SLIST_HEAD(, region_page) free_pages = SLIST_HEAD_INITIALIZER(free_pages);
+
+static uint64_t region_bytes_allocated;  // bytes of pages handed to regions
+static uint64_t region_live_bytes;       // bytes of pages regions hold now
+static uint64_t region_max_live_bytes;
+static uint64_t region_pages_malloced;
+static unsigned region_max_depth;
+
+static void A_NORETURN A_COLD
+region_oom(void)
+{
+        fputs("Out of memory!\n", stderr);
+        abort();
+}
+
+static void
+region_stack_grow(void)
+{
+        unsigned size = region_stack_size * 2;
+        struct region *rs;
+        if (region_stack == initial_regions) {
+                if ((rs = malloc(size * sizeof(struct region))))
+                        memcpy(rs, initial_regions, sizeof(initial_regions));
+        } else
+                rs = realloc(region_stack, size * sizeof(struct region));
+        if (!rs)
+                region_oom();
+        region_stack = rs;
+        region_stack_size = size;
+}
+
+static inline size_t
+page_slot(uintptr_t key)
+{
+        return (key * 0x9E3779B97F4A7C15ULL) & (page_table_size - 1);
+}
+
+static void page_table_insert(uintptr_t key, struct region_page *rp);
+
+static void
+page_table_grow(void)
+{
+        struct region_page **old = page_table;
+        uintptr_t *old_keys = page_table_keys;
+        size_t old_size = page_table_size;
+        page_table_size = old_size ? 2 * old_size : 1024;
+        page_table = calloc(page_table_size, sizeof(*page_table));
+        page_table_keys = calloc(page_table_size, sizeof(*page_table_keys));
+        if (!page_table || !page_table_keys)
+                region_oom();
+        page_table_used = 0;
+        for (size_t i = 0; i < old_size; i++)
+                if (old[i])
+                        page_table_insert(old_keys[i], old[i]);
+        free(old);
+        free(old_keys);
+}
+
+static void
+page_table_insert(uintptr_t key, struct region_page *rp)
+{
+        if (2 * (page_table_used + 1) > page_table_size)
+                page_table_grow();
+        size_t i = page_slot(key);
+        while (page_table[i])
+                i = (i + 1) & (page_table_size - 1);
+        page_table[i] = rp;
+        page_table_keys[i] = key;
+        page_table_used++;
+}
+
+static void
+page_table_delete(uintptr_t key)
+{
+        size_t i = page_slot(key), j;
+        while (page_table_keys[i] != key || !page_table[i])
+                i = (i + 1) & (page_table_size - 1);
+        page_table[i] = NULL;
+        page_table_used--;
+        // shift back the entries of the probe sequence this one interrupted.
+        for (j = (i + 1) & (page_table_size - 1); page_table[j]; j = (j + 1) & (page_table_size - 1)) {
+                size_t k = page_slot(page_table_keys[j]);
+                if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+                        page_table[i] = page_table[j];
+                        page_table_keys[i] = page_table_keys[j];
+                        page_table[j] = NULL;
+                        i = j;
                 }
         }
-        struct region_page *r = SLIST_FIRST(&free_pages);
-        SLIST_REMOVE_HEAD(&free_pages, next);
-        return r;
 }
 
-static struct region *
-new_region(unsigned current_region)
+static void
+register_pages(struct region_page *rp, bool add)
 {
-        struct region *r = &region_stack[current_region];
-        if (SLIST_EMPTY(&r->pages)) {
-                r->offset = JHC_MEM_CHUNK_SIZE;
-                return r;
+        uintptr_t first = (uintptr_t)rp >> _JHC_REGION_PAGE_SHIFT;
+        uintptr_t last = ((uintptr_t)rp + rp->size - 1) >> _JHC_REGION_PAGE_SHIFT;
+        for (uintptr_t k = first; k <= last; k++) {
+                if (add)
+                        page_table_insert(k, rp);
+                else
+                        page_table_delete(k);
+        }
+}
+
+// the region a pointer refers into, 0 for anything that isn't region memory
+// such as static nodes and raw values.
+static unsigned
+region_level(void *p)
+{
+        if (((uintptr_t)p & 0x2) || !page_table_used)
+                return 0;
+        uintptr_t key = (uintptr_t)p >> _JHC_REGION_PAGE_SHIFT;
+        for (size_t i = page_slot(key); page_table[i]; i = (i + 1) & (page_table_size - 1))
+                if (page_table_keys[i] == key)
+                        return page_table[i]->level;
+        return 0;
+}
+
+static void *
+aligned_pages(size_t size)
+{
+        void *p;
+        if (posix_memalign(&p, REGION_PAGE_SIZE, size))
+                region_oom();
+        return p;
+}
+
+static struct region_page *
+new_region_page(size_t size)
+{
+        struct region_page *rp;
+        if (size == REGION_PAGE_SIZE && !SLIST_EMPTY(&free_pages)) {
+                rp = SLIST_FIRST(&free_pages);
+                SLIST_REMOVE_HEAD(&free_pages, next);
+        } else if (size == REGION_PAGE_SIZE) {
+                if (chunk_next == chunk_end) {
+                        chunk_next = aligned_pages(REGION_CHUNK_PAGES * REGION_PAGE_SIZE);
+                        chunk_end = chunk_next + REGION_CHUNK_PAGES * REGION_PAGE_SIZE;
+                }
+                rp = (struct region_page *)chunk_next;
+                chunk_next += REGION_PAGE_SIZE;
+                rp->size = size;
+                register_pages(rp, true);
+                region_pages_malloced++;
         } else {
-                // if the region already has some pages allocated, then
-                // we reuse one of them and return the rest to the free list.
-                struct region_page *next = SLIST_NEXT(SLIST_FIRST(&r->pages), next);
-                if (next) {
-                        SLIST_NEXT(SLIST_FIRST(&r->pages), next) = NULL;
-                        while (next) {
-                                struct region_page *nnext = SLIST_NEXT(next, next);
-                                SLIST_INSERT_HEAD(&free_pages, next, next);
-                                next = nnext;
-                        }
+                rp = aligned_pages(size);
+                rp->size = size;
+                register_pages(rp, true);
+                region_pages_malloced++;
+        }
+        rp->level = current_region;
+        region_bytes_allocated += size;
+        region_live_bytes += size;
+        if (region_live_bytes > region_max_live_bytes)
+                region_max_live_bytes = region_live_bytes;
+        return rp;
+}
+
+// ordinary pages go on the free list, pages made for a single large
+// allocation go back to malloc.
+static void
+release_pages(struct region *r)
+{
+        struct region_page *rp;
+        while ((rp = SLIST_FIRST(&r->pages))) {
+                SLIST_REMOVE_HEAD(&r->pages, next);
+                region_live_bytes -= rp->size;
+                if (rp->size == REGION_PAGE_SIZE)
+                        SLIST_INSERT_HEAD(&free_pages, rp, next);
+                else {
+                        register_pages(rp, false);
+                        free(rp);
                 }
-                r->offset = sizeof(struct region_page);
-                return r;
         }
 }
 
-static inline void *A_MALLOC
-jhc_malloc_region(unsigned current_region, struct region *r, size_t n)
+// move the pages of 'from' to region 'level', keeping the first page of the
+// latter first as that is the one being allocated from.
+static void
+region_promote(struct region *from, unsigned level)
+{
+        struct region *to = &region_stack[level];
+        struct region_page *first = SLIST_FIRST(&from->pages), *last;
+        if (!first)
+                return;
+        for (last = first; ; last = SLIST_NEXT(last, next)) {
+                last->level = level;
+                if (!SLIST_NEXT(last, next))
+                        break;
+        }
+        if (SLIST_EMPTY(&to->pages)) {
+                SLIST_FIRST(&to->pages) = first;
+                to->offset = from->offset;
+                return;
+        }
+        struct region_page *head = SLIST_FIRST(&to->pages);
+        SLIST_NEXT(last, next) = SLIST_NEXT(head, next);
+        SLIST_NEXT(head, next) = first;
+}
+
+void
+jhc_region_escape(void *target, void *value)
+{
+        unsigned lv = region_level(value);
+        if (!lv)
+                return;
+        unsigned lt = region_level(target);
+        if (lv > lt && region_stack[lv].escape > lt)
+                region_stack[lv].escape = lt;
+}
+
+static void * A_COLD
+jhc_malloc_region_slow(struct region *r, size_t n)
 {
-        n = ALIGN(sizeof(void *), n);
         struct region_page *rp;
-        if (n > (JHC_MEM_CHUNK_SIZE - r->offset)) {
-                rp = new_region_page(current_region);
-                SLIST_INSERT_HEAD(&r->pages, rp, next);
-                r->offset = sizeof(struct region_page);
-        } else {
-                rp = SLIST_FIRST(&r->pages);
+        if (n > REGION_PAGE_SIZE - sizeof(struct region_page)) {
+                // large allocations get a page of their own, linked in behind
+                // the current page so it stays available for small ones.
+                rp = new_region_page(sizeof(struct region_page) + n);
+                if (SLIST_EMPTY(&r->pages)) {
+                        SLIST_INSERT_HEAD(&r->pages, rp, next);
+                        r->offset = REGION_PAGE_SIZE;
+                } else
+                        SLIST_INSERT_AFTER(SLIST_FIRST(&r->pages), rp, next);
+                return rp->data;
         }
-        void *ret = (void *)rp + r->offset;
+        rp = new_region_page(REGION_PAGE_SIZE);
+        SLIST_INSERT_HEAD(&r->pages, rp, next);
+        r->offset = sizeof(struct region_page) + n;
+        return rp->data;
+}
+
+static inline void * A_MALLOC
+jhc_malloc_region(struct region *r, size_t n)
+{
+        n = R_ALIGN(n);
+        if (__predict_false(n > REGION_PAGE_SIZE - r->offset))
+                return jhc_malloc_region_slow(r, n);
+        void *ret = (char *)SLIST_FIRST(&r->pages) + r->offset;
         r->offset += n;
         return ret;
 }
 
+void *A_MALLOC
+jhc_malloc(size_t n)
+{
+        alloc_count(n, 0);
+        return jhc_malloc_region(&region_stack[current_region], n);
+}
+
+void *A_MALLOC
+jhc_malloc_atomic(size_t n)
+{
+        alloc_count(n, 1);
+        return jhc_malloc_region(&region_stack[current_region], n);
+}
+
+unsigned
+jhc_region_enter(void)
+{
+        if (++current_region == region_stack_size)
+                region_stack_grow();
+        if (current_region > region_max_depth)
+                region_max_depth = current_region;
+        struct region *r = &region_stack[current_region];
+        SLIST_INIT(&r->pages);
+        r->offset = REGION_PAGE_SIZE;
+        r->escape = current_region;
+        return current_region;
+}
+
+void
+jhc_region_leave(unsigned region, void *result)
+{
+        if (region != current_region || region == 0) {
+                fprintf(stderr, "jhc_region_leave: region %u is not the innermost region (%u)\n",
+                        region, current_region);
+                abort();
+        }
+        struct region *r = &region_stack[current_region--];
+        unsigned to = r->escape;
+        if (to == region && region_level(result) == region)
+                to = region - 1;
+        if (to == region) {
+                release_pages(r);
+                return;
+        }
+        // the pages may refer to any region in between, they must live at
+        // least as long now.
+        for (unsigned i = to + 1; i < region; i++)
+                if (region_stack[i].escape > to)
+                        region_stack[i].escape = to;
+        region_promote(r, to);
+}
+
+void hs_perform_gc(void) {}
+
+void jhc_alloc_init(void) {}
+
+void
+jhc_alloc_fini(void)
+{
+        if (_JHC_PROFILE) {
+                fprintf(stderr, "Memory Allocated: %llu bytes\n", (unsigned long long)region_bytes_allocated);
+                fprintf(stderr, "Region Pages: %llu malloced, max depth %u, max live %llu bytes\n",
+                        (unsigned long long)region_pages_malloced, region_max_depth,
+                        (unsigned long long)region_max_live_bytes);
+                print_alloc_size_stats();
+        }
+}
+
+void
+jhc_gc_get_stats(struct jhc_gc_stats *stats)
+{
+        memset(stats, 0, sizeof(*stats));
+        stats->bytes_allocated = region_bytes_allocated;
+        stats->live_bytes = region_live_bytes;
+        stats->max_live_bytes = region_max_live_bytes;
+        stats->blocks_used = region_pages_malloced;
+}
+
+unsigned
+jhc_gc_get_cache_stats(struct jhc_gc_cache_stats *cs, unsigned n)
+{
+        return 0;
+}
+
 #endif
@@ -6,11 +6,13 @@
 #include "rts/gc.h"
 #include "rts/profile.h"
 #include "rts/rts_support.h"
+#include "rts/threads.h"
 
-jmp_buf jhc_uncaught;
+JHC_THREAD_LOCAL jmp_buf jhc_uncaught;
 int jhc_argc;
 char **jhc_argv;
 char *jhc_progname;
+void (*jhc_exit_flush)(void);
 
 #ifdef __WIN32__
 A_UNUSED char *jhc_options_os =  "mingw32";
@@ -34,6 +36,8 @@ hs_set_argv(int argc, char *argv[])
 void A_NORETURN A_UNUSED A_COLD
 jhc_exit(int n)
 {
+        if (jhc_exit_flush)
+                jhc_exit_flush();
         fflush(stdout);
         jhc_print_profile();
         exit(n);
@@ -42,6 +46,9 @@ jhc_exit(int n)
 void  A_NORETURN A_UNUSED  A_COLD
 jhc_error(char *s)
 {
+        // like error, write out what a failing string already produced first.
+        if (jhc_exit_flush)
+                jhc_exit_flush();
         fflush(stdout);
         fputs(s, stderr);
         fputs("\n", stderr);
@@ -64,8 +71,11 @@ hs_init(int *argc, char **argv[])
 {
         if (!hs_init_count++) {
                 jhc_alloc_init();
+                jhc_threads_init();
                 jhc_hs_init();
                 hs_set_argv(*argc, *argv);
+                jhc_heap_profile_init();
+                jhc_alloc_profile_init();
 #if JHC_isPosix
                 struct utsname jhc_utsname;
                 if (!uname(&jhc_utsname)) {
@@ -4,7 +4,7 @@
 #include <setjmp.h>
 #include "rts/cdefs.h"
 
-extern jmp_buf jhc_uncaught;
+extern JHC_THREAD_LOCAL jmp_buf jhc_uncaught;
 A_UNUSED extern char *jhc_options_os;
 A_UNUSED extern char *jhc_options_arch;
 extern int jhc_argc;
@@ -15,6 +15,10 @@ extern char jhc_c_compile[];
 extern char jhc_command[];
 extern char jhc_version[];
 
+// set by the libraries when they hold output that must be written out before
+// the program exits.
+extern void (*jhc_exit_flush)(void);
+
 void A_NORETURN A_UNUSED A_COLD jhc_exit(int n);
 void A_NORETURN A_UNUSED A_COLD jhc_error(char *s);
 void A_NORETURN A_UNUSED A_COLD jhc_case_fell_off(int n);
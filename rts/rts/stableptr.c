@@ -3,11 +3,25 @@
 
 struct StablePtr_list root_StablePtrs = LIST_HEAD_INITIALIZER();
 
+#if _JHC_THREADED
+#include <pthread.h>
+// the collector only walks the list with every other thread stopped, which
+// can't happen in the middle of these.
+static pthread_mutex_t stableptr_lock = PTHREAD_MUTEX_INITIALIZER;
+#define STABLEPTR_LOCK()   pthread_mutex_lock(&stableptr_lock)
+#define STABLEPTR_UNLOCK() pthread_mutex_unlock(&stableptr_lock)
+#else
+#define STABLEPTR_LOCK()   do { } while (0)
+#define STABLEPTR_UNLOCK() do { } while (0)
+#endif
+
 wptr_t c_newStablePtr(sptr_t c)
 {
         struct StablePtr *sp = malloc(sizeof(struct StablePtr));
         sp->contents = c;
+        STABLEPTR_LOCK();
         LIST_INSERT_HEAD(&root_StablePtrs, sp, link);
+        STABLEPTR_UNLOCK();
         assert(GET_PTYPE(sp) == 0);
         return (wptr_t)TO_SPTR(P_VALUE, (wptr_t)sp);
 }
@@ -15,7 +29,9 @@ wptr_t c_newStablePtr(sptr_t c)
 void c_freeStablePtr(wptr_t wp)
 {
         struct StablePtr *sp = FROM_SPTR((HsPtr)wp);
+        STABLEPTR_LOCK();
         LIST_REMOVE(sp, link);
+        STABLEPTR_UNLOCK();
         free(sp);
 }
 
@@ -0,0 +1,1136 @@
+#include "jhc_rts_header.h"
+#include "rts/threads.h"
+#include "sys/queue.h"
+
+#if JHC_isPosix
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
+#endif
+#if _JHC_THREADED
+#include <pthread.h>
+#endif
+
+// forkIO makes a green thread, which gets a C stack and a gc stack when it
+// first runs and is run by a worker switching to it with swapcontext. Without
+// -fthreaded the main OS thread is the only worker. With -fthreaded there is a
+// worker per processor, each an OS thread with a capability of its own, see
+// gc_jgc.c. A worker runs the threads on its queue in order and when it runs
+// out takes the last thread that has not run yet from the queue of another
+// worker before going to sleep. A thread that has run stays on its worker,
+// the generated code may hold on to the address of a thread local such as
+// saved_gc across a call that blocks.
+//
+// Scheduling is cooperative, a thread runs until it blocks on an MVar, sleeps,
+// yields or returns. forkOS starts an OS thread that runs nothing but its own
+// haskell thread and blocks when that does.
+//
+// An MVar is an IORef guarded by one of a fixed set of locks, picked by the
+// key the MVar was created with, so nothing has to be freed along with it. A
+// thread that has to wait queues up on the lock with the key and whether it
+// waits for the MVar to become full or empty, releasing the lock wakes the
+// first thread waiting for the state the MVar was left in.
+//
+// A green thread waiting for a file descriptor queues up on it and the I/O
+// manager asks the poller, epoll on linux and poll elsewhere, which are ready.
+// A worker with nothing to run blocks in the poller, which a pipe interrupts
+// when the worker gets work, and busy workers check it every IO_POLL_SWITCHES
+// thread switches so waiting threads are not starved.
+
+#define MVAR_LOCKS 64
+#define MAX_WORKERS 64
+#define MAX_FREE_STACKS 64
+#define IO_POLL_SWITCHES 64
+#define IO_POLL_EVENTS 64
+
+// the directions a thread can wait for a file descriptor in
+#define IO_READ  1
+#define IO_WRITE 2
+
+// the gc stack grows up from the bottom of the mapping and the C stack down
+// from the top, so either can use what the other does not. There is no guard
+// page, as 100k threads would run into the limit on the number of mappings,
+// so running out of stack is not caught.
+#ifndef _JHC_THREAD_STACK_SHIFT
+#define _JHC_THREAD_STACK_SHIFT 19
+#endif
+#define THREAD_STACK_SIZE (1UL << (_JHC_THREAD_STACK_SHIFT))
+
+#if _JHC_THREADED
+typedef pthread_mutex_t lock_t;
+#define LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#else
+typedef char lock_t;
+#define LOCK_INITIALIZER 0
+#define LOCK(l) ((void)(l))
+#define UNLOCK(l) ((void)(l))
+#endif
+
+struct worker;
+
+struct hs_thread {
+        TAILQ_ENTRY(hs_thread) link;    // on a run queue or waiting
+        HsWord id;
+        HsPtr action;                   // run when the thread starts
+        struct worker *worker;          // set once it ran
+        bool bound;                     // has an OS thread of its own
+        bool ready;                     // a bound thread was woken
+        HsWord wait_key;
+        bool wait_full;
+        uint64_t wake_ns;               // end of a threadDelay
+        // waiting for a file descriptor, io_waiting is cleared by whoever
+        // wakes the thread, the poller or the end of its timeout.
+        TAILQ_ENTRY(hs_thread) io_link;
+        int io_fd;
+        bool io_write;
+        bool io_waiting;
+        bool io_timeout;                // also on the sleepers
+        bool io_ready;
+        char *stack;
+        jmp_buf uncaught;
+#if _JHC_PROFILE
+        struct jhc_function_state prof;  // while it isn't running
+#endif
+#if JHC_isPosix
+        ucontext_t ctx;
+#endif
+#if _JHC_GC == _JHC_GC_JGC
+        struct gc_stack *gcs;
+        struct gc_stack own_gcs;
+#endif
+#if _JHC_THREADED
+        pthread_cond_t cond;            // a bound thread waits on it
+#endif
+};
+
+TAILQ_HEAD(thread_queue, hs_thread);
+
+struct worker {
+        lock_t lock;                    // guards the run queue
+        struct thread_queue run_queue;
+        unsigned num_queued;
+        unsigned num_fresh;             // queued threads that have not run yet
+        struct hs_thread *current;      // NULL in the idle loop
+        // left for whatever runs next on the worker, someone could pick the
+        // thread that switched away up before its context was saved.
+        lock_t *release;
+        struct hs_thread *requeue;
+        struct hs_thread *exited;
+        unsigned switches;
+#if JHC_isPosix
+        ucontext_t idle;                // the loop looking for a thread to run
+        char *idle_stack;
+#endif
+#if _JHC_THREADED
+        pthread_cond_t cond;
+        bool sleeping;
+#endif
+};
+
+struct mvar_lock {
+        lock_t mutex;
+        struct thread_queue waiting;
+};
+
+static struct mvar_lock mvar_locks[MVAR_LOCKS];
+static HsWord mvar_next;
+
+static struct worker *workers;
+static unsigned num_workers = 1;
+static struct hs_thread main_thread;
+static JHC_THREAD_LOCAL struct worker *this_worker;
+static JHC_THREAD_LOCAL struct hs_thread *bound_thread;
+static HsWord threads_started;
+static unsigned fresh_threads;          // queued threads that have not run yet
+
+// guards the sleepers and whether workers are sleeping
+static lock_t sched_lock = LOCK_INITIALIZER;
+static struct thread_queue sleepers = TAILQ_HEAD_INITIALIZER(sleepers);
+static unsigned num_sleepers;
+#if _JHC_THREADED
+static unsigned workers_sleeping;
+#endif
+
+// file descriptors green threads wait for, guarded by io_lock. Entries are
+// made when first waited for and kept.
+struct io_fd {
+        struct thread_queue waiting[2];  // by direction
+        unsigned events;                 // what the poller is asked for
+};
+
+static lock_t io_lock = LOCK_INITIALIZER;
+static struct io_fd **io_fds;
+static int io_fds_size;
+static unsigned num_io_waiters;
+#if USE_EPOLL
+static int io_poller_fd = -1;
+#endif
+static int io_wakeup[2] = { -1, -1 };
+static bool io_polling;                 // someone is in io_poll
+#if _JHC_THREADED
+static struct worker *io_poller;        // a sleeping worker blocked in io_poll
+#endif
+
+// set once forkIO was used, until then nothing can run while the program
+// waits for I/O so there is no point in asking the poller.
+int jhc_threads_forked;
+
+static lock_t stacks_lock = LOCK_INITIALIZER;
+static char *free_stacks;
+static unsigned num_free_stacks;
+
+// provided by Control.Concurrent, which is the only way to fork.
+void jhc_thread_entry(HsPtr action) __attribute__((weak));
+
+static uint64_t
+now_ns(void)
+{
+#if JHC_isPosix
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+        return 0;
+#endif
+}
+
+static struct hs_thread *
+current_thread(void)
+{
+        if (this_worker)
+                return this_worker->current;
+#if _JHC_THREADED
+        // an OS thread that attached a capability without forkOS
+        if (!bound_thread) {
+                bound_thread = malloc(sizeof(struct hs_thread));
+                memset(bound_thread, 0, sizeof(struct hs_thread));
+                bound_thread->id = __atomic_add_fetch(&threads_started, 1, __ATOMIC_RELAXED);
+                bound_thread->bound = true;
+                pthread_cond_init(&bound_thread->cond, NULL);
+        }
+#endif
+        return bound_thread;
+}
+
+void
+jhc_threads_init(void)
+{
+        for (int i = 0; i < MVAR_LOCKS; i++) {
+#if _JHC_THREADED
+                pthread_mutex_init(&mvar_locks[i].mutex, NULL);
+#endif
+                TAILQ_INIT(&mvar_locks[i].waiting);
+        }
+#if _JHC_THREADED
+#if defined(_JHC_WORKERS) && _JHC_WORKERS > 0
+        long n = _JHC_WORKERS;
+#else
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        num_workers = n < 1 ? 1 : n > MAX_WORKERS ? MAX_WORKERS : n;
+#endif
+        workers = calloc(num_workers, sizeof(struct worker));
+        for (unsigned i = 0; i < num_workers; i++) {
+                struct worker *w = &workers[i];
+                TAILQ_INIT(&w->run_queue);
+#if _JHC_THREADED
+                pthread_mutex_init(&w->lock, NULL);
+                pthread_cond_init(&w->cond, NULL);
+#endif
+        }
+        this_worker = &workers[0];
+        main_thread.worker = &workers[0];
+        workers[0].current = &main_thread;
+#if _JHC_GC == _JHC_GC_JGC
+        main_thread.gcs = jhc_gc_stack_current();
+#endif
+}
+
+static void
+enqueue(struct worker *w, struct hs_thread *t)
+{
+        LOCK(&w->lock);
+        TAILQ_INSERT_TAIL(&w->run_queue, t, link);
+        __atomic_add_fetch(&w->num_queued, 1, __ATOMIC_SEQ_CST);
+        if (!t->worker) {
+                __atomic_add_fetch(&w->num_fresh, 1, __ATOMIC_SEQ_CST);
+                __atomic_add_fetch(&fresh_threads, 1, __ATOMIC_SEQ_CST);
+        }
+        UNLOCK(&w->lock);
+}
+
+// the poller is interrupted by workers with work for it and, when it polls
+// the whole table, by changes to the table.
+#if JHC_isPosix && (_JHC_THREADED || !USE_EPOLL)
+static void
+io_interrupt(void)
+{
+        char c = 0;
+        if (write(io_wakeup[1], &c, 1) < 0 && errno != EAGAIN)
+                jhc_error("I/O manager: could not wake the poller");
+}
+#endif
+
+#if _JHC_THREADED
+// the caller holds sched_lock.
+static void
+wake_sleeping(struct worker *w)
+{
+        if (w == io_poller)
+                io_interrupt();
+        else
+                pthread_cond_signal(&w->cond);
+}
+#endif
+
+// a worker that may be asleep got work, with fresh any sleeping worker will
+// do. Sleeping workers count themselves before they look for work so one of
+// the two sides sees the other.
+static void
+wake_worker(struct worker *w, bool fresh)
+{
+#if _JHC_THREADED
+        if (!__atomic_load_n(&workers_sleeping, __ATOMIC_SEQ_CST))
+                return;
+        pthread_mutex_lock(&sched_lock);
+        for (unsigned i = 0; fresh && !w->sleeping && i < num_workers; i++)
+                if (workers[i].sleeping)
+                        w = &workers[i];
+        if (w->sleeping)
+                wake_sleeping(w);
+        pthread_mutex_unlock(&sched_lock);
+#endif
+}
+
+// wake t, the caller holds the lock t waits with.
+static void
+make_runnable(struct hs_thread *t)
+{
+#if _JHC_THREADED
+        if (t->bound) {
+                t->ready = true;
+                pthread_cond_signal(&t->cond);
+                return;
+        }
+#endif
+        enqueue(t->worker, t);
+        wake_worker(t->worker, false);
+}
+
+#if JHC_isPosix
+// tell the poller what the threads waiting for fd want, the caller holds
+// io_lock. False if fd can't be polled, such as a regular file which is
+// always ready.
+static bool
+io_update(int fd)
+{
+        struct io_fd *f = io_fds[fd];
+        unsigned want = (TAILQ_EMPTY(&f->waiting[0]) ? 0 : IO_READ) |
+                        (TAILQ_EMPTY(&f->waiting[1]) ? 0 : IO_WRITE);
+        if (want == f->events)
+                return true;
+#if USE_EPOLL
+        struct epoll_event ev = { 0 };
+        ev.events = (want & IO_READ ? EPOLLIN : 0) | (want & IO_WRITE ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        int op = !want ? EPOLL_CTL_DEL : f->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        int r = epoll_ctl(io_poller_fd, op, fd, &ev);
+        // the descriptor may have been closed and opened again since.
+        if (r && op == EPOLL_CTL_MOD && errno == ENOENT)
+                r = epoll_ctl(io_poller_fd, EPOLL_CTL_ADD, fd, &ev);
+        else if (r && op == EPOLL_CTL_ADD && errno == EEXIST)
+                r = epoll_ctl(io_poller_fd, EPOLL_CTL_MOD, fd, &ev);
+        if (r && op != EPOLL_CTL_DEL)
+                return false;
+#else
+        // the poll is built from the table, a running one has to start over.
+        if (io_polling)
+                io_interrupt();
+#endif
+        f->events = want;
+        return true;
+}
+
+static void
+io_remove(struct hs_thread *t)
+{
+        TAILQ_REMOVE(&io_fds[t->io_fd]->waiting[t->io_write], t, io_link);
+        t->io_waiting = false;
+        __atomic_sub_fetch(&num_io_waiters, 1, __ATOMIC_RELAXED);
+}
+
+// queue t up on fd, the caller holds io_lock.
+static bool
+io_add(struct hs_thread *t, int fd, bool write)
+{
+        if (fd >= io_fds_size) {
+                int size = io_fds_size ? io_fds_size : 64;
+                while (size <= fd)
+                        size *= 2;
+                struct io_fd **fds = realloc(io_fds, size * sizeof(struct io_fd *));
+                if (!fds)
+                        jhc_error("I/O manager: out of memory");
+                memset(fds + io_fds_size, 0, (size - io_fds_size) * sizeof(struct io_fd *));
+                io_fds = fds;
+                io_fds_size = size;
+        }
+        if (!io_fds[fd]) {
+                io_fds[fd] = malloc(sizeof(struct io_fd));
+                TAILQ_INIT(&io_fds[fd]->waiting[0]);
+                TAILQ_INIT(&io_fds[fd]->waiting[1]);
+                io_fds[fd]->events = 0;
+        }
+        t->io_fd = fd;
+        t->io_write = write;
+        t->io_waiting = true;
+        t->io_ready = false;
+        TAILQ_INSERT_TAIL(&io_fds[fd]->waiting[write], t, io_link);
+        __atomic_add_fetch(&num_io_waiters, 1, __ATOMIC_RELAXED);
+        if (io_update(fd))
+                return true;
+        io_remove(t);
+        return false;
+}
+
+// the pipe interrupting the poller and the poller itself are made when a
+// thread first waits, the caller holds io_lock.
+static void
+io_start(void)
+{
+        if (io_wakeup[0] >= 0)
+                return;
+        if (pipe(io_wakeup))
+                jhc_error("I/O manager: could not create a pipe");
+        for (int i = 0; i < 2; i++) {
+                fcntl(io_wakeup[i], F_SETFL, O_NONBLOCK);
+                fcntl(io_wakeup[i], F_SETFD, FD_CLOEXEC);
+        }
+#if USE_EPOLL
+        if ((io_poller_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+                jhc_error("I/O manager: could not create an epoll instance");
+        struct epoll_event ev = { 0 };
+        ev.events = EPOLLIN;
+        ev.data.fd = io_wakeup[0];
+        epoll_ctl(io_poller_fd, EPOLL_CTL_ADD, io_wakeup[0], &ev);
+#endif
+}
+#endif
+
+static void
+wake_sleepers(bool locked)
+{
+        if (!__atomic_load_n(&num_sleepers, __ATOMIC_RELAXED))
+                return;
+        if (!locked)
+                LOCK(&sched_lock);
+        uint64_t now = now_ns();
+        struct hs_thread *t;
+        while ((t = TAILQ_FIRST(&sleepers)) && t->wake_ns <= now) {
+                TAILQ_REMOVE(&sleepers, t, link);
+                __atomic_sub_fetch(&num_sleepers, 1, __ATOMIC_RELAXED);
+#if JHC_isPosix
+                if (t->io_timeout) {
+                        // the poller may have woken it already, then it
+                        // leaves the thread to be run by the poller.
+                        t->io_timeout = false;
+                        LOCK(&io_lock);
+                        bool timed_out = t->io_waiting;
+                        if (timed_out) {
+                                io_remove(t);
+                                io_update(t->io_fd);
+                                t->io_ready = false;
+                        }
+                        UNLOCK(&io_lock);
+                        if (!timed_out)
+                                continue;
+                }
+#endif
+                enqueue(t->worker, t);
+#if _JHC_THREADED
+                if (t->worker->sleeping)
+                        wake_sleeping(t->worker);
+#endif
+        }
+        if (!locked)
+                UNLOCK(&sched_lock);
+}
+
+static struct hs_thread *
+take_thread(struct worker *w, bool steal)
+{
+        if (!__atomic_load_n(steal ? &w->num_fresh : &w->num_queued, __ATOMIC_SEQ_CST))
+                return NULL;
+        LOCK(&w->lock);
+        struct hs_thread *t;
+        if (steal) {
+                TAILQ_FOREACH_REVERSE(t, &w->run_queue, thread_queue, link)
+                if (!t->worker)
+                        break;
+        } else
+                t = TAILQ_FIRST(&w->run_queue);
+        if (t) {
+                TAILQ_REMOVE(&w->run_queue, t, link);
+                __atomic_sub_fetch(&w->num_queued, 1, __ATOMIC_SEQ_CST);
+                if (!t->worker) {
+                        __atomic_sub_fetch(&w->num_fresh, 1, __ATOMIC_SEQ_CST);
+                        __atomic_sub_fetch(&fresh_threads, 1, __ATOMIC_SEQ_CST);
+                }
+        }
+        UNLOCK(&w->lock);
+        return t;
+}
+
+#if JHC_isPosix
+// move the threads waiting for fd in the directions dirs to ready, the
+// caller holds io_lock.
+static void
+io_wake(int fd, unsigned dirs, struct thread_queue *ready)
+{
+        if (fd < 0 || fd >= io_fds_size || !io_fds[fd])
+                return;
+        struct hs_thread *t;
+        for (int d = 0; d < 2; d++) {
+                if (!(dirs & (1 << d)))
+                        continue;
+                while ((t = TAILQ_FIRST(&io_fds[fd]->waiting[d]))) {
+                        io_remove(t);
+                        t->io_ready = true;
+                        TAILQ_INSERT_TAIL(ready, t, io_link);
+                }
+        }
+        io_update(fd);
+}
+
+// wait up to timeout milliseconds, forever if negative, for the descriptors
+// threads wait for and run the threads of those that are ready. One worker
+// polls at a time, the others return at once.
+static void
+io_poll(int timeout)
+{
+        if (__atomic_exchange_n(&io_polling, true, __ATOMIC_ACQUIRE))
+                return;
+        struct thread_queue ready = TAILQ_HEAD_INITIALIZER(ready);
+        bool interrupted = false;
+#if USE_EPOLL
+        struct epoll_event evs[IO_POLL_EVENTS];
+        int n = epoll_wait(io_poller_fd, evs, IO_POLL_EVENTS, timeout);
+        LOCK(&io_lock);
+        for (int i = 0; i < n; i++) {
+                int fd = evs[i].data.fd;
+                unsigned e = evs[i].events, dirs = 0;
+                if (fd == io_wakeup[0]) {
+                        interrupted = true;
+                        continue;
+                }
+                if (e & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                        dirs |= IO_READ;
+                if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                        dirs |= IO_WRITE;
+                io_wake(fd, dirs, &ready);
+        }
+#else
+        static struct pollfd *pfds;
+        static int pfds_size;
+        LOCK(&io_lock);
+        int n = 1;
+        for (int fd = 0; fd < io_fds_size; fd++)
+                n += io_fds[fd] && io_fds[fd]->events;
+        if (n > pfds_size) {
+                pfds_size = n * 2;
+                if (!(pfds = realloc(pfds, pfds_size * sizeof(struct pollfd))))
+                        jhc_error("I/O manager: out of memory");
+        }
+        pfds[0].fd = io_wakeup[0];
+        pfds[0].events = POLLIN;
+        for (int fd = 0, i = 1; fd < io_fds_size; fd++)
+                if (io_fds[fd] && io_fds[fd]->events) {
+                        pfds[i].fd = fd;
+                        pfds[i++].events = (io_fds[fd]->events & IO_READ ? POLLIN : 0) |
+                                           (io_fds[fd]->events & IO_WRITE ? POLLOUT : 0);
+                }
+        UNLOCK(&io_lock);
+        int r = poll(pfds, n, timeout);
+        LOCK(&io_lock);
+        interrupted = r > 0 && pfds[0].revents;
+        for (int i = 1; r > 0 && i < n; i++) {
+                unsigned e = pfds[i].revents, dirs = 0;
+                if (e & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+                        dirs |= IO_READ;
+                if (e & (POLLOUT | POLLHUP | POLLERR | POLLNVAL))
+                        dirs |= IO_WRITE;
+                if (dirs)
+                        io_wake(pfds[i].fd, dirs, &ready);
+        }
+#endif
+        UNLOCK(&io_lock);
+        if (interrupted) {
+                char buf[64];
+                while (read(io_wakeup[0], buf, sizeof(buf)) > 0);
+        }
+        __atomic_store_n(&io_polling, false, __ATOMIC_RELEASE);
+        if (TAILQ_EMPTY(&ready))
+                return;
+        // a waiting thread holds sched_lock until it is off its stacks, and
+        // threads with a timeout are on the sleepers too.
+        struct hs_thread *t;
+        LOCK(&sched_lock);
+        TAILQ_FOREACH(t, &ready, io_link)
+        if (t->io_timeout) {
+                TAILQ_REMOVE(&sleepers, t, link);
+                __atomic_sub_fetch(&num_sleepers, 1, __ATOMIC_RELAXED);
+                t->io_timeout = false;
+        }
+        UNLOCK(&sched_lock);
+        while ((t = TAILQ_FIRST(&ready))) {
+                TAILQ_REMOVE(&ready, t, io_link);
+                make_runnable(t);
+        }
+}
+
+// milliseconds from now until deadline, rounded up.
+static int
+poll_timeout(uint64_t deadline, uint64_t now)
+{
+        if (deadline <= now)
+                return 0;
+        uint64_t ms = (deadline - now + 999999) / 1000000;
+        return ms > INT_MAX ? INT_MAX : ms;
+}
+#endif
+
+// locked says the caller holds sched_lock.
+static struct hs_thread *
+next_thread(struct worker *w, bool locked)
+{
+        wake_sleepers(locked);
+#if JHC_isPosix
+        if (!locked && __atomic_load_n(&num_io_waiters, __ATOMIC_RELAXED) &&
+            ++w->switches % IO_POLL_SWITCHES == 0)
+                io_poll(0);
+#endif
+        struct hs_thread *t = take_thread(w, false);
+        unsigned self = w - workers;
+        for (unsigned i = 1; !t && i < num_workers; i++) {
+                if (!__atomic_load_n(&fresh_threads, __ATOMIC_SEQ_CST))
+                        break;
+                t = take_thread(&workers[(self + i) % num_workers], true);
+        }
+        return t;
+}
+
+#if _JHC_THREADED
+static bool
+has_work(struct worker *w)
+{
+        return __atomic_load_n(&w->num_queued, __ATOMIC_SEQ_CST) ||
+               __atomic_load_n(&fresh_threads, __ATOMIC_SEQ_CST);
+}
+#endif
+
+#if JHC_isPosix
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static char *
+stack_alloc(void)
+{
+        LOCK(&stacks_lock);
+        char *s = free_stacks;
+        if (s) {
+                free_stacks = *(char **)s;
+                num_free_stacks--;
+        }
+        UNLOCK(&stacks_lock);
+        if (!s) {
+                s = mmap(NULL, THREAD_STACK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (s == MAP_FAILED)
+                        jhc_error("forkIO: out of memory for thread stacks");
+        }
+        return s;
+}
+
+static void
+stack_free(char *s)
+{
+        LOCK(&stacks_lock);
+        if (num_free_stacks < MAX_FREE_STACKS) {
+                *(char **)s = free_stacks;
+                free_stacks = s;
+                num_free_stacks++;
+                s = NULL;
+        }
+        UNLOCK(&stacks_lock);
+        if (s)
+                munmap(s, THREAD_STACK_SIZE);
+}
+
+static void
+finish_switch(void)
+{
+        struct worker *w = this_worker;
+        if (w->release) {
+                UNLOCK(w->release);
+                w->release = NULL;
+        }
+        if (w->requeue) {
+                enqueue(w, w->requeue);
+                w->requeue = NULL;
+        }
+        if (w->exited) {
+                struct hs_thread *t = w->exited;
+                w->exited = NULL;
+#if _JHC_GC == _JHC_GC_JGC
+                jhc_gc_stack_unregister(t->gcs);
+#endif
+                stack_free(t->stack);
+                free(t);
+        }
+}
+
+static void thread_switch(lock_t *release, bool exiting);
+
+static void
+thread_start(void)
+{
+        finish_switch();
+        struct hs_thread *t = this_worker->current;
+        if (jhc_setjmp(&jhc_uncaught))
+                jhc_error("Uncaught Exception");
+        else
+                jhc_thread_entry(t->action);
+        jhc_function_free();
+        thread_switch(NULL, true);
+}
+
+// make w run t, switching to the stacks of t.
+static ucontext_t *
+resume_thread(struct worker *w, struct hs_thread *t)
+{
+        if (!t->worker) {
+                t->worker = w;
+                t->stack = stack_alloc();
+                getcontext(&t->ctx);
+                t->ctx.uc_stack.ss_sp = t->stack;
+                t->ctx.uc_stack.ss_size = THREAD_STACK_SIZE;
+                t->ctx.uc_link = NULL;
+                makecontext(&t->ctx, thread_start, 0);
+#if _JHC_GC == _JHC_GC_JGC
+                t->gcs = &t->own_gcs;
+                jhc_gc_stack_register(t->gcs, (gc_t)t->stack);
+#endif
+        }
+        w->current = t;
+        memcpy(jhc_uncaught, t->uncaught, sizeof(jmp_buf));
+#if _JHC_GC == _JHC_GC_JGC
+        jhc_gc_stack_switch(saved_gc, t->gcs);
+#endif
+        return &t->ctx;
+}
+
+static void worker_loop(void);
+
+static ucontext_t *
+idle_context(struct worker *w)
+{
+        w->current = NULL;
+#if _JHC_GC == _JHC_GC_JGC
+        jhc_gc_stack_switch(saved_gc, NULL);
+#endif
+        // the OS thread of the first worker runs the main thread on its own
+        // stack, so its idle loop gets one made for it.
+        if (w == workers && !w->idle_stack) {
+                w->idle_stack = stack_alloc();
+                getcontext(&w->idle);
+                w->idle.uc_stack.ss_sp = w->idle_stack;
+                w->idle.uc_stack.ss_size = THREAD_STACK_SIZE;
+                w->idle.uc_link = NULL;
+                makecontext(&w->idle, worker_loop, 0);
+        }
+        return &w->idle;
+}
+
+static void
+switch_to(struct worker *w, struct hs_thread *next)
+{
+        struct hs_thread *self = w->current;
+        memcpy(self->uncaught, jhc_uncaught, sizeof(jmp_buf));
+        jhc_function_save(&self->prof);
+        swapcontext(&self->ctx, next ? resume_thread(w, next) : idle_context(w));
+        finish_switch();
+        jhc_function_restore(&self->prof);
+}
+
+// suspend the running green thread, which has been put where it will be
+// woken from unless it is exiting. release is unlocked once it is off its
+// stacks.
+static void
+thread_switch(lock_t *release, bool exiting)
+{
+        struct worker *w = this_worker;
+        struct hs_thread *next = next_thread(w, release == &sched_lock);
+        w->release = release;
+        if (exiting)
+                w->exited = w->current;
+        switch_to(w, next);
+}
+
+static void
+worker_sleep(struct worker *w)
+{
+#if _JHC_THREADED
+        jhc_cap_leave(NULL);
+        pthread_mutex_lock(&sched_lock);
+        w->sleeping = true;
+        __atomic_add_fetch(&workers_sleeping, 1, __ATOMIC_SEQ_CST);
+        struct hs_thread *s;
+        while (!has_work(w)) {
+                uint64_t now = now_ns();
+                s = TAILQ_FIRST(&sleepers);
+                if (s && s->wake_ns <= now)
+                        break;
+                if (__atomic_load_n(&num_io_waiters, __ATOMIC_RELAXED) && !io_poller) {
+                        io_poller = w;
+                        pthread_mutex_unlock(&sched_lock);
+                        io_poll(s ? poll_timeout(s->wake_ns, now) : -1);
+                        pthread_mutex_lock(&sched_lock);
+                        io_poller = NULL;
+                        continue;
+                }
+                if (!s) {
+                        pthread_cond_wait(&w->cond, &sched_lock);
+                        continue;
+                }
+                // the condition waits on the realtime clock, the deadline is
+                // on the monotonic one.
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                uint64_t until = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + (s->wake_ns - now);
+                ts.tv_sec = until / 1000000000;
+                ts.tv_nsec = until % 1000000000;
+                pthread_cond_timedwait(&w->cond, &sched_lock, &ts);
+        }
+        __atomic_sub_fetch(&workers_sleeping, 1, __ATOMIC_SEQ_CST);
+        w->sleeping = false;
+        pthread_mutex_unlock(&sched_lock);
+        jhc_cap_enter();
+#else
+        struct hs_thread *s = TAILQ_FIRST(&sleepers);
+        bool io = num_io_waiters;
+        if (!s && !io)
+                jhc_error("thread blocked indefinitely in an MVar operation");
+        uint64_t now = now_ns();
+        if (io)
+                io_poll(s ? poll_timeout(s->wake_ns, now) : -1);
+        else if (s->wake_ns > now) {
+                struct timespec ts = { (s->wake_ns - now) / 1000000000, (s->wake_ns - now) % 1000000000 };
+                while (nanosleep(&ts, &ts) && errno == EINTR);
+        }
+#endif
+}
+
+static void
+worker_loop(void)
+{
+        struct worker *w = this_worker;
+        for (;;) {
+                finish_switch();
+                struct hs_thread *t = next_thread(w, false);
+                if (t)
+                        swapcontext(&w->idle, resume_thread(w, t));
+                else
+                        worker_sleep(w);
+        }
+}
+
+#if _JHC_THREADED
+static void *
+worker_start(void *arg)
+{
+        this_worker = arg;
+        jhc_cap_attach();
+        jhc_gc_stack_switch(saved_gc, NULL);
+        worker_loop();
+        return NULL;
+}
+
+static void
+start_workers(void)
+{
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        for (unsigned i = 1; i < num_workers; i++) {
+                pthread_t t;
+                if (pthread_create(&t, &attr, worker_start, &workers[i]))
+                        jhc_error("forkIO: could not start a worker");
+        }
+        pthread_attr_destroy(&attr);
+}
+
+static pthread_once_t workers_once = PTHREAD_ONCE_INIT;
+#endif
+
+#else
+
+static void
+thread_switch(lock_t *release, bool exiting)
+{
+        jhc_error("thread blocked indefinitely in an MVar operation");
+}
+
+#endif
+
+HsWord
+jhc_fork_io(HsPtr action)
+{
+#if !JHC_isPosix || _JHC_GC == _JHC_GC_BOEHM
+        jhc_error("forkIO: green threads are not supported by this runtime");
+#else
+#if _JHC_THREADED
+        pthread_once(&workers_once, start_workers);
+#endif
+        struct hs_thread *t = malloc(sizeof(struct hs_thread));
+        memset(t, 0, sizeof(struct hs_thread));
+        HsWord id = t->id = __atomic_add_fetch(&threads_started, 1, __ATOMIC_RELAXED);
+        jhc_threads_forked = 1;
+        t->action = action;
+        struct worker *w = this_worker ? this_worker : &workers[0];
+        enqueue(w, t);
+        wake_worker(w, true);
+        return id;
+#endif
+}
+
+#if _JHC_THREADED
+struct forkos_args {
+        HsPtr action;
+        HsWord id;
+};
+
+static void *
+forkos_start(void *arg)
+{
+        struct forkos_args args = *(struct forkos_args *)arg;
+        free(arg);
+        struct hs_thread self;
+        memset(&self, 0, sizeof(self));
+        self.id = args.id;
+        self.bound = true;
+        pthread_cond_init(&self.cond, NULL);
+        bound_thread = &self;
+        jhc_cap_attach();
+        if (jhc_setjmp(&jhc_uncaught))
+                jhc_error("Uncaught Exception");
+        else
+                jhc_thread_entry(args.action);
+        jhc_function_free();
+        jhc_cap_detach();
+        pthread_cond_destroy(&self.cond);
+        return NULL;
+}
+#endif
+
+HsWord
+jhc_fork_os(HsPtr action)
+{
+#if _JHC_THREADED
+        HsWord id = __atomic_add_fetch(&threads_started, 1, __ATOMIC_RELAXED);
+        struct forkos_args *args = malloc(sizeof(*args));
+        args->action = action;
+        args->id = id;
+        pthread_t t;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&t, &attr, forkos_start, args))
+                jhc_error("forkOS: could not create a thread");
+        pthread_attr_destroy(&attr);
+        return id;
+#else
+        jhc_error("forkOS: the program was not compiled with -fthreaded");
+#endif
+}
+
+HsWord
+jhc_thread_id(void)
+{
+        return current_thread()->id;
+}
+
+void
+jhc_yield(void)
+{
+#if JHC_isPosix
+        struct worker *w = this_worker;
+        struct hs_thread *next;
+        if (w && (next = next_thread(w, false))) {
+                w->requeue = w->current;
+                switch_to(w, next);
+                return;
+        }
+#endif
+#if _JHC_THREADED
+        jhc_cap_yield(saved_gc);
+#endif
+}
+
+#if JHC_isPosix
+// the caller holds sched_lock.
+static void
+add_sleeper(struct hs_thread *self, uint64_t wake_ns)
+{
+        self->wake_ns = wake_ns;
+        struct hs_thread *s;
+        TAILQ_FOREACH_REVERSE(s, &sleepers, thread_queue, link)
+        if (s->wake_ns <= self->wake_ns)
+                break;
+        if (s)
+                TAILQ_INSERT_AFTER(&sleepers, s, self, link);
+        else
+                TAILQ_INSERT_HEAD(&sleepers, self, link);
+        __atomic_add_fetch(&num_sleepers, 1, __ATOMIC_RELAXED);
+#if _JHC_THREADED
+        // sleeping workers wait for the earliest deadline they saw.
+        for (unsigned i = 0; !s && i < num_workers; i++)
+                if (workers[i].sleeping) {
+                        wake_sleeping(&workers[i]);
+                        break;
+                }
+#endif
+}
+#endif
+
+void
+jhc_thread_delay(HsInt usecs)
+{
+        if (usecs <= 0)
+                return;
+#if JHC_isPosix
+        struct hs_thread *self = current_thread();
+        if (!self->bound) {
+                LOCK(&sched_lock);
+                add_sleeper(self, now_ns() + (uint64_t)usecs * 1000);
+                thread_switch(&sched_lock, false);
+                return;
+        }
+#endif
+#if _JHC_THREADED
+        jhc_cap_leave(saved_gc);
+#endif
+#if JHC_isPosix
+        struct timespec ts = { usecs / 1000000, (usecs % 1000000) * 1000 };
+        while (nanosleep(&ts, &ts) && errno == EINTR);
+#endif
+#if _JHC_THREADED
+        jhc_cap_enter();
+#endif
+}
+
+HsBool
+jhc_io_wait(HsInt fd, HsInt write, HsInt msecs)
+{
+#if JHC_isPosix
+        struct pollfd p = { fd, write ? POLLOUT : POLLIN, 0 };
+        int r = poll(&p, 1, 0);
+        if (r > 0)
+                return HS_BOOL_TRUE;
+        if (!msecs)
+                return HS_BOOL_FALSE;
+        struct hs_thread *self = current_thread();
+        if (self->bound) {
+#if _JHC_THREADED
+                jhc_cap_leave(saved_gc);
+#endif
+                do
+                        r = poll(&p, 1, msecs < 0 ? -1 : msecs);
+                while (r < 0 && errno == EINTR);
+#if _JHC_THREADED
+                jhc_cap_enter();
+#endif
+                return r > 0;
+        }
+        LOCK(&sched_lock);
+        LOCK(&io_lock);
+        io_start();
+        if (!io_add(self, fd, write)) {
+                UNLOCK(&io_lock);
+                UNLOCK(&sched_lock);
+                return HS_BOOL_TRUE;
+        }
+        UNLOCK(&io_lock);
+        if (msecs > 0) {
+                self->io_timeout = true;
+                add_sleeper(self, now_ns() + (uint64_t)msecs * 1000000);
+        }
+        thread_switch(&sched_lock, false);
+        return self->io_ready;
+#else
+        return HS_BOOL_TRUE;
+#endif
+}
+
+HsWord
+jhc_mvar_new(void)
+{
+        return __atomic_fetch_add(&mvar_next, 1, __ATOMIC_RELAXED);
+}
+
+void
+jhc_mvar_lock(HsWord key)
+{
+#if _JHC_THREADED
+        struct mvar_lock *l = &mvar_locks[key % MVAR_LOCKS];
+        if (pthread_mutex_trylock(&l->mutex)) {
+                jhc_cap_leave(saved_gc);
+                pthread_mutex_lock(&l->mutex);
+                jhc_cap_enter();
+        }
+#endif
+}
+
+void
+jhc_mvar_wait(HsWord key, HsInt full)
+{
+        struct mvar_lock *l = &mvar_locks[key % MVAR_LOCKS];
+        struct hs_thread *self = current_thread();
+        self->wait_key = key;
+        self->wait_full = full;
+        TAILQ_INSERT_TAIL(&l->waiting, self, link);
+#if _JHC_THREADED
+        if (self->bound) {
+                jhc_cap_leave(saved_gc);
+                while (!self->ready)
+                        pthread_cond_wait(&self->cond, &l->mutex);
+                self->ready = false;
+                jhc_cap_enter();
+                return;
+        }
+#endif
+        thread_switch(&l->mutex, false);
+        jhc_mvar_lock(key);
+}
+
+void
+jhc_mvar_unlock(HsWord key, HsInt full)
+{
+        struct mvar_lock *l = &mvar_locks[key % MVAR_LOCKS];
+        struct hs_thread *t;
+        TAILQ_FOREACH(t, &l->waiting, link)
+        if (t->wait_key == key && t->wait_full == !!full)
+                break;
+        if (t) {
+                TAILQ_REMOVE(&l->waiting, t, link);
+                make_runnable(t);
+        }
+        UNLOCK(&l->mutex);
+}
@@ -0,0 +1,30 @@
+#ifndef JHC_THREADS_H
+#define JHC_THREADS_H
+
+#include "HsFFI.h"
+
+// Threads and MVar locks for Control.Concurrent. Anything that may block
+// switches to another thread or gives up the capability of the calling OS
+// thread first, so these must be imported as safe calls for saved_gc to be
+// set. Only jhc_mvar_new and jhc_mvar_unlock never block.
+
+void jhc_threads_init(void);
+
+HsWord jhc_fork_io(HsPtr action);
+HsWord jhc_fork_os(HsPtr action);
+HsWord jhc_thread_id(void);
+void jhc_yield(void);
+void jhc_thread_delay(HsInt usecs);
+
+// wait up to msecs milliseconds, forever if negative, for fd to become ready
+// for reading or writing. Returns whether it did.
+HsBool jhc_io_wait(HsInt fd, HsInt write, HsInt msecs);
+extern int jhc_threads_forked;
+
+// full says whether the MVar is wanted full or was left full.
+HsWord jhc_mvar_new(void);
+void jhc_mvar_lock(HsWord key);
+void jhc_mvar_wait(HsWord key, HsInt full);
+void jhc_mvar_unlock(HsWord key, HsInt full);
+
+#endif
@@ -0,0 +1,100 @@
+#include "jhc_rts_header.h"
+
+#include "seatest.h"
+
+static uint64_t
+live_bytes(void)
+{
+        struct jhc_gc_stats stats;
+        jhc_gc_get_stats(&stats);
+        return stats.live_bytes;
+}
+
+void
+test_reset(void)
+{
+        uint64_t live = live_bytes();
+        void *mark = jhc_arena_mark();
+        char *p = jhc_malloc(24);
+        assert_true(p >= (char *)mark && p < (char *)mark + 32);
+        jhc_arena_reset(mark);
+        assert_true(live_bytes() == live);
+        assert_true(jhc_malloc(24) == p);
+        jhc_arena_reset(mark);
+}
+
+void
+test_reset_chunks(void)
+{
+        uint64_t live = live_bytes();
+        void *mark = jhc_arena_mark();
+        // enough to span several chunks
+        for (int i = 0; i < 100000; i++)
+                *(int *)jhc_malloc(40) = i;
+        assert_true(live_bytes() > live + 3 * (1 << 20));
+        jhc_arena_reset(mark);
+        assert_true(live_bytes() == live);
+        assert_true(jhc_arena_mark() == mark);
+}
+
+void
+test_nested(void)
+{
+        void *outer = jhc_arena_mark();
+        uintptr_t *keep = jhc_malloc(sizeof(uintptr_t));
+        *keep = 42;
+        void *inner = jhc_arena_mark();
+        for (int i = 0; i < 50000; i++)
+                jhc_malloc_atomic(64);
+        jhc_arena_reset(inner);
+        assert_true(*keep == 42);
+        jhc_arena_reset(outer);
+}
+
+void
+test_poison(void)
+{
+        void *mark = jhc_arena_mark();
+        // volatile as the compiler may assume nothing else writes to fresh memory.
+        volatile uintptr_t *p = jhc_malloc(2 * sizeof(uintptr_t));
+        p[0] = p[1] = 0;
+        jhc_arena_reset(mark);
+        if (_JHC_ARENA_POISON) {
+                assert_true(p[0] == JHC_ARENA_POISON_WORD);
+                assert_true(p[1] == JHC_ARENA_POISON_WORD);
+                assert_true(IS_LAZY(p[0]));
+        }
+}
+
+void
+test_large(void)
+{
+        uint64_t live = live_bytes();
+        // bigger than a whole chunk
+        char *before = jhc_malloc_atomic(3 << 20);
+        memset(before, 1, 3 << 20);
+        assert_true(live_bytes() >= live + (3 << 20));
+        void *mark = jhc_arena_mark();
+        char *small = jhc_malloc(16);
+        char *big = jhc_malloc_atomic(5 << 20);
+        memset(big, 2, 5 << 20);
+        // the large allocation does not disturb bump allocation
+        assert_true((char *)jhc_malloc(16) < small + 64);
+        jhc_arena_reset(mark);
+        assert_true(live_bytes() < live + (4 << 20));
+        assert_true(before[0] == 1 && before[(3 << 20) - 1] == 1);
+}
+
+int
+main(int argc, const char *argv[])
+{
+        hs_init(&argc, (char ***)&argv);
+        test_fixture_start();
+        run_test(test_reset);
+        run_test(test_reset_chunks);
+        run_test(test_nested);
+        run_test(test_poison);
+        run_test(test_large);
+        test_fixture_end();
+        return 0;
+}
@@ -0,0 +1,233 @@
+#include "jhc_rts_header.h"
+#include "seatest.h"
+
+// green threads driven the way Control.Concurrent drives them, built with
+// and without _JHC_THREADED.
+
+#define NTHREADS 8
+#define LIST_LEN 20000
+
+typedef void (*job_fn)(void *arg);
+
+struct job {
+        job_fn fn;
+        void *arg;
+};
+
+void
+jhc_thread_entry(HsPtr action)
+{
+        struct job *j = action;
+        j->fn(j->arg);
+        free(j);
+}
+
+static HsWord
+fork_job(job_fn fn, void *arg)
+{
+        struct job *j = malloc(sizeof(*j));
+        j->fn = fn;
+        j->arg = arg;
+        return jhc_fork_io(j);
+}
+
+// a counter threads bump when they are done, guarded by an MVar lock.
+static HsWord done_key;
+static int done;
+
+static void
+finished(void)
+{
+        jhc_mvar_lock(done_key);
+        done++;
+        jhc_mvar_unlock(done_key, true);
+}
+
+static void
+wait_for(int n)
+{
+        jhc_mvar_lock(done_key);
+        while (done < n)
+                jhc_mvar_wait(done_key, true);
+        done = 0;
+        jhc_mvar_unlock(done_key, false);
+}
+
+#if _JHC_GC == _JHC_GC_JGC
+// build a list on the gc stack of the thread, yielding to the others as it
+// goes so collections find most of them switched out.
+static void
+build_list(void *arg)
+{
+        gc_t gc = saved_gc;
+        gc[0] = RAW_SET_16(0);
+        for (int i = 0; i < LIST_LEN; i++) {
+                sptr_t *cell = gc_alloc(gc + 1, NULL, 2, 1);
+                cell[0] = gc[0];
+                cell[1] = RAW_SET_F(i);
+                gc[0] = (sptr_t)cell;
+                if (i % 1000 == 0) {
+                        saved_gc = gc + 1;
+                        jhc_yield();
+                }
+                if (i % 5000 == 0)
+                        gc_perform_gc(gc + 1);
+        }
+        long sum = 0, len = 0;
+        for (sptr_t p = gc[0]; IS_PTR(p); p = ((sptr_t *)p)[0]) {
+                sum += RAW_GET_F(((sptr_t *)p)[1]);
+                len++;
+        }
+        *(long *)arg = len == LIST_LEN ? sum : -1;
+        finished();
+}
+
+void alloc_test(void)
+{
+        long sums[NTHREADS];
+        for (int i = 0; i < NTHREADS; i++)
+                fork_job(build_list, &sums[i]);
+        wait_for(NTHREADS);
+        for (int i = 0; i < NTHREADS; i++)
+                assert_true(sums[i] == (long)LIST_LEN * (LIST_LEN - 1) / 2);
+}
+#endif
+
+// a one place buffer, as Control.Concurrent.MVar uses them.
+static HsWord slot_key;
+static bool slot_full;
+static long slot;
+
+static void
+consume(void *arg)
+{
+        long sum = 0;
+        for (int i = 0; i < 1000; i++) {
+                jhc_mvar_lock(slot_key);
+                while (!slot_full)
+                        jhc_mvar_wait(slot_key, true);
+                sum += slot;
+                slot_full = false;
+                jhc_mvar_unlock(slot_key, false);
+        }
+        *(long *)arg = sum;
+        finished();
+}
+
+void mvar_test(void)
+{
+        slot_key = jhc_mvar_new();
+        long sum = 0;
+        fork_job(consume, &sum);
+        for (int i = 1; i <= 1000; i++) {
+                jhc_mvar_lock(slot_key);
+                while (slot_full)
+                        jhc_mvar_wait(slot_key, false);
+                slot = i;
+                slot_full = true;
+                jhc_mvar_unlock(slot_key, true);
+        }
+        wait_for(1);
+        assert_true(sum == 500500);
+}
+
+static HsWord order_key;
+static int order[3], num_order;
+
+static void
+sleeper(void *arg)
+{
+        int ms = (intptr_t)arg;
+        jhc_thread_delay(ms * 1000);
+        jhc_mvar_lock(order_key);
+        order[num_order++] = ms;
+        jhc_mvar_unlock(order_key, true);
+        finished();
+}
+
+void delay_test(void)
+{
+        order_key = jhc_mvar_new();
+        fork_job(sleeper, (void *)60);
+        fork_job(sleeper, (void *)20);
+        fork_job(sleeper, (void *)40);
+        wait_for(3);
+        assert_int_equal(20, order[0]);
+        assert_int_equal(40, order[1]);
+        assert_int_equal(60, order[2]);
+}
+
+static void
+count(void *arg)
+{
+        jhc_mvar_lock(done_key);
+        done++;
+        *(HsWord *)arg = jhc_thread_id();
+        jhc_mvar_unlock(done_key, true);
+}
+
+static int io_pipe[2];
+static char io_got;
+
+static void
+pipe_reader(void *arg)
+{
+        *(bool *)arg = jhc_io_wait(io_pipe[0], false, -1);
+        read(io_pipe[0], &io_got, 1);
+        finished();
+}
+
+// a thread waiting for a pipe lets the others run until it is written to.
+void io_test(void)
+{
+        assert_true(pipe(io_pipe) == 0);
+        bool ready = false;
+        fork_job(pipe_reader, &ready);
+        jhc_yield();
+        assert_false(ready);
+        jhc_thread_delay(10000);
+        assert_false(ready);
+        write(io_pipe[1], "x", 1);
+        wait_for(1);
+        assert_true(ready);
+        assert_true(io_got == 'x');
+        // timeouts, and descriptors that are always ready
+        assert_false(jhc_io_wait(io_pipe[0], false, 20));
+        assert_false(jhc_io_wait(io_pipe[0], false, 0));
+        assert_true(jhc_io_wait(io_pipe[1], true, -1));
+        FILE *f = tmpfile();
+        assert_true(jhc_io_wait(fileno(f), false, -1));
+        fclose(f);
+        close(io_pipe[0]);
+        close(io_pipe[1]);
+}
+
+// stacks of threads that returned are used again.
+void many_test(void)
+{
+        enum { N = 20000 };
+        static HsWord ids[N];
+        for (int i = 0; i < N; i++)
+                fork_job(count, &ids[i]);
+        wait_for(N);
+        for (int i = 1; i < N; i++)
+                assert_true(ids[i] != ids[0]);
+        assert_true(jhc_thread_id() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+        hs_init(&argc, &argv);
+        done_key = jhc_mvar_new();
+        test_fixture_start();
+#if _JHC_GC == _JHC_GC_JGC
+        run_test(alloc_test);
+#endif
+        run_test(mvar_test);
+        run_test(delay_test);
+        run_test(many_test);
+        run_test(io_test);
+        test_fixture_end();
+        hs_exit();
+        return 0;
+}
@@ -54,6 +54,26 @@ void foreignptr_test(void)
         arena_sanity(arena);
 }
 
+// byte arrays keep their contents right after the header, whatever their size.
+void bytearray_test(void)
+{
+        gc_t gc = saved_gc;
+        unsigned sizes[] = { 0, 1, 9, 4096, 100000 };
+        for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+                uint8_t **ba = gc_new_bytearray(sizes[i]);
+                gc[0] = ba;
+                assert_ptr_equal(ba + 1, ba[0]);
+                assert_true(!(get_heap_flags(ba) & SLAB_FLAG_FINALIZER));
+                memset(ba[0], 0x5a, sizes[i]);
+                gc_perform_gc(gc + 1);
+                assert_ptr_equal(ba + 1, ba[0]);
+                for (unsigned j = 0; j < sizes[i]; j++)
+                        if (ba[0][j] != 0x5a)
+                                assert_true(false);
+        }
+        arena_sanity(arena);
+}
+
 void basic_test(void)
 {
         arena_sanity(arena);
@@ -67,11 +87,107 @@ void basic_test(void)
         arena_sanity(arena);
 }
 
+void stats_test(void)
+{
+        gc_t gc = saved_gc;
+        struct jhc_gc_stats before, after;
+        jhc_gc_get_stats(&before);
+        heap_t e = gc_alloc(gc, NULL, 3, 3);
+        ((void **)e)[0] = e;
+        ((void **)e)[1] = e;
+        ((void **)e)[2] = e;
+        gc[0] = e;
+        jhc_gc_get_stats(&after);
+        assert_true(after.bytes_allocated >= before.bytes_allocated + 3 * sizeof(void *));
+        gc_perform_gc(gc + 1);
+        jhc_gc_get_stats(&after);
+        assert_true(after.num_gcs == before.num_gcs + 1);
+        assert_true(after.live_bytes >= 3 * sizeof(void *));
+        assert_true(after.max_live_bytes >= after.live_bytes);
+        assert_true(after.megablocks >= 1);
+        uint64_t pauses = 0;
+        for (int i = 0; i < JHC_GC_PAUSE_BUCKETS; i++)
+                pauses += after.pause_histogram[i];
+        assert_true(pauses == after.num_gcs);
+        struct jhc_gc_cache_stats cs[64];
+        unsigned n = jhc_gc_get_cache_stats(cs, 64);
+        assert_true(n > 0);
+        bool found = false;
+        for (unsigned i = 0; i < n && i < 64; i++)
+                if (cs[i].size == 3 * sizeof(void *) && cs[i].num_ptrs == 3)
+                        found = found || cs[i].blocks + cs[i].full_blocks > 0;
+        assert_true(found);
+}
+
+void named_cache_test(void)
+{
+        struct s_cache *named = NULL, *shared = NULL;
+        new_named_cache(&named, arena, 5, 1, "CMain.Node", "fMain.build");
+        assert_true(!!named);
+        find_cache(&shared, arena, 5, 1);
+        assert_true(named != shared);
+        assert_string_equal("CMain.Node", (char *)named->node_name);
+        assert_true(!shared->node_name);
+        arena_sanity(arena);
+}
+
+void ptag_test(void)
+{
+        gc_t gc = saved_gc;
+        heap_t c = gc_alloc(gc, NULL, 1, 0);
+        ((uintptr_t *)c)[0] = 0x1234;
+        wptr_t w = TO_SPTR(P_TAG, (wptr_t)c);
+        assert_true(FETCH_PTR_TAG(w, 7, 9) == (P_TAG ? 9 : FETCH_TAG(w)));
+        assert_true(FETCH_PTR_TAG(RAW_SET_16(3), 7, 9) == 3);
+        assert_true(FETCH_KNOWN_TAG(w, 7) == 7);
+        assert_ptr_equal(c, FROM_WPTR(w));
+        heap_t e = gc_alloc(gc, NULL, 1, 1);
+        ((wptr_t *)e)[0] = w;
+        gc[0] = e;
+        gc_perform_gc(gc + 1);
+        // the tagged pointer must have kept c alive
+        for (int i = 0; i < 1000; i++)
+                ((uintptr_t *)gc_alloc(gc + 1, NULL, 1, 0))[0] = 0;
+        assert_true(((uintptr_t *)c)[0] == 0x1234);
+        arena_sanity(arena);
+}
+
+static int thunk_runs;
+
+static wptr_t A_STD
+test_thunk(gc_t gc, node_t *n)
+{
+        thunk_runs++;
+        GETHEAD(n) = (fptr_t)RAW_SET_16(42);
+        return RAW_SET_16(42);
+}
+
+void eval_test(void)
+{
+        gc_t gc = saved_gc;
+        node_t *n = gc_alloc(gc, NULL, 2, 0);
+        n->head = TO_FPTR(&test_thunk);
+        sptr_t s = MKLAZY(n);
+        assert_true(eval(gc, s) == RAW_SET_16(42));
+        assert_int_equal(1, thunk_runs);
+        // now an indirection, the thunk must not run again
+        assert_true(eval_known(gc, s, (eval_fn)&test_thunk) == RAW_SET_16(42));
+        assert_true(eval(gc, (sptr_t)RAW_SET_16(7)) == RAW_SET_16(7));
+        n->head = TO_FPTR(&test_thunk);
+        assert_true(eval_known(gc, s, (eval_fn)&test_thunk) == RAW_SET_16(42));
+        assert_int_equal(2, thunk_runs);
+}
+
 int main(int argc, char *argv[])
 {
         hs_init(&argc, &argv);
         test_fixture_start();
         run_test(basic_test);
+        run_test(stats_test);
+        run_test(named_cache_test);
+        run_test(ptag_test);
+        run_test(eval_test);
+        run_test(bytearray_test);
         run_test(foreignptr_test);
         test_fixture_end();
         hs_exit();
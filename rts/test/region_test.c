@@ -0,0 +1,199 @@
+#include "jhc_rts_header.h"
+
+#include "seatest.h"
+
+#define PAGE (1UL << 12)
+
+static uint64_t
+live_bytes(void)
+{
+        struct jhc_gc_stats stats;
+        jhc_gc_get_stats(&stats);
+        return stats.live_bytes;
+}
+
+static uint64_t
+pages_malloced(void)
+{
+        struct jhc_gc_stats stats;
+        jhc_gc_get_stats(&stats);
+        return stats.blocks_used;
+}
+
+void
+test_release(void)
+{
+        uint64_t live = live_bytes();
+        unsigned r = jhc_region_enter();
+        char *p = jhc_malloc(24);
+        char *q = jhc_malloc_atomic(8);
+        assert_true(q == p + 24);
+        assert_true(live_bytes() == live + PAGE);
+        jhc_region_leave(r, RAW_SET_F(42));
+        assert_true(live_bytes() == live);
+}
+
+void
+test_reuse(void)
+{
+        unsigned r = jhc_region_enter();
+        void *p = jhc_malloc(16);
+        jhc_region_leave(r, NULL);
+        uint64_t malloced = pages_malloced();
+        r = jhc_region_enter();
+        assert_true(jhc_malloc(16) == p);
+        jhc_region_leave(r, NULL);
+        assert_true(pages_malloced() == malloced);
+}
+
+void
+test_escape(void)
+{
+        uint64_t live = live_bytes();
+        unsigned r0 = jhc_region_enter();
+        unsigned r1 = jhc_region_enter();
+        assert_true(r1 == r0 + 1);
+        sptr_t *p = jhc_malloc(2 * sizeof(sptr_t));
+        jhc_region_leave(r1, TO_SPTR(P_TAG, (wptr_t)p));
+        // the inner region's page now belongs to r0.
+        assert_true(live_bytes() == live + PAGE);
+        p[1] = RAW_SET_F(1);
+        jhc_region_leave(r0, NULL);
+        assert_true(live_bytes() == live);
+}
+
+void
+test_large(void)
+{
+        uint64_t live = live_bytes();
+        unsigned r0 = jhc_region_enter();
+        unsigned r1 = jhc_region_enter();
+        char *small = jhc_malloc(8);
+        char *big = jhc_malloc(3 * PAGE);
+        memset(big, 0xaa, 3 * PAGE);
+        // the large allocation must not disturb the current page.
+        assert_true(jhc_malloc(8) == small + 8);
+        assert_true(live_bytes() > live + 4 * PAGE);
+        jhc_region_leave(r1, (wptr_t)(big + PAGE));
+        assert_true(live_bytes() > live + 4 * PAGE);
+        jhc_region_leave(r0, NULL);
+        assert_true(live_bytes() == live);
+}
+
+void
+test_update(void)
+{
+        uint64_t live = live_bytes();
+        unsigned r0 = jhc_region_enter();
+        node_t *outer = jhc_malloc(2 * sizeof(sptr_t));
+        outer->head = BLACK_HOLE;
+        unsigned r1 = jhc_region_enter();
+        unsigned r2 = jhc_region_enter();
+        // an outer thunk is updated with a value built two regions in.
+        wptr_t v = jhc_malloc(2 * sizeof(sptr_t));
+        update(outer, v);
+        jhc_region_leave(r2, NULL);
+        // r2's page now belongs to r0, r1 keeps nothing of its own.
+        uint64_t kept = live_bytes();
+        assert_true(kept == live + 2 * PAGE);
+        jhc_region_leave(r1, NULL);
+        assert_true(live_bytes() == kept);
+        jhc_region_leave(r0, NULL);
+        assert_true(live_bytes() == live);
+}
+
+void
+test_static(void)
+{
+        static node_t caf;
+        uint64_t live = live_bytes();
+        unsigned r = jhc_region_enter();
+        sptr_t *p = jhc_malloc(2 * sizeof(sptr_t));
+        jhc_region_write(&caf, TO_SPTR(P_LAZY, (sptr_t)p));
+        // a raw value or a pointer stored within the region escapes nothing.
+        unsigned r1 = jhc_region_enter();
+        sptr_t *q = jhc_malloc(2 * sizeof(sptr_t));
+        jhc_region_write(q, RAW_SET_F(7));
+        jhc_region_write(q, (wptr_t)p);
+        jhc_region_leave(r1, NULL);
+        assert_true(live_bytes() == live + PAGE);
+        jhc_region_leave(r, NULL);
+        // the region is kept for good by region 0.
+        assert_true(live_bytes() == live + PAGE);
+}
+
+void
+test_array(void)
+{
+        uint64_t live = live_bytes();
+        unsigned r0 = jhc_region_enter();
+        sptr_t *arr = jhc_malloc(8 * sizeof(sptr_t));
+        jhc_array_fill(0, 8, RAW_SET_F(0), arr);
+        unsigned r1 = jhc_region_enter();
+        sptr_t v = TO_SPTR(P_LAZY, (sptr_t)jhc_malloc(2 * sizeof(sptr_t)));
+        jhc_array_fill(0, 4, v, arr);
+        jhc_region_leave(r1, NULL);
+        // filling the older array kept the page it points to.
+        assert_true(live_bytes() == live + 2 * PAGE);
+        unsigned r2 = jhc_region_enter();
+        sptr_t *src = jhc_malloc(4 * sizeof(sptr_t));
+        src[0] = src[1] = RAW_SET_F(1);
+        src[2] = (sptr_t)jhc_malloc(sizeof(sptr_t));
+        src[3] = RAW_SET_F(2);
+        jhc_array_copy(0, 4, 4, src, arr);
+        jhc_region_leave(r2, NULL);
+        assert_true(live_bytes() == live + 3 * PAGE);
+        jhc_region_leave(r0, NULL);
+        assert_true(live_bytes() == live);
+}
+
+void
+test_many_large(void)
+{
+        uint64_t live = live_bytes();
+        for (int n = 0; n < 4; n++) {
+                unsigned r = jhc_region_enter();
+                char *big[64];
+                for (int i = 0; i < 64; i++)
+                        big[i] = jhc_malloc((i % 5 + 2) * PAGE);
+                unsigned r1 = jhc_region_enter();
+                sptr_t *p = jhc_malloc(sizeof(sptr_t));
+                jhc_region_write(big[n * 7] + PAGE + 8, (wptr_t)p);
+                jhc_region_leave(r1, NULL);
+                assert_true(live_bytes() > live + 64 * 2 * PAGE);
+                jhc_region_leave(r, NULL);
+                assert_true(live_bytes() == live);
+        }
+}
+
+void
+test_deep(void)
+{
+        uint64_t live = live_bytes();
+        unsigned rs[300];
+        for (int i = 0; i < 300; i++) {
+                rs[i] = jhc_region_enter();
+                *(int *)jhc_malloc(sizeof(int)) = i;
+        }
+        for (int i = 299; i >= 0; i--)
+                jhc_region_leave(rs[i], NULL);
+        assert_true(live_bytes() == live);
+}
+
+int
+main(int argc, const char *argv[])
+{
+        hs_init(&argc, (char ***)&argv);
+        test_fixture_start();
+        run_test(test_release);
+        run_test(test_reuse);
+        run_test(test_escape);
+        run_test(test_large);
+        run_test(test_update);
+        run_test(test_static);
+        run_test(test_array);
+        run_test(test_many_large);
+        run_test(test_deep);
+        test_fixture_end();
+        return 0;
+}
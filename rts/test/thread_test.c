@@ -0,0 +1,153 @@
+#include <pthread.h>
+
+#include "jhc_rts_header.h"
+#include "seatest.h"
+
+#define NTHREADS 4
+#define LIST_LEN 20000
+
+// build a list of LIST_LEN cells on the heap of the calling thread, the
+// other threads allocating at the same time force collections from all
+// of them.
+static void *
+build_list(void *arg)
+{
+        jhc_cap_attach();
+        gc_t gc = saved_gc;
+        gc[0] = RAW_SET_16(0);
+        for (int i = 0; i < LIST_LEN; i++) {
+                sptr_t *cell = gc_alloc(gc + 1, NULL, 2, 1);
+                cell[0] = gc[0];
+                cell[1] = RAW_SET_F(i);
+                gc[0] = (sptr_t)cell;
+                if (i % 5000 == 0)
+                        gc_perform_gc(gc + 1);
+        }
+        long sum = 0, len = 0;
+        for (sptr_t p = gc[0]; IS_PTR(p); p = ((sptr_t *)p)[0]) {
+                sum += RAW_GET_F(((sptr_t *)p)[1]);
+                len++;
+        }
+        jhc_cap_detach();
+        *(long *)arg = len == LIST_LEN ? sum : -1;
+        return NULL;
+}
+
+void alloc_test(void)
+{
+        pthread_t t[NTHREADS];
+        long sums[NTHREADS];
+        for (int i = 0; i < NTHREADS; i++)
+                pthread_create(&t[i], NULL, build_list, &sums[i]);
+        // the main thread must not hold up collections while it waits.
+        jhc_cap_leave(saved_gc);
+        for (int i = 0; i < NTHREADS; i++)
+                pthread_join(t[i], NULL);
+        jhc_cap_enter();
+        for (int i = 0; i < NTHREADS; i++)
+                assert_true(sums[i] == (long)LIST_LEN * (LIST_LEN - 1) / 2);
+        // capabilities of finished threads are reused
+        pthread_create(&t[0], NULL, build_list, &sums[0]);
+        jhc_cap_leave(saved_gc);
+        pthread_join(t[0], NULL);
+        jhc_cap_enter();
+        assert_true(sums[0] == (long)LIST_LEN * (LIST_LEN - 1) / 2);
+}
+
+static int thunk_runs;
+
+static wptr_t A_STD
+slow_thunk(gc_t gc, node_t *n)
+{
+        __atomic_fetch_add(&thunk_runs, 1, __ATOMIC_RELAXED);
+        usleep(20000);
+        update(n, RAW_SET_16(42));
+        return RAW_SET_16(42);
+}
+
+static sptr_t shared_thunk;
+
+static void *
+force_thunk(void *arg)
+{
+        jhc_cap_attach();
+        *(wptr_t *)arg = eval(saved_gc, shared_thunk);
+        jhc_cap_detach();
+        return NULL;
+}
+
+void blackhole_test(void)
+{
+        gc_t gc = saved_gc;
+        node_t *n = gc_alloc(gc, NULL, 2, 0);
+        n->head = TO_FPTR(&slow_thunk);
+        shared_thunk = MKLAZY(n);
+        gc[0] = shared_thunk;
+        pthread_t t[NTHREADS];
+        wptr_t r[NTHREADS];
+        for (int i = 0; i < NTHREADS; i++)
+                pthread_create(&t[i], NULL, force_thunk, &r[i]);
+        jhc_cap_leave(gc + 1);
+        for (int i = 0; i < NTHREADS; i++)
+                pthread_join(t[i], NULL);
+        jhc_cap_enter();
+        assert_int_equal(1, thunk_runs);
+        for (int i = 0; i < NTHREADS; i++)
+                assert_true(r[i] == RAW_SET_16(42));
+}
+
+// a one place buffer guarded by an MVar lock, as Control.Concurrent.MVar
+// uses them.
+static HsWord slot_key;
+static bool slot_full;
+static long slot;
+
+static void *
+consume(void *arg)
+{
+        jhc_cap_attach();
+        long sum = 0;
+        for (int i = 0; i < 1000; i++) {
+                jhc_mvar_lock(slot_key);
+                while (!slot_full)
+                        jhc_mvar_wait(slot_key, !slot_full);
+                sum += slot;
+                slot_full = false;
+                jhc_mvar_unlock(slot_key, slot_full);
+        }
+        jhc_cap_detach();
+        *(long *)arg = sum;
+        return NULL;
+}
+
+void mvar_test(void)
+{
+        slot_key = jhc_mvar_new();
+        pthread_t t;
+        long sum = 0;
+        pthread_create(&t, NULL, consume, &sum);
+        for (int i = 1; i <= 1000; i++) {
+                jhc_mvar_lock(slot_key);
+                while (slot_full)
+                        jhc_mvar_wait(slot_key, !slot_full);
+                slot = i;
+                slot_full = true;
+                jhc_mvar_unlock(slot_key, slot_full);
+        }
+        jhc_cap_leave(saved_gc);
+        pthread_join(t, NULL);
+        jhc_cap_enter();
+        assert_true(sum == 500500);
+}
+
+int main(int argc, char *argv[])
+{
+        hs_init(&argc, &argv);
+        test_fixture_start();
+        run_test(alloc_test);
+        run_test(blackhole_test);
+        run_test(mvar_test);
+        test_fixture_end();
+        hs_exit();
+        return 0;
+}
@@ -48,7 +48,7 @@ data Written = Written {
     wRequires :: Requires,
     wStructures :: Map.Map Name Structure,
     wTags :: Set.Set Atom,
-    wAllocs :: Set.Set (Atom,Int),
+    wAllocs :: Set.Set (Atom,Maybe Atom,Int),  -- node, allocation site when profiling, pointers
     wEnums :: Map.Map Name Int,
     wFunctions :: Map.Map Name Function
     }
@@ -68,6 +68,10 @@ data Env = Env {
     rEMap :: Map.Map Atom (Name,[Expression]),
     rCPR  :: Map.Map Atom TyRep,
     rConst :: Set.Set Atom,
+    rAllocSite :: Maybe Atom,  -- function being compiled, when allocations are attributed to it
+    rSingleEntry :: Set.Set Var,  -- thunks in the current function that are evaluated at most once
+    rNoUpdate :: Bool,            -- the node being stored is a single entry thunk
+    rProfiled :: Bool,            -- returns must leave the function's profile
     rGrin :: Grin
     }
 
@@ -84,6 +88,10 @@ runC grin (C m) =  (execUniq1 (runRWST m startEnv emptyHcHash),ityrep) where
     startEnv = Env {
         rCPR = ityrep,
         rGrin = grin,
+        rAllocSite = Nothing,
+        rSingleEntry = Set.empty,
+        rNoUpdate = False,
+        rProfiled = False,
         rStowed = Set.empty,
         rDeclare = False,
         rTodo = TodoExp [],
@@ -144,19 +152,30 @@ compileGrin grin = (LBS.fromChunks code, req)  where
         text "",
         nh_stuff,
         text "",
+        fprofs,
         body
         ]
-    jgcs | fopts FO.Jgc = [ text "static struct s_cache *" <> tshow (nodeCacheName m) <> char ';' | (m,_) <- Set.toList wAllocs]
+    jgcs | fopts FO.Jgc = [ text "static struct s_cache *" <> tshow (allocCacheName m s) <> char ';' | (m,s,_) <- Set.toList wAllocs]
          | otherwise = empty
     fromRequires (Requires s) = map (unpackPS . snd) (Set.toList s)
     nh_stuff  = text "const void * const nh_stuff[] = {" $$ fsep (punctuate (char ',') (cafnames ++ constnames ++ [text "NULL"]))  $$ text "};"
     includes  = map include (filter ((".h" ==) . takeExtension)  $ fromRequires req)
 --    cincludes = map include (filter ((".c" ==) . takeExtension) $ fromRequires req)
     include fn = text "#include <" <> text fn <> text ">"
-    (header,body) = generateC (function (name "jhc_hs_init") voidType [] [Public] icaches:Map.elems fm) (Map.elems sm)
+    (header,body) = generateC (function (name "jhc_hs_init") voidType [] [Public] (icaches `mappend` ifprofs):Map.elems fm) (Map.elems sm)
     icaches :: Statement
-    icaches | fopts FO.Jgc = mconcat [  toStatement $ functionCall (name "find_cache") [reference (toExpression $ nodeCacheName t),toExpression $ name "arena", tbsize (sizeof (structType $ nodeStructName t)), toExpression nptrs] | (t,nptrs) <- Set.toList wAllocs ]
+    icaches | fopts FO.Jgc = mconcat (map icache $ Set.toList wAllocs)
             | otherwise = mempty
+    -- per function entry counts and cycles, dumped by jhc_print_profile.
+    fprofs | fopts FO.Profile = vcat $ [ text "static struct jhc_function_profile" <+> tshow (funcProfileName a) <+> text "= { .name =" <+> text (show $ demangleFunc a) <> text ", .id =" <+> tshow i <+> text "};" | (a,_) <- grinFuncs grin | i <- [0 :: Int ..] ] ++
+                [text "static struct jhc_function_profile *const jhc_function_table[] = {" $$ fsep (punctuate (char ',') ([ char '&' <> tshow (funcProfileName a) | (a,_) <- grinFuncs grin ] ++ [text "NULL"])) $$ text "};", text ""]
+           | otherwise = empty
+    ifprofs | fopts FO.Profile = variable (name "jhc_function_profiles") =* variable (name "jhc_function_table")
+            | otherwise = mempty
+    icache (t,site,nptrs) = toStatement $ case site of
+        Nothing -> functionCall (name "find_cache") cargs
+        Just s -> functionCall (name "new_named_cache") (cargs ++ [string (fromAtom t), string (fromAtom s)])
+      where cargs = [reference (toExpression $ allocCacheName t site),toExpression $ name "arena", tbsize (sizeof (structType $ nodeStructName t)), toExpression nptrs]
     cafnames = [ text "&_" <> tshow (varName v) | (v,_) <- grinCafs grin ]
     constnames =  map (\n -> text "&_c" <> tshow n) [ 1 .. length $ Grin.HashConst.toList finalHcHash]
     ((cafs',finalHcHash,Written { wRequires = req, wFunctions = fm, wEnums = wenum, wStructures = sm, wTags = ts, .. }),cpr) = runC grin $ go >> mapM convertCAF (grinCafs grin)
@@ -178,7 +197,7 @@ compileGrin grin = (LBS.fromChunks code, req)  where
         mapM_ tellTags (Set.toList $ tset `mappend` tset')
     cafs = text "/* CAFS */" $$ (vcat $ cafs')
     convertCAF (v,val@(NodeC a [])) = do
-        en <- declareEvalFunc True a
+        en <- declareEvalFunc EvalCAF a
         let ef =  drawG $ f_TO_FPTR (reference $ variable en)
         let ts =  text "/* " <> text (show v) <> text " = " <> (text $ P.render (pprint val)) <> text "*/\n" <>
                 text "static node_t _" <> tshow (varName v) <> text " = { .head = " <> ef <> text " };\n" <>
@@ -188,7 +207,12 @@ compileGrin grin = (LBS.fromChunks code, req)  where
 
 convertFunc :: Maybe FfiExport -> (Atom,Lam) -> C [Function]
 convertFunc ffie (n,as :-> body) = do
-        s <- localTodo TodoReturn (convertBody body)
+        -- when profiling, every function gets its own caches so heap censuses
+        -- and allocation samples can be attributed to the allocating function.
+        let site e = if fopts FO.Profile || fopts FO.AllocProfile then e { rAllocSite = Just n } else e
+            once e = e { rSingleEntry = singleEntryThunks body }
+            prof e = e { rProfiled = fopts FO.Profile }
+        s <- local (once . site . prof) $ localTodo TodoReturn (convertBody body)
         let bt = getType body
             mmalloc [TyINode] = [a_MALLOC]
             mmalloc [TyNode] = [a_MALLOC]
@@ -215,7 +239,15 @@ convertFunc ffie (n,as :-> body) = do
                                       zipWith cast (map snd as')
                                                    (map variable newVars))]
 
-        return (function fnname fr (mgct as') ats s : mstub)
+        -- when profiling the cycles spent inside are charged to the function,
+        -- every return leaves it first so tail calls stay tail calls. A void
+        -- function can also end by falling off its end.
+        let fun | not (fopts FO.Profile) = [function fnname fr (mgct as') ats s]
+                | otherwise = [function fnname fr (mgct as') ats (enter & s & end)] where
+                enter = functionCall (name "jhc_function_enter") [reference (variable $ funcProfileName n)]
+                end | null bt = toStatement f_function_leave
+                    | otherwise = mempty
+        return (fun ++ mstub)
 
 fetchVar :: Var -> Ty -> C Expression
 fetchVar (V 0) _ = return $ noAssign (err "fetchVar v0")
@@ -369,9 +401,9 @@ convertBody (Case v@(getType -> TyNode) [[p1@(NodeC t fps)] :-> e1,[p2] :-> e2])
             --tellTags t2
             --return $ annotate (show p2) (f_assert ((constant $ enum (nodeTagName t2)) `eq` tag) & e)
             return $ annotate (show p2) e
-        tag = if null fps then f_FETCH_RAW_TAG scrut else f_FETCH_TAG scrut
-        ifscrut = if null fps then f_SET_RAW_TAG tenum `eq` scrut else tenum `eq` tag where
-            tenum = (constant $ enum (nodeTagName t))
+        tenum = constant $ enum (nodeTagName t)
+    tag <- fetchTag t scrut
+    let ifscrut = if null fps then f_SET_RAW_TAG tenum `eq` scrut else tenum `eq` tag
     p1' <- da p1 e1
     p2' <- am p2 =<< da p2 e2
     return $ cif ifscrut p1' p2'
@@ -388,8 +420,10 @@ convertBody (Case v@(getType -> t) [[p1] :-> e1, [p2] :-> e2]) | Set.null ((free
     return $ cif (cp p1 `eq` scrut) e1' (am e2')
 convertBody (Case v@(getType -> TyNode) ls) = do
     scrut <- convertVal v
-    let tag = f_FETCH_TAG scrut
-        da ([(Var v _)] :-> e) | v == v0 = do
+    tag <- case [ t | [NodeC t _] :-> _ <- ls ] of
+        (t:_) -> fetchTag t scrut
+        [] -> return $ f_FETCH_TAG scrut
+    let da ([(Var v _)] :-> e) | v == v0 = do
             e' <- convertBody e
             return $ (Nothing,e')
         da ([v@(Var {})] :-> e) = do
@@ -405,8 +439,8 @@ convertBody (Case v@(getType -> TyNode) ls) = do
             declareStruct t
             as' <- iDeclare $ mapM convertVal as
             e' <- convertBody e
-            let tmp = concrete t scrut
-                ass = mconcat [if needed a then a' =* (project' (arg i) tmp) else mempty | a' <- as' | a <- as | i <- [(1 :: Int) ..] ]
+            tmp <- concreteW t scrut
+            let ass = mconcat [if needed a then a' =* (project' (arg i) tmp) else mempty | a' <- as' | a <- as | i <- [(1 :: Int) ..] ]
                 fve = freeVars e
                 needed ~(Var v _) = v `Set.member` fve
             return $ (Just (enum (nodeTagName t)), ass & e')
@@ -445,7 +479,8 @@ convertBody (Error s t) = do
         TodoDecl {} -> return jerr
         TodoReturn -> do
             v <- g t
-            return (jerr & creturn v)
+            r <- profReturn v
+            return (jerr & r)
 
 convertBody (BaseOp (StoreNode b) [n@NodeC {}]) = newNode region_heap (bool b wptr_t sptr_t) n >>= \(x,y) -> simpleRet y >>= \v -> return (x & v)
 convertBody (BaseOp (StoreNode b) [n@NodeC {},region]) = newNode region (bool b wptr_t sptr_t) n >>= \(x,y) -> simpleRet y >>= \v -> return (x & v)
@@ -457,7 +492,8 @@ convertBody (e :>>= [(Var vn _)] :-> e') | vn == v0 = do
 
 convertBody (e :>>= [(Var vn' vt')] :-> e') | not (isCompound e) = do
     (vn,vt) <- fetchVar' vn' vt'
-    ss <- localTodo (TodoDecl vn vt) (convertBody e)
+    once <- asks rSingleEntry
+    ss <- local (\r -> r { rNoUpdate = vn' `Set.member` once }) $ localTodo (TodoDecl vn vt) (convertBody e)
     ss' <- convertBody e'
     return (ss & ss')
 
@@ -482,11 +518,11 @@ convertBody (BaseOp PokeVal [Index base off,z])  = do
     base <- convertVal base
     off <- convertVal off
     z' <- convertVal z
-    return $ indexArray base off =* z'
+    return $ regionWrite base z z' & indexArray base off =* z'
 convertBody (BaseOp PokeVal [base,z])  = do
     base <- convertVal base
     z' <- convertVal z
-    return $ indexArray base (constant $ number 0) =* z'
+    return $ regionWrite base z z' & indexArray base (constant $ number 0) =* z'
 convertBody (BaseOp PeekVal [Index base off]) | getType base == TyPtr tyINode = do
     base <- convertVal base
     off <- convertVal off
@@ -525,7 +561,7 @@ convertBody e = do
 simpleRet er = do
     x <- asks rTodo
     case x of
-        TodoReturn -> return (creturn er)
+        TodoReturn -> profReturn er
         _ | isEmptyExpression er -> return mempty
         TodoNothing -> return (toStatement er)
         TodoExp [v] -> return (v =* er)
@@ -533,6 +569,11 @@ simpleRet er = do
         TodoExp [] -> return $ toStatement er
         _ -> error "simpleRet: odd rTodo"
 
+-- return from the function being compiled, leaving its profile first.
+profReturn er = do
+    p <- asks rProfiled
+    return $ if p then f_function_leave & creturn er else creturn er
+
 nodeAssign :: Val -> Atom -> [Val] -> Exp -> C Statement
 nodeAssign v t as e' = do
     cpr <- asks rCPR
@@ -548,7 +589,8 @@ nodeAssign v t as e' = do
         _ -> do
             declareStruct t
             as' <- iDeclare $ mapM convertVal as
-            let ass = concat [perhapsM (a `Set.member` fve) $ a' =* (project' (arg i) (concrete t v')) | a' <- as' | Var a _ <- as |  i <- [( 1 :: Int) ..] ]
+            tmp <- concreteW t v'
+            let ass = concat [perhapsM (a `Set.member` fve) $ a' =* (project' (arg i) tmp) | a' <- as' | Var a _ <- as |  i <- [( 1 :: Int) ..] ]
                 fve = freeVars e'
             ss' <- convertBody e'
             return $ mconcat ass & ss'
@@ -590,6 +632,14 @@ convertExp (Prim p vs ty) =  do
 convertExp (BaseOp Eval [v]) = do
     v' <- convertVal v
     return (mempty,f_eval v')
+convertExp (BaseOp (EvalKnown t) [v]) = do
+    v' <- convertVal v
+    once <- asks rSingleEntry
+    let kind = case v of
+            Var vv _ | vv `Set.member` once -> EvalOnce
+            _ -> EvalShared
+    en <- declareEvalFunc kind t
+    return (mempty,functionCall (name "eval_known") (mgc [v', cast (basicType "eval_fn") (reference $ variable en)]))
 convertExp (BaseOp GcTouch _) = do
     return (mempty, emptyExpression)
 convertExp (App a vs _) = do
@@ -604,13 +654,13 @@ convertExp (BaseOp Overwrite [v@(Var vv _),tn@(NodeC t as)]) | getType v == TyIN
     v' <- convertVal v
     as' <- mapM convertVal as
     nt <- nodeTypePtr t
-    let tmp' = cast nt (f_FROM_SPTR v')
+    let tmp' = cast nt (f_FROM_WPTR v')
     if not (tagIsSuspFunction t) && vv < v0 then do
         (nns, nn) <- newNode region_heap fptr_t tn
-        return (nns & getHead (f_NODEP(f_FROM_SPTR v')) =* nn,emptyExpression)
+        return (nns & regionWrite v' v nn & getHead (f_NODEP(f_FROM_SPTR v')) =* nn,emptyExpression)
      else do
         s <- tagAssign tmp' t
-        let ass = [project' (arg i) tmp' =* a | a <- as' | i <- [(1 :: Int) ..] ]
+        let ass = [regionWrite tmp' a a' & project' (arg i) tmp' =* a' | a <- as | a' <- as' | i <- [(1 :: Int) ..] ]
         return (mconcat $ s:ass,emptyExpression)
 
 convertExp Alloc { expValue = v, expCount = c, expRegion = r }
@@ -657,7 +707,10 @@ buildConstants cpr grin fh = P.vcat (map cc (Grin.HashConst.toList fh)) where
             --Just [a'] | a' == a -> []
             Just _ -> []
             _ -> [text ".what =" <+> text "(what_t)SET_RAW_TAG(" <> tshow (nodeTagName a) <> text ")"]
-        def = text "#define c" <> tshow i <+> text "(TO_SPTR_C(P_WHNF, (sptr_t)&_c" <> tshow i <> text "))"
+        def = text "#define c" <> tshow i <+> text "(TO_SPTR_C(" <> ptype <> text ", (sptr_t)&_c" <> tshow i <> text "))"
+        ptype = case ptrTag grin cpr a of
+            PtrTagBit _ b | b == a -> text "P_WHNF | P_TAG"
+            _ -> text "P_WHNF"
         rs = [ f z i |  (z,i) <- zip zs [ 1 :: Int .. ]]
         f (Right i) a = text ".a" <> tshow a <+> text "=" <+> text ('c':show i)
         f (Left (Var n _)) a = text ".a" <> tshow a <+> text "=" <+> tshow (varName n)
@@ -683,7 +736,7 @@ convertConst v = return (f v) where
             return $ expressionRaw ("prim_maxbound(" ++ tyToC Op.HintUnsigned arg ++ ")")
         PrimTypeInfo { primArgTy = arg, primTypeInfo = PrimUMaxBound } ->
             return $ expressionRaw ("prim_umaxbound(" ++ tyToC Op.HintUnsigned arg ++ ")")
-        PrimString s -> return $ cast (basicType "uintptr_t") (expressionRaw (show s))
+        PrimString s -> return $ cast (basicType "uintptr_t") (string (unpackPS s))
         x -> return $ err (show x)
     f (ValPrim p [x] (TyPrim opty)) = do
         x' <- f x
@@ -776,7 +829,8 @@ primUnOp n ta r a
 
 tagAssign :: Expression -> Atom -> C Statement
 tagAssign e t | tagIsSuspFunction t = do
-    en <- declareEvalFunc False t
+    noUpdate <- asks rNoUpdate
+    en <- declareEvalFunc (if noUpdate then EvalOnce else EvalShared) t
     return $ getHead e =* f_TO_FPTR (reference (variable en))
 tagAssign e t = do
     cpr <- asks rCPR
@@ -814,7 +868,8 @@ newNode region ty ~(NodeC t as) = do
       Nothing -> do
         st <- nodeType t
         as' <- mapM convertVal as
-        let wmalloc | fopts FO.Jgc = \_ -> functionCall (name "s_alloc") [toExpression $ name "gc", (toExpression $ nodeCacheName t)]
+        site <- asks rAllocSite
+        let wmalloc | fopts FO.Jgc = \_ -> functionCall (name "s_alloc") [toExpression $ name "gc", (toExpression $ allocCacheName t site)]
                     | otherwise = jhc_malloc (reference (toExpression $ nodeCacheName t)) nptrs'
             nptrs = length (filter (not . nonPtr . getType) as) + if sf then 1 else 0
             nptrs' = if nptrs > 0 && not sf && t `Map.notMember` cpr then nptrs + 1 else nptrs
@@ -828,12 +883,15 @@ newNode region ty ~(NodeC t as) = do
                 v <- newVar st
                 return (mempty,reference v)
             False -> do
-                tell mempty { wAllocs = Set.singleton (t,nptrs') }
+                tell mempty { wAllocs = Set.singleton (t,site,nptrs') }
                 ty `newTmpVar` malloc
         let tmp' = concrete t tmp
             ass = [ if isValUnknown aa then mempty else project' i tmp' =* a | a <- as' | aa <- as | i <- map arg [(1 :: Int) ..] ]
         tagassign <- tagAssign tmp' t
-        let res = if sf then (f_MKLAZY tmp) else tmp
+        pt <- ptrTagging t
+        let res | sf = f_MKLAZY tmp
+                | PtrTagBit _ b <- pt, b == t = f_SET_PTAG tmp
+                | otherwise = tmp
         return (mconcat $ dtmp:tagassign:ass,res)
 
 ------------------
@@ -885,21 +943,32 @@ instance Op.ToCmmTy Ty where
     toCmmTy (TyPrim p) = Just p
     toCmmTy _ = Nothing
 
-declareEvalFunc isCAF n = do
+-- | how the code entered through the head of a thunk finishes.
+data EvalKind
+    = EvalCAF     -- update the node and make the result a gc root
+    | EvalShared  -- update the node with the result
+    | EvalOnce    -- the thunk is entered at most once, nothing needs updating
+
+declareEvalFunc kind n = do
     fn <- tagToFunction n
     grin <- asks rGrin
     declareStruct n
     nt <- nodeType n
     let ts = runIdentity $ findArgs (grinTypeEnv grin) n
-        fname = toName $ "E_" ++ show fn
+        fname = toName $ (case kind of EvalOnce -> "E1_"; _ -> "E_") ++ show fn
         aname = name "arg"
         rvar = localVariable wptr_t (name "r")
         atype = ptrType nt
-        body = rvar =* functionCall (toName (show $ fn)) (mgc [ project' (arg i) (variable aname) | _ <- ts | i <- [(1 :: Int) .. ] ])
+        call = functionCall (toName (show $ fn)) (mgc [ project' (arg i) (variable aname) | _ <- ts | i <- [(1 :: Int) .. ] ])
+        body = rvar =* call
         update =  f_update (variable aname) rvar
         addroot =  if isCAF && fopts FO.Jgc then f_gc_add_root (cast sptr_t rvar) else emptyExpression
-        body' = if not isCAF && fopts FO.Jgc then subBlock (gc_roots [f_MKLAZY(variable aname)] & rest) else rest
+        body' = case kind of
+            EvalOnce -> creturn call
+            EvalShared | fopts FO.Jgc -> subBlock (gc_roots [f_MKLAZY(variable aname)] & rest)
+            _ -> rest
         rest = body & update & addroot & creturn rvar
+        isCAF = case kind of EvalCAF -> True; _ -> False
     tellFunctions [function fname wptr_t (mgct [(aname,atype)]) [a_STD, a_FALIGNED] body']
     return fname
 
@@ -944,6 +1013,8 @@ jhc_malloc_ptrs sz = functionCall (name "jhc_malloc") [sizeof sptr_t *# sz]
 
 f_assert e    = functionCall (name "assert") [e]
 f_FROM_SPTR e = functionCall (name "FROM_SPTR") [e]
+f_FROM_WPTR e = functionCall (name "FROM_WPTR") [e]
+f_SET_PTAG e  = functionCall (name "TO_SPTR") [expressionRaw "P_TAG", e]
 f_NODEP e     = functionCall (name "NODEP") [e]
 f_RAW_SET_F e  = functionCall (name "RAW_SET_F") [e]
 f_RAW_SET_UF e = functionCall (name "RAW_SET_UF") [e]
@@ -963,6 +1034,12 @@ f_SET_MEM_TAG e v = functionCall (name "SET_MEM_TAG") [e,v]
 f_demote e    = functionCall (name "demote") [e]
 --f_follow e    = functionCall (name "follow") [e]
 f_update x y  = functionCall (name "update") [x,y]
+f_function_leave = functionCall (name "jhc_function_leave") []
+
+-- with -fregion stores of pointers into nodes that already exist go through
+-- the write barrier, so a region older objects refer to is not freed.
+regionWrite t v v' | fopts FO.Region, getType v == TyINode = functionCall (name "jhc_region_write") [t,v']
+                   | otherwise = emptyExpression
 
 arg i = name $ 'a':show i
 
@@ -974,6 +1051,15 @@ nodeTagName a = toName (fromAtom a)
 nodeFuncName :: Atom -> Name
 nodeFuncName a = toName (fromAtom a)
 
+funcProfileName :: Atom -> Name
+funcProfileName a = toName ("prof@" ++ fromAtom a)
+
+-- | the haskell level name of a grin function, without its kind prefix.
+demangleFunc :: Atom -> String
+demangleFunc a = case fromAtom a of
+    (c:rest) | c `elem` "fbFB" -> rest
+    s -> s
+
 sptr_t  = basicGCType "sptr_t"
 uintptr_t = basicGCType "uintptr_t"
 fptr_t  = basicGCType "fptr_t"
@@ -989,6 +1075,51 @@ a_MALLOC = Attribute "A_MALLOC"
 concrete :: Atom -> Expression -> Expression
 concrete t e = cast (ptrType $ structType (nodeStructName t)) e
 
+-- | like concrete, but for pointers to evaluated nodes which may carry P_TAG.
+concreteW :: Atom -> Expression -> C Expression
+concreteW t e = do
+    pt <- ptrTagging t
+    return $ case pt of
+        PtrTagBit _ b | b == t -> concrete t (f_FROM_WPTR e)
+        _ -> concrete t e
+
+-- | what a pointer to an evaluated node tells us about its constructor
+-- without looking at the node, see P_TAG in rts/jhc_rts.h.
+data PtrTag
+    = PtrTagNone          -- the tag has to be loaded from memory
+    | PtrTagKnown Atom    -- the only constructor with arguments
+    | PtrTagBit Atom Atom -- the two constructors with arguments, pointers to the second carry P_TAG
+
+ptrTag :: Grin -> Map.Map Atom TyRep -> Atom -> PtrTag
+ptrTag _ _ t | tagIsSuspFunction t = PtrTagNone
+ptrTag grin cpr t = case findTyTy (grinTypeEnv grin) t of
+    Just TyTy { tySiblings = Just sibs } -> case filter boxed sibs of
+        [a] -> PtrTagKnown a
+        [a,b] -> PtrTagBit a b
+        _ -> PtrTagNone
+    _ -> PtrTagNone
+  where boxed a = case mlookup a cpr of
+            Just TyRepRawTag -> False
+            Just TyRepRawVal {} -> False
+            _ -> True
+
+ptrTagging :: Atom -> C PtrTag
+ptrTagging t = do
+    grin <- asks rGrin
+    cpr <- asks rCPR
+    return $ ptrTag grin cpr t
+
+-- | the tag of a value with the same type as constructor t.
+fetchTag :: Atom -> Expression -> C Expression
+fetchTag t e = do
+    pt <- ptrTagging t
+    tellTags t
+    let tenum a = constant $ enum (nodeTagName a)
+    return $ case pt of
+        PtrTagNone -> f_FETCH_TAG e
+        PtrTagKnown a -> functionCall (name "FETCH_KNOWN_TAG") [e, tenum a]
+        PtrTagBit a b -> functionCall (name "FETCH_PTR_TAG") [e, tenum a, tenum b]
+
 getHead :: Expression -> Expression
 getHead e = project' (name "head") e
 
@@ -997,6 +1128,8 @@ nodeType a = return $ structType (nodeStructName a)
 nodeStructName :: Atom -> Name
 nodeStructName a = toName ('s':fromAtom a)
 nodeCacheName a = toName ('c':fromAtom a)
+allocCacheName a Nothing = nodeCacheName a
+allocCacheName a (Just s) = toName ('c':fromAtom a ++ "@" ++ fromAtom s)
 
 bool b x y = if b then x else y
 
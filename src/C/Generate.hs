@@ -80,6 +80,8 @@ import Data.List(intersperse)
 import Data.Maybe(isNothing)
 import Numeric
 import Text.PrettyPrint.HughesPJ(Doc,render,nest,($$),($+$))
+import qualified Data.ByteString as BS
+import qualified Data.ByteString.UTF8 as BSU
 import qualified Data.Foldable as Seq
 import qualified Data.Map as Map
 import qualified Data.Sequence as Seq
@@ -347,8 +349,20 @@ uoperator o x = expDC (text o <> pdraw x)
 constant :: Constant -> Expression
 constant c = expD (draw c)
 
+-- | a C string literal of s encoded as UTF-8. Anything but printable ASCII
+-- is written as a three digit octal escape, which unlike a hex escape can
+-- not run on into the character after it.
 string :: String -> Expression
-string s = Exp hintPtr (ED (return $ text (show s))) -- TODO, use C quoting conventions
+string s = Exp hintPtr (ED (return $ text (cQuote s)))
+
+cQuote :: String -> String
+cQuote s = '"' : concatMap f (BS.unpack (BSU.fromString s)) ++ "\"" where
+    f w | c == '"' || c == '\\' = ['\\',c]
+        | c == '?' = "\\?"    -- no trigraphs
+        | w >= 0x20 && w < 0x7f = [c]
+        | otherwise = '\\' : pad (showOct w "")
+        where c = chr (fromIntegral w)
+    pad o = replicate (3 - length o) '0' ++ o
 
 nullPtr = Exp hintPtr (ED $ text "NULL")
 
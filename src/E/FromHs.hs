@@ -939,7 +939,7 @@ convertMatches bs ms err = do
     match bs ms err
 
 packupString :: String -> (E,Bool)
-packupString s | all (\c -> c > '\NUL' && c <= '\xff') s = (EPrim (PrimString (packString s)) [] r_bits_ptr_,True)
+packupString s | all (> '\NUL') s = (EPrim (PrimString (packString s)) [] r_bits_ptr_,True)
 packupString s = (toE s,False)
 
 actuallySpecializeE :: Monad m
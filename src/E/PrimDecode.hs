@@ -70,6 +70,7 @@ plainPrimMap = Map.fromList
     , "newArray__"     ==> hash +> star +> state +> utup state array
     , "newBlankArray__"==> hash +> state +> utup state array
     , "copyArray__"    ==> hash +> hash +> hash +> array +> array +> state +> state
+    , "fillArray__"    ==> hash +> hash +> star +> array +> state +> state
     , "readArray__"    ==> array +> hash +> state +> utup state star
     , "writeArray__"   ==> array +> hash +> star +> state +> state
     , "indexArray__"   ==> array +> hash +> utup1 star
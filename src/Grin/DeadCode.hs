@@ -128,6 +128,9 @@ go fixer pappFuncs suspFuncs usedFuncs usedArgs usedCafs postInline (fn,as :-> b
                        | otherwise = sValue usedVars v
             f e = g e >> return e
             g (BaseOp Eval [e]) =  addRule (doNode e)
+            g (BaseOp (EvalKnown t) [e]) | Just a <- tagToFunction t = do
+                addRule (doNode e)
+                addRule $ fn' `implies` sValue usedFuncs a
             g (BaseOp Apply {} vs) =  addRule (mconcatMap doNode vs)
             g (Case e _) =  addRule (doNode e)
             g Prim { expArgs = as } = addRule (mconcatMap doNode as)
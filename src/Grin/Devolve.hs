@@ -8,6 +8,7 @@ import Data.Maybe
 import qualified Data.Map as Map
 import qualified Data.Set as Set
 
+import C.Prims(Prim(..),Safety(..))
 import Grin.Grin
 import Grin.Noodle
 import Options (verbose,fopts)
@@ -120,6 +121,7 @@ twiddleExp e = f e where
 
     isAllocing (BaseOp StoreNode {} _) = True
     isAllocing (BaseOp Eval {} _) = True
+    isAllocing (BaseOp EvalKnown {} _) = True
     isAllocing (Return [Var {}]) = False
     isAllocing (Return [NodeC {}]) = True
     isAllocing App {} = True
@@ -127,6 +129,9 @@ twiddleExp e = f e where
     isAllocing Let {} = True
     isAllocing (Case _ as) = any isAllocing [ b | _ :-> b <- as]
     isAllocing Alloc {} = True
+    -- a safe foreign call may collect, performGC does and with -fthreaded
+    -- so does anything that blocks.
+    isAllocing (Prim Func { primSafety = Safe } _ _) = True
     isAllocing (e :>>= _ :-> y) = isAllocing e || isAllocing y
     isAllocing _ = False
 
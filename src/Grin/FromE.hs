@@ -429,6 +429,10 @@ compile' cenv (tvr,as,e) = ans where
         f "writeArray__" [r,o,v,_] = do
             let [r',o',v'] = args [r,o,v]
             return $ BaseOp PokeVal [(Index r' o'),v']
+        f "copyArray__" [so,doff,n,src,dst,_] = do
+            return $ Prim (arrayFunc "jhc_array_copy" ["unsigned","unsigned","unsigned","HsPtr","HsPtr"]) (args [so,doff,n,src,dst]) []
+        f "fillArray__" [o,n,v,r,_] = do
+            return $ Prim (arrayFunc "jhc_array_fill" ["unsigned","unsigned","HsPtr","HsPtr"]) (args [o,n,v,r]) []
         -- rts
         f "toBang_" (args -> [x]) = do
             return $ if getType x == tyDNode then Return [x] else gEval x
@@ -440,6 +444,10 @@ compile' cenv (tvr,as,e) = ans where
             return $ Alloc { expValue = ValUnknown (TyPrim Op.bits_ptr),
                 expCount = c, expRegion = region_atomic_heap, expInfo = mempty } :>>= [v] :-> BaseOp (Coerce tyDNode) [v]
         f p xs = fail $ "Grin.FromE - Unknown primitive: " ++ show (p,xs)
+        -- the bulk array operations are loops in the rts that neither
+        -- allocate nor call back into haskell.
+        arrayFunc name ts = Func { primRequires = mempty, funcName = name,
+            primArgTypes = ts, primRetType = "void", primRetArgs = [], primSafety = Unsafe }
 
     -- other primitives
     ce (EPrim ap xs ty) = do
@@ -95,6 +95,7 @@ data BaseOp
     = Demote                -- turn a node into an inode, always okay
     | Promote               -- turn an inode into a node, the inode _must_ already be a valid node
     | Eval                  -- evaluate an inode, returns a node representing the evaluated value. Bool is whether to update the inode
+    | EvalKnown Atom        -- like Eval, but the only suspension the inode can hold is the given suspended function tag
     | Apply [Ty]            -- apply a partial application to a value, returning the given type
     | StoreNode !Bool       -- create a new node, Bool is true if it should be a direct node, the second val is the region
     | Redirect              -- write an indirection over its first argument to point to its second one
@@ -455,6 +456,7 @@ instance CanType Exp where
     getType (BaseOp Promote _) = [TyNode]
     getType (BaseOp Demote _) = [TyINode]
     getType (BaseOp Eval _) = [TyNode]
+    getType (BaseOp EvalKnown {} _) = [TyNode]
     getType (BaseOp (StoreNode b) _) = if b then [TyNode] else [TyINode]
     getType (BaseOp NewRegister xs) = map (TyRegister . getType) xs
     getType (BaseOp WriteRegister _) = []
@@ -129,6 +129,7 @@ printDL h n fs e = f fs e where
 --    f [Right (Var b _)] (Store (NodeC n vs)) = hPrintf h "store(%s,%s,%s).\n" (dshow b) (dshow n) (if tagIsWHNF n then "true" else "false") >> app n vs
 --    f [b] (Store x@Var {}) = do assign "demote" b x
     f [b] (BaseOp Eval [x]) = do assign "eval" b x
+    f [b] (BaseOp EvalKnown {} [x]) = do assign "eval" b x
     f b (App fn as ty) = do
         forM_ (zip naturals as) $ \ (i,a) -> do
             assign "assign" (Left $ funArg fn i) a
@@ -250,6 +251,10 @@ tcExp e = f e where
         v' <- tcVal v
         if v' == tyINode then return [TyNode]
          else tcErr $ "App eval arg doesn't match: " ++ show ap
+    f ap@(BaseOp (EvalKnown t) [v]) = do
+        v' <- tcVal v
+        if v' == tyINode && tagIsSuspFunction t then return [TyNode]
+         else tcErr $ "App eval arg doesn't match: " ++ show ap
     f a@(App fn as t) = do
         te <- asks envTyEnv
         (as',t') <- findArgsType te fn
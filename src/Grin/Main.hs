@@ -113,18 +113,21 @@ compileGrinToC grin = do
            ("rts/jhc_rts.c",jhc_rts_c),
            ("rts/jhc_rts.h",jhc_rts_h),
            ("rts/profile.c",profile_c),
+           ("rts/region.c",region_c),
            ("rts/profile.h",profile_h),
            ("rts/rts_support.c",rts_support_c),
            ("rts/rts_support.h",rts_support_h),
         --   ("rts/slub.c",slub_c),
            ("rts/stableptr.c",stableptr_c),
+           ("rts/threads.c",threads_c),
+           ("rts/threads.h",threads_h),
            ("sys/bitarray.h",bitarray_h),
            ("sys/queue.h",queue_h),
            ("sys/wsize.h",wsize_h)] $ \ (fn,bs) -> do
         fileInTempDir fn $ flip BS.writeFile bs
     let cFiles = ["rts/profile.c", "rts/rts_support.c", "rts/gc_none.c",
                   "rts/jhc_rts.c", "lib/lib_cbits.c", "rts/gc_jgc.c",
-                  "rts/stableptr.c"]
+                  "rts/region.c", "rts/stableptr.c", "rts/threads.c"]
     tdir <- getTempDir
     ds <- iocatch (getDirectoryContents (tdir FP.</> "cbits")) (\_ -> return [])
     let extraCFiles = map (tdir FP.</>) cFiles ++ ["-I" ++ tdir ++ "/cbits", "-I" ++ tdir ] ++ [ tdir FP.</> "cbits" FP.</> fn | fn@(reverse -> 'c':'.':_) <- ds ]
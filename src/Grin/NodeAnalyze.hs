@@ -23,6 +23,7 @@ import Util.Gen
 import Util.SetLike
 import Util.UnionSolve
 import Util.UniqueMonad
+import qualified FlagOpts as FO
 import qualified Stats
 
 data NodeType
@@ -194,6 +195,8 @@ doFunc (name,arg :-> body) = ans where
             | TodoNothing <- ret = mapM_ (fl TodoNothing) as
         f (BaseOp Eval [x]) = do
             dres [Right (N WHNF Top)]
+        f (BaseOp EvalKnown {} [x]) = do
+            dres [Right (N WHNF Top)]
         f (BaseOp (Apply ty) xs) = do
             mapM_ convertVal xs
             dunno ty
@@ -378,7 +381,15 @@ fixupfs cmap tyEnv l = tickleM f (l::Lam) where
             pstuff "eval" arg n
             Stats.mtick (toAtom "Optimize.NodeAnalyze.eval-promote")
             return (BaseOp Promote [arg])
+        N Lazy (Only set) | fopts FO.KnownEval, [t] <- filter tagIsSuspFunction (Set.toList set) -> do
+            pstuff "eval" arg n
+            Stats.mtick (toAtom "Optimize.NodeAnalyze.eval-known")
+            return (BaseOp (EvalKnown t) [arg])
         _ -> return a
+    f a@(BaseOp EvalKnown {} [arg]) | Just n@(N WHNF _) <- lupVar arg = do
+        pstuff "eval" arg n
+        Stats.mtick (toAtom "Optimize.NodeAnalyze.eval-promote")
+        return (BaseOp Promote [arg])
     f a@(BaseOp (Apply ty) (papp:args)) | Just nn <- lupVar papp = case nn of
         N WHNF tset | Only set <- tset, [sv] <- Set.toList set, TagPApp n fn <- tagInfo sv, Just (ts,_) <- findArgsType tyEnv sv -> do
             pstuff "apply" papp nn
@@ -3,6 +3,7 @@ module Grin.Noodle where
 -- various routines for manipulating and exploring grin code.
 
 import Control.Monad.Writer
+import qualified Data.Map as Map
 import qualified Data.Set as Set
 
 import C.Prims
@@ -257,3 +258,46 @@ getReturnInfo  e = ans where
 
 mapGrinFuncsM :: Monad m => (Atom -> Lam -> m Lam) -> Grin -> m Grin
 mapGrinFuncsM f grin = liftM (`setGrinFunctions` grin) $ mapM  (\x -> do nb <- f (funcDefName x) (funcDefBody x); return (funcDefName x, nb)) (grinFunctions grin)
+
+-- | Suspensions bound to a variable whose only use is to be evaluated, at
+-- most once along any path. Nothing else can see such a thunk so its result
+-- never needs to be written back. Local functions may run any number of
+-- times so uses inside them do not count as single.
+singleEntryThunks :: Exp -> Set.Set Var
+singleEntryThunks body = Set.fromList [ v | v <- thunks, Map.lookup v uses == Just 1, v `Set.member` evals, not (v `Set.member` others) ] where
+    uses = varUses body
+    (thunks,evals',others') = execWriter (f body)
+    evals = Set.fromList evals'
+    others = Set.fromList others'
+    f (BaseOp (StoreNode False) (NodeC t as:_) :>>= [Var v _] :-> e') | tagIsSuspFunction t = tell ([v],[],valVars as) >> f e'
+    f (e :>>= _ :-> e') = f e >> f e'
+    f (BaseOp Eval [Var v _]) = tell ([],[v],[])
+    f (BaseOp EvalKnown {} [Var v _]) = tell ([],[v],[])
+    f (Case v ls) = tell ([],[],valVars [v]) >> Prelude.mapM_ f [ e | _ :-> e <- ls ]
+    f (GcRoots _ e) = f e
+    f Let { expDefs = ds, expBody = e } = tell ([],[],Set.toList (freeVars (map funcDefBody ds) :: Set.Set Var)) >> f e
+    f e = tell ([],[],Map.keys (varUses e))
+
+-- | how many times each variable may be used along a single path through the
+-- expression, anything not understood counts as used many times.
+varUses :: Exp -> Map.Map Var Int
+varUses (e :>>= _ :-> e') = Map.unionWith (+) (varUses e) (varUses e')
+varUses (Case v ls) = Map.unionWith (+) (valUses [v]) (Map.unionsWith max [ varUses e | _ :-> e <- ls ])
+varUses (GcRoots _ e) = varUses e  -- roots only keep values alive
+varUses (Return vs) = valUses vs
+varUses Error {} = Map.empty
+varUses e@BaseOp {} = valUses (expArgs e)
+varUses e@App {} = valUses (expArgs e)
+varUses e@Prim {} = valUses (expArgs e)
+varUses e = Map.fromList [ (v,2) | v <- Set.toList (freeVars e) ]
+
+valUses :: [Val] -> Map.Map Var Int
+valUses vs = Map.fromListWith (+) [ (v,1) | v <- valVars vs ]
+
+valVars :: [Val] -> [Var]
+valVars vs = concatMap f vs where
+    f (Var v _) = [v]
+    f (NodeC _ as) = concatMap f as
+    f (Index a b) = f a ++ f b
+    f (ValPrim _ as _) = concatMap f as
+    f _ = []
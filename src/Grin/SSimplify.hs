@@ -131,6 +131,7 @@ simpBind p e cont = f p e where
          else return $ e :>>= (p :-> z)
     cse' name xs = cse name ((e,Return p):xs)
     f p app@(BaseOp Eval [v]) =  cse' "Simplify.CSE.eval" [(BaseOp Promote [v],Return p)]
+    f p app@(BaseOp EvalKnown {} [v]) =  cse' "Simplify.CSE.eval" [(BaseOp Promote [v],Return p),(gEval v,Return p)]
     f p (BaseOp Promote [v@Var {}]) =  cse' "Simplify.CSE.promote" [(gEval v,Return p)]
     f [p] (BaseOp Demote [v@Var {}]) =  cse' "Simplify.CSE.demote" [(BaseOp Promote [p],Return [v]),(gEval p,Return [v])]
     f [p@(Var (V vn) _)] (BaseOp (StoreNode isD) [v@(NodeC t vs)]) | not (isHoly v) = case (isD,tagUnfunction t,tagIsWHNF t) of
@@ -166,6 +167,7 @@ simpExp e = f e [] where
 --    f (Store x) rs | valIsNF x = do
 --        mtick "Grin.Simplify.store-normalform"
 --        f (Return [Const x]) rs
+    f (BaseOp EvalKnown {} [c@Const {}]) rs = f (gEval c) rs
     f (BaseOp Eval [Const n]) rs = do
         mtick "Grin.Simplify.eval-const"
         f (Return [n]) rs
@@ -49,7 +49,7 @@ instance Show Vr where
 
 {-# NOINLINE storeAnalyze #-}
 storeAnalyze :: Grin -> IO Grin
-storeAnalyze grin | fopts FO.Jgc = return grin
+storeAnalyze grin | fopts FO.Jgc || not (fopts FO.StackAlloc) = return grin
 storeAnalyze grin = do
     --dumpGrin "storeAnalyze1" grin
     let (grin',cs) = execUniq1 $ runWriterT (mapGrinFuncsM firstLam grin)
@@ -69,7 +69,8 @@ storeAnalyze grin = do
         fm (Vr _) _ = True
         fm (Va _ _) _ = True
         fm _ _ = False
-    mapM_ (\ (x,y) -> putStrLn $ show x ++ " -> " ++ show y) (Map.toList cmap)
+    putProgressLn $ "Storage analysis: " ++ show (length [ () | (Vr _,S) <- Map.toList cmap ]) ++ " of " ++
+        show (length [ () | Vr _ <- Map.keys rm ]) ++ " node stores allocated on the stack"
     let grin'' = runIdentity $ tickleM (lastLam cmap) grin'
     return grin''
 
@@ -78,38 +79,59 @@ isHeap TyINode = True
 --isHeap TyPtr {} = True
 isHeap _ = False
 
-firstLam fname lam = g Nothing fname lam where
-    g wtd fname (as :-> body) = do
+-- A node can be allocated in the C frame of the function that stores it
+-- unless it escapes, by being returned, passed to something that lets it
+-- escape, stored in a node that escapes or read back out of such a node.
+--
+-- Local functions are labels inside the C function of their parent, so a
+-- store in a local function that loops reuses the same stack slot. Nodes
+-- passed to a local function might be live across such a loop and so are
+-- kept on the heap.
+firstLam fname lam = g Set.empty Nothing fname lam where
+    g locals wtd fname (as :-> body) = do
         tell $ mconcat [ Left (Vb v) `equals` Left (Va fname n) | (n,Var v t) <- zip naturals as, isHeap t ]
         let f wtd (BaseOp (StoreNode sh) [n@(NodeC _ vs)]) = do
                 vu <- V `liftM` newUniq
-                g wtd [[Vr vu]]
+                h wtd [[Vr vu]]
                 tell $ mconcat [ Left (Vr vu) `islte` Left v | v' <- toVs vs, v <- v'  ]
                 return (BaseOp (StoreNode sh) [n,Var vu TyRegion])
             f wtd (e :>>= as :-> body) = do
                 e' <- f (Just as) e
                 body' <- f wtd body
                 return (e' :>>= as :-> body')
-            f wtd (Case e as) = Case e `liftM` mapM (tickleM  (f wtd)) as
-            f wtd (Return xs) = g wtd (toVs xs) >> return (Return xs)
-            f wtd e@(BaseOp Promote xs) = g wtd (toVs xs) >> return e
-            f wtd e@(BaseOp Demote xs) = g wtd (toVs xs) >> return e
-            f wtd e@(BaseOp Redirect xs) = g Nothing (toVs xs) >> return e
+            f wtd (Case e as) = do
+                -- anything bound by a pattern was read out of the scrutinee.
+                tell $ mconcat [ Left x `islte` Left s | s <- concat (toVs [e]), ps :-> _ <- as, x <- concat (toVs ps) ]
+                Case e `liftM` mapM (tickleM  (f wtd)) as
+            f wtd (Return xs) = h wtd (toVs xs) >> return (Return xs)
+            f wtd e@(BaseOp Promote xs) = h wtd (toVs xs) >> return e
+            f wtd e@(BaseOp Demote xs) = h wtd (toVs xs) >> return e
+            f wtd e@(BaseOp Redirect xs) = h Nothing (toVs xs) >> return e
             f wtd e@(BaseOp Overwrite [Var v _,n]) = do tell $ mconcat [ Left (Vb v) `islte` Left r | r <- concat $ toVs [n] ] ; return e
-            f wtd e@(App fn vs ty) = do
-                tell $ mconcat [ Left (Va fn n) `islte` Left (Vb v) | (n,Var v t) <- zip naturals vs, isHeap t ]
-                return e
-            f wtd e@(Let { expDefs = defs, expBody = b }) = do
-                defs' <- mapM (tickleM (g' wtd)) defs
-                b <- f wtd b
+            f wtd e@(App fn vs ty)
+                | fn `Set.member` locals = do
+                    tell $ mconcat [ Right E `islte` Left v | v <- concat (toVs vs) ]
+                    return e
+                | otherwise = do
+                    tell $ mconcat [ Left (Va fn n) `islte` Left (Vb v) | (n,Var v t) <- zip naturals vs, isHeap t ]
+                    return e
+            f wtd e@(Let { expDefs = defs, expBody = b, expNonNormal = nn }) = do
+                let locals' = locals `Set.union` Set.fromList (map funcDefName defs)
+                    -- a local function called in non tail position returns to
+                    -- its caller rather than to the continuation of the let.
+                    g' (fname,b) = do
+                        b <- g locals' (if fname `Set.member` nn then Nothing else wtd) fname b
+                        return (fname,b)
+                defs' <- mapM (tickleM g') defs
+                _ :-> b <- g locals' wtd fname ([] :-> b)
                 return $ updateLetProps e { expDefs = defs', expBody = b }
             f wtd e =  do
                 let zs = Set.toList (Set.map (Vb . fst) $ Set.filter (isHeap . snd) (freeVars e))
                 tell $ mconcat [ Right E `islte` Left r | r <- zs ];
                 return e
 
-            g Nothing vs = tell $ mconcat [ Right E `islte` Left v | v' <- vs, v <- v' ]
-            g (Just as) vs = tell $ mconcat [ Left a `islte` Left v | (a',v') <- zip (toVs as) vs, a <- a', v <- v']
+            h Nothing vs = tell $ mconcat [ Right E `islte` Left v | v' <- vs, v <- v' ]
+            h (Just as) vs = tell $ mconcat [ Left a `islte` Left v | (a',v') <- zip (toVs as) vs, a <- a', v <- v']
 
             toVs :: [Val] -> [[Vr]]
             toVs xs = f xs [] where
@@ -117,9 +139,6 @@ firstLam fname lam = g Nothing fname lam where
                 f (x:xs) rs = f xs (Set.toList (Set.map (Vb . fst) $ Set.filter (isHeap . snd) (freeVars x)):rs)
         b <- f wtd body
         return (as :-> b)
-    g' wtd (fname,b) = do
-        b <- g wtd fname b
-        return (fname,b)
 
 lastLam :: Map.Map Vr T -> Lam -> Identity Lam
 lastLam cmap  lam = tickleM f lam where
@@ -79,9 +79,16 @@ fetchCompilerFlags = return (cc,args) where
     lup k = maybe "" id $ Map.lookup k (optInis options)
     boehmOpts | fopts FO.Boehm = ["-D_JHC_GC=_JHC_GC_BOEHM", "-lgc"]
               | fopts FO.Jgc   = ["-D_JHC_GC=_JHC_GC_JGC"]
+              | fopts FO.Region = ["-D_JHC_GC=_JHC_GC_REGION"]
               | otherwise = []
     profileOpts | fopts FO.Profile || lup "profile" == "true" = ["-D_JHC_PROFILE=1"]
                 | otherwise = []
+    allocProfileOpts | fopts FO.AllocProfile = ["-D_JHC_ALLOC_PROFILE=1"]
+                     | otherwise = []
+    blackholeOpts | fopts FO.EagerBlackhole = ["-D_JHC_EAGER_BLACKHOLE=1"]
+                  | otherwise = []
+    threadedOpts | fopts FO.Threaded = ["-D_JHC_THREADED=1", "-pthread"]
+                 | otherwise = []
     debug = if fopts FO.Debug then words (lup "cflags_debug") else words (lup "cflags_nodebug")
     cc = lup "cc"
-    args = words (lup "cflags") ++ debug ++ optCCargs options  ++ boehmOpts ++ profileOpts
+    args = words (lup "cflags") ++ debug ++ optCCargs options  ++ boehmOpts ++ profileOpts ++ allocProfileOpts ++ blackholeOpts ++ threadedOpts
@@ -167,6 +167,13 @@ Define                             Meaning
 \_JHC\_JGC\_FIXED\_MEGABLOCK       use a single megablock without allocation megablock.
 \_JHC\_JGC\_BLOCK\_SHIFT           bit shift to specify block size. Use it internally like this: (1 << (_JHC_JGC_BLOCK_SHIFT)).
 \_JHC\_JGC\_MEGABLOCK\_SHIFT       bit shift to specify megablock size. Use it internally like this: (1 << (_JHC_JGC_MEGABLOCK_SHIFT)).
+\_JHC\_EAGER\_BLACKHOLE            black hole thunks under evaluation in release builds, set by -feager-blackhole.
+\_JHC\_REGION\_PAGE\_SHIFT         bit shift to specify the page size of the region allocator selected by -fregion, 12 by default.
+\_JHC\_ARENA\_POISON               overwrite memory freed by an arena reset so escaping pointers are caught, on unless NDEBUG is set.
+\_JHC\_MEM\_CHUNK\_SHIFT           bit shift to specify the chunk size of the default allocator, 20 by default. Requests over an eighth of a chunk are mapped separately.
+\_JHC\_THREADED                    use the threaded runtime, set by -fthreaded. Needs jgc and pthreads.
+\_JHC\_WORKERS                     number of worker OS threads running green threads with -fthreaded, one per processor by default.
+\_JHC\_THREAD\_STACK\_SHIFT        bit shift to specify the stack size of a green thread, 19 by default. The gc stack and the C stack share it.
 
 -}
 
@@ -223,6 +230,18 @@ processOptions = do
             Just "boehm" -> optFOptsSet_u (S.insert FO.Boehm) o
             _ -> o
     o2 <- either putErrDie return $ postProcessFO o1
+    -- a collector chosen with -fboehm or -fregion replaces the ini default,
+    -- and only jgc knows how to collect with several threads running or
+    -- takes allocation samples.
+    let fset = optFOptsSet o2
+        other = filter (`S.member` fset) [FO.Boehm, FO.Region]
+        needJgc = [ n | (f,n) <- [(FO.Threaded,"threaded"),(FO.AllocProfile,"alloc-profile")], f `S.member` fset ]
+    when (not (null other) && not (null needJgc)) $
+        putErrDie $ "-f" ++ head needJgc ++ " can only be used with the jgc garbage collector"
+    o2 <- return $ case () of
+        _ | not (null other) -> optFOptsSet_u (S.delete FO.Jgc) o2
+          | not (null needJgc) -> optFOptsSet_u (S.insert FO.Jgc) o2
+          | otherwise -> o2
 
     -- add autoloads based on ini options
     let autoloads = maybe [] (tokens (',' ==)) (M.lookup "autoload" inis)